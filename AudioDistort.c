@@ -0,0 +1,282 @@
+#include <pthread.h>
+#include <string.h>
+#include "Checksum.h"
+#include "AudioDistort.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AUDIO_DISTORT_X86 1
+#include <immintrin.h>
+#endif
+
+// Rounding quantizer shared by every width: add half a step, clamp, clear the low bits
+static int64_t quantize(int64_t sample, unsigned int bits, int64_t minimum, int64_t maximum) {
+    int64_t rounded = sample + ((int64_t)1 << (bits - 1));
+    if (rounded > maximum) {
+        rounded = maximum;
+    }
+    if (rounded < minimum) {
+        rounded = minimum;
+    }
+    return rounded & ~(((int64_t)1 << bits) - 1);
+}
+
+// 8-bit PCM is unsigned, centred on 128
+void reduceBits8Scalar(uint8_t *samples, size_t count, unsigned int bits) {
+    for (size_t i = 0; i < count; i++) {
+        samples[i] = quantize(samples[i], bits, 0, 0xFF);
+    }
+}
+
+void reduceBits16Scalar(uint8_t *samples, size_t count, unsigned int bits) {
+    for (size_t i = 0; i < count; i++) {
+        int16_t sample = (int16_t)(samples[2 * i] | (samples[2 * i + 1] << 8));
+        uint16_t result = quantize(sample, bits, INT16_MIN, INT16_MAX);
+        samples[2 * i] = result & 0xFF;
+        samples[2 * i + 1] = result >> 8;
+    }
+}
+
+static void reduceBits24Scalar(uint8_t *samples, size_t count, unsigned int bits) {
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *bytes = samples + 3 * i;
+        int32_t sample = (int32_t)((uint32_t)bytes[0] << 8 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 24) >> 8;
+        uint32_t result = quantize(sample, bits, -(1 << 23), (1 << 23) - 1);
+        bytes[0] = result & 0xFF;
+        bytes[1] = (result >> 8) & 0xFF;
+        bytes[2] = (result >> 16) & 0xFF;
+    }
+}
+
+static void reduceBits32Scalar(uint8_t *samples, size_t count, unsigned int bits) {
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *bytes = samples + 4 * i;
+        int32_t sample = (int32_t)(bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24);
+        uint32_t result = quantize(sample, bits, INT32_MIN, INT32_MAX);
+        bytes[0] = result & 0xFF;
+        bytes[1] = (result >> 8) & 0xFF;
+        bytes[2] = (result >> 16) & 0xFF;
+        bytes[3] = result >> 24;
+    }
+}
+
+#ifdef AUDIO_DISTORT_X86
+// Saturating add of half a step, then a mask; unaligned loads since blocks start anywhere
+__attribute__((target("sse2")))
+void reduceBits8Sse2(uint8_t *samples, size_t count, unsigned int bits) {
+    __m128i half = _mm_set1_epi8((char)(1 << (bits - 1)));
+    __m128i mask = _mm_set1_epi8((char)(0xFF << bits));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(samples + i));
+        _mm_storeu_si128((__m128i *)(samples + i), _mm_and_si128(_mm_adds_epu8(v, half), mask));
+    }
+    reduceBits8Scalar(samples + i, count - i, bits);
+}
+
+__attribute__((target("avx2")))
+void reduceBits8Avx2(uint8_t *samples, size_t count, unsigned int bits) {
+    __m256i half = _mm256_set1_epi8((char)(1 << (bits - 1)));
+    __m256i mask = _mm256_set1_epi8((char)(0xFF << bits));
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(samples + i));
+        _mm256_storeu_si256((__m256i *)(samples + i), _mm256_and_si256(_mm256_adds_epu8(v, half), mask));
+    }
+    reduceBits8Scalar(samples + i, count - i, bits);
+}
+
+__attribute__((target("sse2")))
+void reduceBits16Sse2(uint8_t *samples, size_t count, unsigned int bits) {
+    __m128i half = _mm_set1_epi16((short)(1 << (bits - 1)));
+    __m128i mask = _mm_set1_epi16((short)(0xFFFF << bits));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(samples + 2 * i));
+        _mm_storeu_si128((__m128i *)(samples + 2 * i), _mm_and_si128(_mm_adds_epi16(v, half), mask));
+    }
+    reduceBits16Scalar(samples + 2 * i, count - i, bits);
+}
+
+__attribute__((target("avx2")))
+void reduceBits16Avx2(uint8_t *samples, size_t count, unsigned int bits) {
+    __m256i half = _mm256_set1_epi16((short)(1 << (bits - 1)));
+    __m256i mask = _mm256_set1_epi16((short)(0xFFFF << bits));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(samples + 2 * i));
+        _mm256_storeu_si256((__m256i *)(samples + 2 * i), _mm256_and_si256(_mm256_adds_epi16(v, half), mask));
+    }
+    reduceBits16Scalar(samples + 2 * i, count - i, bits);
+}
+#else
+void reduceBits8Sse2(uint8_t *samples, size_t count, unsigned int bits) { reduceBits8Scalar(samples, count, bits); }
+void reduceBits8Avx2(uint8_t *samples, size_t count, unsigned int bits) { reduceBits8Scalar(samples, count, bits); }
+void reduceBits16Sse2(uint8_t *samples, size_t count, unsigned int bits) { reduceBits16Scalar(samples, count, bits); }
+void reduceBits16Avx2(uint8_t *samples, size_t count, unsigned int bits) { reduceBits16Scalar(samples, count, bits); }
+#endif
+
+typedef void (*ReduceBitsFn)(uint8_t *, size_t, unsigned int);
+
+static ReduceBitsFn reduceBits8Impl = reduceBits8Scalar;
+static ReduceBitsFn reduceBits16Impl = reduceBits16Scalar;
+static pthread_once_t dispatchOnce = PTHREAD_ONCE_INIT;
+
+static void initDispatch(void) {
+#ifdef AUDIO_DISTORT_X86
+    __builtin_cpu_init();
+    reduceBits8Impl = cpuHasAvx2() ? reduceBits8Avx2 : reduceBits8Sse2;
+    reduceBits16Impl = cpuHasAvx2() ? reduceBits16Avx2 : reduceBits16Sse2;
+#endif
+}
+
+void reduceBitDepth(uint8_t *samples, size_t count, unsigned int bitsPerSample, unsigned int bits) {
+    if (bits >= bitsPerSample) {
+        bits = bitsPerSample - 1;
+    }
+    if (bits == 0) {
+        return;
+    }
+
+    pthread_once(&dispatchOnce, initDispatch);
+    switch (bitsPerSample) {
+        case 8:
+            reduceBits8Impl(samples, count, bits);
+            break;
+        case 16:
+            reduceBits16Impl(samples, count, bits);
+            break;
+        case 24:
+            reduceBits24Scalar(samples, count, bits);
+            break;
+        case 32:
+            reduceBits32Scalar(samples, count, bits);
+            break;
+    }
+}
+
+#define WAV_STATE_HEADER 0
+#define WAV_STATE_DATA 1
+#define WAV_STATE_PASSTHROUGH 2
+
+static uint32_t readLe32(const uint8_t *bytes) {
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// Walk the buffered header: 1 once the data chunk starts (offset in *dataOffset),
+// 0 if more bytes are needed, -1 if this is not PCM WAV we can process
+static int parseWavHeader(WavDistortStream *stream, size_t *dataOffset) {
+    const uint8_t *header = stream->header;
+    size_t length = stream->headerLength;
+
+    if (length < 12) {
+        return (memcmp(header, "RIFF", length < 4 ? length : 4) == 0) ? 0 : -1;
+    }
+    if (memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+        return -1;
+    }
+
+    int formatSeen = 0;
+    size_t offset = 12;
+    while (offset + 8 <= length) {
+        uint32_t chunkSize = readLe32(header + offset + 4);
+
+        if (memcmp(header + offset, "data", 4) == 0) {
+            if (!formatSeen) {
+                return -1;
+            }
+            stream->dataRemaining = chunkSize;
+            *dataOffset = offset + 8;
+            return 1;
+        }
+        if (memcmp(header + offset, "fmt ", 4) == 0) {
+            if (offset + 8 + 16 > length) {
+                return 0;
+            }
+            uint16_t format = header[offset + 8] | (header[offset + 9] << 8);
+            uint16_t bits = header[offset + 22] | (header[offset + 23] << 8);
+            // PCM, or WAVE_FORMAT_EXTENSIBLE which this treats as PCM
+            if ((format != 1 && format != 0xFFFE) || (bits != 8 && bits != 16 && bits != 24 && bits != 32)) {
+                return -1;
+            }
+            stream->bitsPerSample = bits;
+            formatSeen = 1;
+        }
+        offset += 8 + chunkSize + (chunkSize & 1); // Chunks are padded to even sizes
+    }
+    return 0;
+}
+
+void wavStreamInit(WavDistortStream *stream, unsigned int factor) {
+    memset(stream, 0, sizeof(*stream));
+    stream->state = WAV_STATE_HEADER;
+    stream->factor = factor;
+}
+
+size_t wavStreamDistort(WavDistortStream *stream, const uint8_t *input, size_t length, uint8_t *output, int final) {
+    size_t out = 0;
+    size_t position = 0;
+
+    while (position < length) {
+        if (stream->state == WAV_STATE_HEADER) {
+            size_t before = stream->headerLength;
+            size_t take = length - position;
+            if (take > WAV_HEADER_MAX - before) {
+                take = WAV_HEADER_MAX - before;
+            }
+            memcpy(stream->header + before, input + position, take);
+            stream->headerLength += take;
+
+            size_t dataOffset;
+            int parsed = parseWavHeader(stream, &dataOffset);
+            if (parsed == 1) {
+                // Header bytes pass through; the rest of this chunk is sample data
+                take = dataOffset - before;
+                stream->state = WAV_STATE_DATA;
+            } else if (parsed < 0 || stream->headerLength == WAV_HEADER_MAX) {
+                stream->state = WAV_STATE_PASSTHROUGH;
+            }
+            memcpy(output + out, input + position, take);
+            out += take;
+            position += take;
+        } else if (stream->state == WAV_STATE_DATA) {
+            size_t take = length - position;
+            if (take > stream->dataRemaining) {
+                take = stream->dataRemaining;
+            }
+            size_t sampleSize = stream->bitsPerSample / 8;
+
+            // Carried partial sample first, then whole samples in place; a new partial tail waits
+            memcpy(output + out, stream->carry, stream->carryLength);
+            memcpy(output + out + stream->carryLength, input + position, take);
+            size_t available = stream->carryLength + take;
+            size_t whole = available - available % sampleSize;
+            reduceBitDepth(output + out, whole / sampleSize, stream->bitsPerSample, stream->factor);
+
+            stream->carryLength = available - whole;
+            memcpy(stream->carry, output + out + whole, stream->carryLength);
+            out += whole;
+            position += take;
+            stream->dataRemaining -= take;
+
+            if (stream->dataRemaining == 0) {
+                // A data chunk with an odd size leaves a partial sample: emit it as is
+                memcpy(output + out, stream->carry, stream->carryLength);
+                out += stream->carryLength;
+                stream->carryLength = 0;
+                stream->state = WAV_STATE_PASSTHROUGH;
+            }
+        } else {
+            memcpy(output + out, input + position, length - position);
+            out += length - position;
+            position = length;
+        }
+    }
+
+    if (final && stream->carryLength > 0) {
+        // Truncated data chunk: the partial sample goes out untouched
+        memcpy(output + out, stream->carry, stream->carryLength);
+        out += stream->carryLength;
+        stream->carryLength = 0;
+    }
+    return out;
+}
@@ -0,0 +1,39 @@
+#ifndef AUDIO_DISTORT_H
+#define AUDIO_DISTORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Audio distortion: PCM samples lose their `bits` lowest bits (rounded to nearest, saturated).
+// 8-bit (unsigned) and 16-bit (signed LE) samples have SSE2/AVX2 kernels; 24/32-bit are scalar.
+void reduceBits8Scalar(uint8_t *samples, size_t count, unsigned int bits);
+void reduceBits8Sse2(uint8_t *samples, size_t count, unsigned int bits);
+void reduceBits8Avx2(uint8_t *samples, size_t count, unsigned int bits);
+void reduceBits16Scalar(uint8_t *samples, size_t count, unsigned int bits);
+void reduceBits16Sse2(uint8_t *samples, size_t count, unsigned int bits);
+void reduceBits16Avx2(uint8_t *samples, size_t count, unsigned int bits);
+
+// Dispatching entry point for any supported sample width (8, 16, 24, 32 bits)
+void reduceBitDepth(uint8_t *samples, size_t count, unsigned int bitsPerSample, unsigned int bits);
+
+// Streaming WAV distortion: the RIFF header and any chunk other than "data" pass through
+// unchanged, data is processed block by block with at most one partial sample carried over.
+// Input that is not PCM WAV passes through untouched.
+#define WAV_HEADER_MAX 4096
+
+typedef struct {
+    int state;
+    unsigned int factor;        // Bits removed from each sample (clamped to the sample width - 1)
+    uint8_t header[WAV_HEADER_MAX];
+    size_t headerLength;
+    uint64_t dataRemaining;
+    unsigned int bitsPerSample;
+    uint8_t carry[4];
+    size_t carryLength;
+} WavDistortStream;
+
+void wavStreamInit(WavDistortStream *stream, unsigned int factor);
+// output needs room for length + 4 bytes; final marks the last chunk (may be empty)
+size_t wavStreamDistort(WavDistortStream *stream, const uint8_t *input, size_t length, uint8_t *output, int final);
+
+#endif
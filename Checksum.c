@@ -0,0 +1,274 @@
+#include <pthread.h>
+#include <string.h>
+#include "Checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CHECKSUM_X86 1
+#include <immintrin.h>
+#endif
+
+// CRC32C (Castagnoli) polynomial, reflected
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crcTables[8][256];
+static pthread_once_t crcTablesOnce = PTHREAD_ONCE_INIT;
+
+// Build the slicing-by-8 tables: table[k][b] is the CRC of byte b followed by k zero bytes
+static void initCrcTables(void) {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crcTables[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            crcTables[k][b] = (crcTables[k - 1][b] >> 8) ^ crcTables[0][crcTables[k - 1][b] & 0xFF];
+        }
+    }
+}
+
+int cpuHasSse42(void) {
+#ifdef CHECKSUM_X86
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return 0;
+#endif
+}
+
+int cpuHasAvx2(void) {
+#ifdef CHECKSUM_X86
+    return __builtin_cpu_supports("avx2");
+#else
+    return 0;
+#endif
+}
+
+// Reference byte sum, one byte at a time
+uint32_t byteSumScalar(const uint8_t *bytes, size_t length) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum;
+}
+
+#ifdef CHECKSUM_X86
+// psadbw against zero adds 8 bytes into each 64-bit lane, 16 bytes per instruction
+__attribute__((target("sse2")))
+uint32_t byteSumSse2(const uint8_t *bytes, size_t length) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i total = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(bytes + i));
+        total = _mm_add_epi64(total, _mm_sad_epu8(block, zero));
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, total);
+    return (uint32_t)(lanes[0] + lanes[1]) + byteSumScalar(bytes + i, length - i);
+}
+
+__attribute__((target("avx2")))
+uint32_t byteSumAvx2(const uint8_t *bytes, size_t length) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(bytes + i));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(block, zero));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, total);
+    return (uint32_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]) + byteSumSse2(bytes + i, length - i);
+}
+
+#if defined(__x86_64__)
+// Blocks per stream of the 3-way interleaved CRC: long ones for 64 KB frames, short ones down to 768 bytes
+#define CRC32C_LONG 8192
+#define CRC32C_SHORT 256
+
+// shift[k][b]: byte b at position k of a CRC state, advanced over CRC32C_LONG/SHORT zero bytes
+static uint32_t crcLongShift[4][256];
+static uint32_t crcShortShift[4][256];
+static pthread_once_t crcShiftOnce = PTHREAD_ONCE_INIT;
+
+// GF(2) 32x32 matrix (one column per bit) times a vector
+static uint32_t gf2MatrixTimes(const uint32_t *matrix, uint32_t vector) {
+    uint32_t sum = 0;
+    for (; vector != 0; vector >>= 1, matrix++) {
+        if (vector & 1) {
+            sum ^= *matrix;
+        }
+    }
+    return sum;
+}
+
+static void gf2MatrixSquare(uint32_t *square, const uint32_t *matrix) {
+    for (int n = 0; n < 32; n++) {
+        square[n] = gf2MatrixTimes(matrix, matrix[n]);
+    }
+}
+
+// Operator feeding length zero bytes (a power of two) into a CRC state, by repeated squaring
+static void crcZerosOperator(uint32_t *even, size_t length) {
+    uint32_t odd[32];
+    odd[0] = CRC32C_POLY; // One zero bit
+    for (int n = 1; n < 32; n++) {
+        odd[n] = 1u << (n - 1);
+    }
+    gf2MatrixSquare(even, odd); // Two zero bits
+    gf2MatrixSquare(odd, even); // Four zero bits
+
+    // The first square gives one zero byte, each following one doubles it
+    while (1) {
+        gf2MatrixSquare(even, odd);
+        length >>= 1;
+        if (length == 0) {
+            return;
+        }
+        gf2MatrixSquare(odd, even);
+        length >>= 1;
+        if (length == 0) {
+            memcpy(even, odd, sizeof(odd));
+            return;
+        }
+    }
+}
+
+static void buildShiftTable(uint32_t table[][256], size_t length) {
+    uint32_t op[32];
+    crcZerosOperator(op, length);
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int k = 0; k < 4; k++) {
+            table[k][b] = gf2MatrixTimes(op, b << (8 * k));
+        }
+    }
+}
+
+static void initCrcShiftTables(void) {
+    buildShiftTable(crcLongShift, CRC32C_LONG);
+    buildShiftTable(crcShortShift, CRC32C_SHORT);
+}
+
+static inline uint32_t crcShift(uint32_t table[][256], uint32_t crc) {
+    return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+}
+
+// Three consecutive blocks on independent crc32 chains, so the instruction's latency is hidden;
+// the later chains start from zero and are merged by shifting the earlier state over one block
+__attribute__((target("sse4.2")))
+static uint64_t crc32cThreeWay(uint64_t crc0, const uint8_t *bytes, size_t block, uint32_t shift[][256]) {
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    for (size_t i = 0; i < block; i += 8) {
+        uint64_t word0, word1, word2;
+        memcpy(&word0, bytes + i, sizeof(word0));
+        memcpy(&word1, bytes + block + i, sizeof(word1));
+        memcpy(&word2, bytes + 2 * block + i, sizeof(word2));
+        crc0 = _mm_crc32_u64(crc0, word0);
+        crc1 = _mm_crc32_u64(crc1, word1);
+        crc2 = _mm_crc32_u64(crc2, word2);
+    }
+    crc0 = crcShift(shift, (uint32_t)crc0) ^ crc1;
+    return crcShift(shift, (uint32_t)crc0) ^ crc2;
+}
+#endif
+
+// SSE4.2 crc32 instruction, 8 bytes per step; on x86-64, buffers of 768 bytes and more run three streams at once
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(uint32_t crc, const uint8_t *bytes, size_t length) {
+    crc = ~crc;
+    size_t i = 0;
+
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    if (length >= 3 * CRC32C_SHORT) {
+        pthread_once(&crcShiftOnce, initCrcShiftTables);
+        for (; length - i >= 3 * CRC32C_LONG; i += 3 * CRC32C_LONG) {
+            crc64 = crc32cThreeWay(crc64, bytes + i, CRC32C_LONG, crcLongShift);
+        }
+        for (; length - i >= 3 * CRC32C_SHORT; i += 3 * CRC32C_SHORT) {
+            crc64 = crc32cThreeWay(crc64, bytes + i, CRC32C_SHORT, crcShortShift);
+        }
+    }
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+#endif
+    for (; i + 4 <= length; i += 4) {
+        uint32_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for (; i < length; i++) {
+        crc = _mm_crc32_u8(crc, bytes[i]);
+    }
+    return ~crc;
+}
+#else
+uint32_t byteSumSse2(const uint8_t *bytes, size_t length) {
+    return byteSumScalar(bytes, length);
+}
+
+uint32_t byteSumAvx2(const uint8_t *bytes, size_t length) {
+    return byteSumScalar(bytes, length);
+}
+
+uint32_t crc32cHardware(uint32_t crc, const uint8_t *bytes, size_t length) {
+    return crc32cTable(crc, bytes, length);
+}
+#endif
+
+// Portable slicing-by-8 CRC32C, 8 bytes per table round
+uint32_t crc32cTable(uint32_t crc, const uint8_t *bytes, size_t length) {
+    pthread_once(&crcTablesOnce, initCrcTables);
+    crc = ~crc;
+    size_t i = 0;
+
+    for (; i + 8 <= length; i += 8) {
+        uint32_t low = crc ^ ((uint32_t)bytes[i] | ((uint32_t)bytes[i + 1] << 8) |
+                              ((uint32_t)bytes[i + 2] << 16) | ((uint32_t)bytes[i + 3] << 24));
+        crc = crcTables[7][low & 0xFF] ^ crcTables[6][(low >> 8) & 0xFF] ^
+              crcTables[5][(low >> 16) & 0xFF] ^ crcTables[4][low >> 24] ^
+              crcTables[3][bytes[i + 4]] ^ crcTables[2][bytes[i + 5]] ^
+              crcTables[1][bytes[i + 6]] ^ crcTables[0][bytes[i + 7]];
+    }
+    for (; i < length; i++) {
+        crc = (crc >> 8) ^ crcTables[0][(crc ^ bytes[i]) & 0xFF];
+    }
+    return ~crc;
+}
+
+typedef uint32_t (*ByteSumFn)(const uint8_t *, size_t);
+typedef uint32_t (*Crc32cFn)(uint32_t, const uint8_t *, size_t);
+
+static ByteSumFn byteSumImpl = byteSumScalar;
+static Crc32cFn crc32cImpl = crc32cTable;
+static pthread_once_t dispatchOnce = PTHREAD_ONCE_INIT;
+
+static void initDispatch(void) {
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+    byteSumImpl = cpuHasAvx2() ? byteSumAvx2 : byteSumSse2;
+    crc32cImpl = cpuHasSse42() ? crc32cHardware : crc32cTable;
+#endif
+}
+
+uint32_t byteSum(const uint8_t *bytes, size_t length) {
+    pthread_once(&dispatchOnce, initDispatch);
+    return byteSumImpl(bytes, length);
+}
+
+uint32_t crc32c(uint32_t crc, const uint8_t *bytes, size_t length) {
+    pthread_once(&dispatchOnce, initDispatch);
+    return crc32cImpl(crc, bytes, length);
+}
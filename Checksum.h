@@ -0,0 +1,22 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Dispatching kernels: pick the fastest implementation the CPU supports
+uint32_t byteSum(const uint8_t *bytes, size_t length);
+uint32_t crc32c(uint32_t crc, const uint8_t *bytes, size_t length);
+
+// Individual implementations (exposed for ProtocolBench)
+uint32_t byteSumScalar(const uint8_t *bytes, size_t length);
+uint32_t byteSumSse2(const uint8_t *bytes, size_t length);
+uint32_t byteSumAvx2(const uint8_t *bytes, size_t length);
+uint32_t crc32cTable(uint32_t crc, const uint8_t *bytes, size_t length);
+uint32_t crc32cHardware(uint32_t crc, const uint8_t *bytes, size_t length);
+
+// CPU feature checks used by the dispatchers
+int cpuHasSse42(void);
+int cpuHasAvx2(void);
+
+#endif
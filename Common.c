@@ -3,46 +3,138 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #include "Common.h"
 
-char *readUntil(int fd, char cEnd) {
-    int i = 0;
-    ssize_t chars_read;
-    char c = 0;
-    char *buffer = NULL;
-    
-    // Initialize buffer with size 1 for the null terminator
-    buffer = (char *)malloc(1);
+#define LINE_READER_INITIAL_SIZE 4096
+
+void lineReaderInit(LineReader *reader, int fd) {
+    reader->fd = fd;
+    reader->buffer = NULL;
+    reader->capacity = 0;
+    reader->start = 0;
+    reader->end = 0;
+    reader->scanned = 0;
+    reader->finished = 0;
+}
+
+void lineReaderDestroy(LineReader *reader) {
+    free(reader->buffer);
+    reader->buffer = NULL;
+}
+
+// Make room after the buffered bytes: drop consumed lines first, then double the buffer
+static int lineReaderMakeRoom(LineReader *reader) {
+    if (reader->start > 0) {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->scanned -= reader->start;
+        reader->start = 0;
+    }
+    // One byte always stays free for the terminator of a last line without delimiter
+    if (reader->end + 1 < reader->capacity) {
+        return 0;
+    }
+    size_t capacity = (reader->capacity == 0) ? LINE_READER_INITIAL_SIZE : reader->capacity * 2;
+    char *buffer = realloc(reader->buffer, capacity);
     if (buffer == NULL) {
-        return NULL;
+        return -1;
     }
-    
+    reader->buffer = buffer;
+    reader->capacity = capacity;
+    return 0;
+}
+
+char *lineReaderNext(LineReader *reader, char delimiter, size_t *length) {
     while (1) {
-        chars_read = read(fd, &c, sizeof(char));
-        if (chars_read == 0) {
-            if (i == 0) {
-                free(buffer);  // Free buffer if no chars were read
-                return NULL;
+        char *found = (reader->scanned < reader->end) ?
+            memchr(reader->buffer + reader->scanned, delimiter, reader->end - reader->scanned) : NULL;
+        if (found != NULL || (reader->finished && reader->start < reader->end)) {
+            char *line = reader->buffer + reader->start;
+            size_t lineLength = (found != NULL) ? (size_t)(found - line) : reader->end - reader->start;
+            line[lineLength] = '\0';
+            reader->start += lineLength + (found != NULL);
+            reader->scanned = reader->start;
+            if (length != NULL) {
+                *length = lineLength;
             }
-            break;
-        } else if (chars_read < 0) {
-            free(buffer);
-            return NULL;
+            return line;
         }
-        
-        if (c == cEnd) {
-            break;
+        if (reader->finished) {
+            return NULL;
         }
-        
-        buffer = (char *)realloc(buffer, i + 2);
-        if (buffer == NULL) {
+        reader->scanned = reader->end;
+
+        if (lineReaderMakeRoom(reader) < 0) {
             return NULL;
         }
-        buffer[i++] = c;
+        ssize_t count = read(reader->fd, reader->buffer + reader->end, reader->capacity - reader->end - 1);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            // End of input, or an error: whatever is buffered is the last line
+            reader->finished = 1;
+            continue;
+        }
+        reader->end += count;
+    }
+}
+
+char *lineReaderNextCopy(LineReader *reader, char delimiter) {
+    size_t length;
+    char *line = lineReaderNext(reader, delimiter, &length);
+    if (line == NULL) {
+        return NULL;
+    }
+    char *copy = malloc(length + 1);
+    if (copy != NULL) {
+        memcpy(copy, line, length + 1);
+    }
+    return copy;
+}
+
+// Record a job duration, overwriting the oldest sample once the window is full
+void latencyRecord(LatencyWindow *window, unsigned int milliseconds) {
+    window->samples[window->next] = milliseconds;
+    window->next = (window->next + 1) % LATENCY_WINDOW_SIZE;
+    if (window->count < LATENCY_WINDOW_SIZE) {
+        window->count++;
+    }
+}
+
+static int compareUnsigned(const void *a, const void *b) {
+    unsigned int x = *(const unsigned int *)a;
+    unsigned int y = *(const unsigned int *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of the samples in the window (0 if empty)
+unsigned int latencyPercentile(const LatencyWindow *window, int percentile) {
+    if (window->count == 0) {
+        return 0;
+    }
+    unsigned int sorted[LATENCY_WINDOW_SIZE];
+    memcpy(sorted, window->samples, window->count * sizeof(unsigned int));
+    qsort(sorted, window->count, sizeof(unsigned int), compareUnsigned);
+
+    int rank = (percentile * window->count + 99) / 100;
+    if (rank < 1) {
+        rank = 1;
     }
-    
-    buffer[i] = '\0';  // Null-terminate the string
-    return buffer;
+    return sorted[rank - 1];
+}
+
+// Read an optional integer line, falling back to a default when missing
+static int readIntOrDefault(LineReader *reader, int defaultValue) {
+    size_t length;
+    char *line = lineReaderNext(reader, '\n', &length);
+    return (line != NULL && length > 0) ? atoi(line) : defaultValue;
+}
+
+// Read a required integer line (0 when missing)
+static int readInt(LineReader *reader) {
+    return readIntOrDefault(reader, 0);
 }
 
 void* readConfigFile(char *file, void *config) {
@@ -58,48 +150,100 @@ void* readConfigFile(char *file, void *config) {
         return NULL;
     }
 
+    LineReader reader;
+    lineReaderInit(&reader, fd);
+    void *result = NULL;
     if (strcmp(config, "Gotham") == 0) {
         Gotham *gotham = (Gotham*)malloc(sizeof(Gotham));
-        gotham->fleckIpAddress = readUntil(fd, '\n');
-        gotham->fleckPort = atoi(readUntil(fd, '\n'));
-        gotham->harleyEnigmaIpAddress = readUntil(fd, '\n');
-        gotham->harleyEnigmaPort = atoi(readUntil(fd, '\n'));
-        close(fd);
-        return gotham;
+        gotham->fleckIpAddress = lineReaderNextCopy(&reader, '\n');
+        gotham->fleckPort = readInt(&reader);
+        gotham->harleyEnigmaIpAddress = lineReaderNextCopy(&reader, '\n');
+        gotham->harleyEnigmaPort = readInt(&reader);
+        // Optional lines: I/O model and reactor thread count
+        gotham->ioMode = lineReaderNextCopy(&reader, '\n');
+        if (gotham->ioMode == NULL) {
+            gotham->ioMode = strdup("threads");
+        }
+        gotham->reactorThreads = readIntOrDefault(&reader, 2);
+        if (gotham->reactorThreads < 1) {
+            gotham->reactorThreads = 1;
+        }
+        gotham->schedulingPolicy = lineReaderNextCopy(&reader, '\n');
+        if (gotham->schedulingPolicy == NULL) {
+            gotham->schedulingPolicy = strdup("round-robin");
+        }
+        gotham->maxMissedHeartbeats = readIntOrDefault(&reader, 3);
+        if (gotham->maxMissedHeartbeats < 1) {
+            gotham->maxMissedHeartbeats = 1;
+        }
+        result = gotham;
     } else if (strcmp(config, "Enigma") == 0) {
         Enigma *enigma = (Enigma*)malloc(sizeof(Enigma));
-        enigma->gothamIpAddress = readUntil(fd, '\n');
-        enigma->gothamPort = atoi(readUntil(fd, '\n'));
-        enigma->fleckIpAddress = readUntil(fd, '\n');
-        enigma->fleckPort = atoi(readUntil(fd, '\n'));
-        enigma->folderName = readUntil(fd, '\n');
-        enigma->workerType = readUntil(fd, '\n');
-        close(fd);
-        return enigma;
+        enigma->gothamIpAddress = lineReaderNextCopy(&reader, '\n');
+        enigma->gothamPort = readInt(&reader);
+        enigma->fleckIpAddress = lineReaderNextCopy(&reader, '\n');
+        enigma->fleckPort = readInt(&reader);
+        enigma->folderName = lineReaderNextCopy(&reader, '\n');
+        enigma->workerType = lineReaderNextCopy(&reader, '\n');
+        // Optional lines: thread pool size and job queue capacity
+        enigma->poolSize = readIntOrDefault(&reader, 0);
+        if (enigma->poolSize < 1) {
+            enigma->poolSize = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+        }
+        enigma->queueCapacity = readIntOrDefault(&reader, 16);
+        if (enigma->queueCapacity < 1) {
+            enigma->queueCapacity = 1;
+        }
+        result = enigma;
     } else if (strcmp(config, "Fleck") == 0) {
         Fleck *user = (Fleck*)malloc(sizeof(Fleck));
-        user->name = readUntil(fd, '\n');
-        user->userFile = readUntil(fd, '\n');
-        user->ipAddress = readUntil(fd, '\n');
-        user->port = atoi(readUntil(fd, '\n'));
-        close(fd);
-        return user;
+        user->name = lineReaderNextCopy(&reader, '\n');
+        user->userFile = lineReaderNextCopy(&reader, '\n');
+        user->ipAddress = lineReaderNextCopy(&reader, '\n');
+        user->port = readInt(&reader);
+        // Optional line: transfer window (frames), 32 when missing
+        user->transferWindow = readIntOrDefault(&reader, 32);
+        if (user->transferWindow < 1) {
+            user->transferWindow = 1;
+        }
+        // Optional line: concurrent distortions, 4 when missing
+        user->maxJobs = readIntOrDefault(&reader, 4);
+        if (user->maxJobs < 1) {
+            user->maxJobs = 1;
+        }
+        result = user;
     } else if (strcmp(config, "Harley") == 0) {
         Harley *harley = (Harley*)malloc(sizeof(Harley));
-        harley->gothamIpAddress = readUntil(fd, '\n');
-        harley->gothamPort = atoi(readUntil(fd, '\n'));
-        harley->fleckIpAddress = readUntil(fd, '\n');
-        harley->fleckPort = atoi(readUntil(fd, '\n'));
-        harley->folderName = readUntil(fd, '\n');
-        harley->workerType = readUntil(fd, '\n');
-        close(fd);
-        return harley;
+        harley->gothamIpAddress = lineReaderNextCopy(&reader, '\n');
+        harley->gothamPort = readInt(&reader);
+        harley->fleckIpAddress = lineReaderNextCopy(&reader, '\n');
+        harley->fleckPort = readInt(&reader);
+        harley->folderName = lineReaderNextCopy(&reader, '\n');
+        harley->workerType = lineReaderNextCopy(&reader, '\n');
+        // Optional lines: thread pool size and job queue capacity
+        harley->poolSize = readIntOrDefault(&reader, 0);
+        if (harley->poolSize < 1) {
+            harley->poolSize = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+        }
+        harley->queueCapacity = readIntOrDefault(&reader, 16);
+        if (harley->queueCapacity < 1) {
+            harley->queueCapacity = 1;
+        }
+        // Optional lines: image tile size and threads per image
+        harley->tileSize = readIntOrDefault(&reader, 64);
+        if (harley->tileSize < 8) {
+            harley->tileSize = 8;
+        }
+        harley->imageThreads = readIntOrDefault(&reader, 0);
+        if (harley->imageThreads < 1) {
+            harley->imageThreads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+        }
+        result = harley;
     } else {
         printF("Error: Unknown config struct type\n");
-        close(fd);
-        return NULL;
     }
 
+    lineReaderDestroy(&reader);
     close(fd);
-    return NULL;
+    return result;
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <stddef.h>
+
 #define printF(x) write(1, x, strlen(x))
 
 typedef struct{
@@ -10,6 +12,8 @@ typedef struct{
     int fleckPort;
     char* folderName;
     char* workerType;
+    int poolSize;         // Threads serving distortion jobs (online CPUs by default)
+    int queueCapacity;    // Accepted connections waiting for a pool thread
 } Enigma;
 
 typedef struct{
@@ -17,6 +21,8 @@ typedef struct{
     char* userFile;
     char* ipAddress;
     int port;
+    int transferWindow;   // Data frames in flight during uploads and downloads
+    int maxJobs;          // Distortions running at once; later ones wait in the job table
 } Fleck;
 
 typedef struct{
@@ -24,6 +30,10 @@ typedef struct{
     int fleckPort;
     char* harleyEnigmaIpAddress;
     int harleyEnigmaPort;
+    char* ioMode;         // "threads" (default) or "epoll"
+    int reactorThreads;   // Number of epoll reactor threads
+    char* schedulingPolicy; // "round-robin" (default), "least-jobs" or "p2c"
+    int maxMissedHeartbeats; // Workers silent for this many beats are evicted
 } Gotham;
 
 typedef struct{
@@ -33,9 +43,42 @@ typedef struct{
     int fleckPort;
     char* folderName;
     char* workerType;
+    int poolSize;         // Threads serving distortion jobs (online CPUs by default)
+    int queueCapacity;    // Accepted connections waiting for a pool thread
+    int tileSize;         // Image tile edge in pixels
+    int imageThreads;     // Threads sharing the tiles of one image (online CPUs by default)
 } Harley;
 
-char *readUntil(int fd, char cEnd);
+// Sliding window of recent job durations (milliseconds) used for load reports
+#define LATENCY_WINDOW_SIZE 128
+
+typedef struct{
+    unsigned int samples[LATENCY_WINDOW_SIZE];
+    int count;
+    int next;
+} LatencyWindow;
+
+// Buffered line reader: block reads into a buffer that grows geometrically, lines handed out in place
+typedef struct{
+    int fd;
+    char *buffer;
+    size_t capacity;
+    size_t start;           // First byte not yet returned
+    size_t end;             // End of the buffered bytes
+    size_t scanned;         // Bytes from start already searched for the delimiter
+    int finished;           // End of input (or a read error) reached
+} LineReader;
+
+void lineReaderInit(LineReader *reader, int fd);
+void lineReaderDestroy(LineReader *reader);
+// Next line without its delimiter, NUL-terminated in the reader's buffer and valid until the next call;
+// a last line without delimiter is returned too. NULL at the end of input.
+char *lineReaderNext(LineReader *reader, char delimiter, size_t *length);
+// Same line as a malloc'd copy the caller frees
+char *lineReaderNextCopy(LineReader *reader, char delimiter);
+
+void latencyRecord(LatencyWindow *window, unsigned int milliseconds);
+unsigned int latencyPercentile(const LatencyWindow *window, int percentile);
 
 void* readConfigFile(char *file, void *config);
 
@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "FileCache.h"
+
+#define FILE_CACHE_MAGIC 0x434B4C46 // "FLKC"
+#define FILE_CACHE_VERSION 1
+#define FILE_CACHE_INITIAL_SLOTS 256
+#define FILE_CACHE_MAX_SLOTS (1u << 20) // Entries of deleted files pile up; past this the cache starts over
+
+static size_t cacheFileLength(uint32_t slots) {
+    return sizeof(FileCacheHeader) + (size_t)slots * sizeof(FileCacheEntry);
+}
+
+static int mapCache(FileCache *cache, size_t length) {
+    void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    cache->mapLength = length;
+    cache->header = (FileCacheHeader *)map;
+    cache->entries = (FileCacheEntry *)((uint8_t *)map + sizeof(FileCacheHeader));
+    return 0;
+}
+
+static void unmapCache(FileCache *cache) {
+    if (cache->header != NULL) {
+        munmap(cache->header, cache->mapLength);
+    }
+    cache->header = NULL;
+    cache->entries = NULL;
+}
+
+// Start over with an empty table of the given size
+static int resetCache(FileCache *cache, uint32_t slots) {
+    unmapCache(cache);
+    if (ftruncate(cache->fd, 0) < 0 || ftruncate(cache->fd, cacheFileLength(slots)) < 0 ||
+            mapCache(cache, cacheFileLength(slots)) < 0) {
+        return -1;
+    }
+    cache->header->magic = FILE_CACHE_MAGIC;
+    cache->header->version = FILE_CACHE_VERSION;
+    cache->header->slots = slots;
+    cache->header->count = 0;
+    return 0;
+}
+
+int fileCacheOpen(FileCache *cache, const char *directory) {
+    char *path;
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->mutex, NULL);
+
+    if (asprintf(&path, "%s/%s", directory, FILE_CACHE_NAME) < 0) {
+        cache->fd = -1;
+        return -1;
+    }
+    cache->fd = open(path, O_RDWR | O_CREAT, 0644);
+    free(path);
+    if (cache->fd < 0) {
+        return -1;
+    }
+
+    // A cache from another version, or a torn one, is simply rebuilt
+    struct stat cacheStat;
+    int valid = fstat(cache->fd, &cacheStat) == 0 && (size_t)cacheStat.st_size >= sizeof(FileCacheHeader) &&
+                mapCache(cache, cacheStat.st_size) == 0;
+    if (valid) {
+        FileCacheHeader *header = cache->header;
+        valid = header->magic == FILE_CACHE_MAGIC && header->version == FILE_CACHE_VERSION &&
+                header->slots > 0 && (header->slots & (header->slots - 1)) == 0 &&
+                (size_t)cacheStat.st_size == cacheFileLength(header->slots) && header->count < header->slots;
+    }
+    if (!valid && resetCache(cache, FILE_CACHE_INITIAL_SLOTS) < 0) {
+        unmapCache(cache);
+        close(cache->fd);
+        cache->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void fileCacheClose(FileCache *cache) {
+    if (cache->fd >= 0) {
+        unmapCache(cache);
+        close(cache->fd);
+        cache->fd = -1;
+    }
+    pthread_mutex_destroy(&cache->mutex);
+}
+
+static uint32_t slotFor(const FileCache *cache, uint64_t inode) {
+    return (uint32_t)((inode * 0x9E3779B97F4A7C15ull) >> 32) & (cache->header->slots - 1);
+}
+
+// Slot holding the inode, or the empty slot where it would go (linear probing)
+static FileCacheEntry *findSlot(FileCache *cache, uint64_t inode) {
+    uint32_t mask = cache->header->slots - 1;
+    for (uint32_t i = slotFor(cache, inode);; i = (i + 1) & mask) {
+        FileCacheEntry *entry = &cache->entries[i];
+        if (!entry->used || entry->inode == inode) {
+            return entry;
+        }
+    }
+}
+
+static int matches(const FileCacheEntry *entry, const struct stat *fileStat) {
+    return entry->used && entry->inode == (uint64_t)fileStat->st_ino && entry->size == (uint64_t)fileStat->st_size &&
+           entry->mtimeSeconds == fileStat->st_mtim.tv_sec && entry->mtimeNanoseconds == fileStat->st_mtim.tv_nsec;
+}
+
+int fileCacheLookup(FileCache *cache, const struct stat *fileStat, FileCacheEntry *entry) {
+    int found = 0;
+    pthread_mutex_lock(&cache->mutex);
+    if (cache->fd >= 0) {
+        FileCacheEntry *slot = findSlot(cache, fileStat->st_ino);
+        if (matches(slot, fileStat)) {
+            *entry = *slot;
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+    return found;
+}
+
+// Double the table once it is three quarters full, re-inserting every entry
+static int growCache(FileCache *cache) {
+    uint32_t slots = cache->header->slots;
+    uint32_t count = cache->header->count;
+    FileCacheEntry *old = malloc((size_t)slots * sizeof(FileCacheEntry));
+    if (old == NULL) {
+        return -1;
+    }
+    memcpy(old, cache->entries, (size_t)slots * sizeof(FileCacheEntry));
+
+    if (slots >= FILE_CACHE_MAX_SLOTS) {
+        free(old);
+        return resetCache(cache, FILE_CACHE_INITIAL_SLOTS);
+    }
+    if (resetCache(cache, slots * 2) < 0) {
+        free(old);
+        return -1;
+    }
+    for (uint32_t i = 0; i < slots; i++) {
+        if (old[i].used) {
+            *findSlot(cache, old[i].inode) = old[i];
+        }
+    }
+    cache->header->count = count;
+    free(old);
+    return 0;
+}
+
+void fileCacheStore(FileCache *cache, const struct stat *fileStat, const uint8_t md5[MD5_SIZE], uint8_t type) {
+    pthread_mutex_lock(&cache->mutex);
+    if (cache->fd < 0) {
+        pthread_mutex_unlock(&cache->mutex);
+        return;
+    }
+    if ((cache->header->count + 1) * 4 > cache->header->slots * 3 && growCache(cache) < 0) {
+        // A cache that cannot grow keeps serving what it has, or is dropped if the remap failed
+        if (cache->header == NULL) {
+            close(cache->fd);
+            cache->fd = -1;
+        }
+        pthread_mutex_unlock(&cache->mutex);
+        return;
+    }
+
+    // One entry per inode: a modified file replaces its stale digest
+    FileCacheEntry *slot = findSlot(cache, fileStat->st_ino);
+    if (!slot->used) {
+        cache->header->count++;
+    }
+    slot->inode = fileStat->st_ino;
+    slot->size = fileStat->st_size;
+    slot->mtimeSeconds = fileStat->st_mtim.tv_sec;
+    slot->mtimeNanoseconds = fileStat->st_mtim.tv_nsec;
+    memcpy(slot->md5, md5, MD5_SIZE);
+    slot->type = type;
+    slot->used = 1;
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void fileCacheForget(FileCache *cache, const struct stat *fileStat) {
+    pthread_mutex_lock(&cache->mutex);
+    if (cache->fd >= 0) {
+        FileCacheEntry *slot = findSlot(cache, fileStat->st_ino);
+        if (slot->used) {
+            // Backward-shift deletion keeps every later entry of the probe run reachable
+            uint32_t mask = cache->header->slots - 1;
+            uint32_t hole = slot - cache->entries;
+            for (uint32_t i = (hole + 1) & mask; cache->entries[i].used; i = (i + 1) & mask) {
+                uint32_t home = slotFor(cache, cache->entries[i].inode);
+                if (((i - home) & mask) >= ((i - hole) & mask)) {
+                    cache->entries[hole] = cache->entries[i];
+                    hole = i;
+                }
+            }
+            memset(&cache->entries[hole], 0, sizeof(FileCacheEntry));
+            cache->header->count--;
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+uint8_t detectFileType(const uint8_t *head, size_t length) {
+    if (length >= 12 && memcmp(head, "RIFF", 4) == 0 && memcmp(head + 8, "WAVE", 4) == 0) {
+        return DETECTED_WAV;
+    }
+    if (length >= 8 && memcmp(head, "\x89PNG\r\n\x1a\n", 8) == 0) {
+        return DETECTED_PNG;
+    }
+    if (length >= 3 && head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF) {
+        return DETECTED_JPEG;
+    }
+    if (length >= 3 && (memcmp(head, "ID3", 3) == 0 || (head[0] == 0xFF && (head[1] & 0xE0) == 0xE0))) {
+        return DETECTED_MP3;
+    }
+    // Text: no NUL or other control bytes apart from whitespace in what we were shown
+    for (size_t i = 0; i < length; i++) {
+        if (head[i] < 0x20 && head[i] != '\n' && head[i] != '\r' && head[i] != '\t') {
+            return DETECTED_UNKNOWN;
+        }
+    }
+    return DETECTED_TEXT;
+}
+
+const char *detectedTypeName(uint8_t type) {
+    switch (type) {
+        case DETECTED_TEXT: return "text";
+        case DETECTED_WAV: return "wav";
+        case DETECTED_PNG: return "png";
+        case DETECTED_JPEG: return "jpeg";
+        case DETECTED_MP3: return "mp3";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "Md5.h"
+
+// Per-folder cache of file digests (FILE_CACHE_NAME in the user folder), memory-mapped and
+// keyed by (inode, size, mtime): an entry stays valid exactly as long as the file is untouched.
+// Entries are added lazily from hashes computed while files stream, or by a multi-buffer pass
+// (md5HashBuffers()) running alongside the uploads of a DISTORT pattern's files, so later uploads skip hashing.
+#define FILE_CACHE_NAME ".fleck_cache"
+
+// Content types recognised from a file's first bytes
+#define DETECTED_UNKNOWN 0
+#define DETECTED_TEXT 1
+#define DETECTED_WAV 2
+#define DETECTED_PNG 3
+#define DETECTED_JPEG 4
+#define DETECTED_MP3 5
+
+typedef struct {
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtimeSeconds;
+    int64_t mtimeNanoseconds;
+    uint8_t md5[MD5_SIZE];
+    uint8_t type;           // DETECTED_*
+    uint8_t used;
+    uint8_t reserved[6];
+} FileCacheEntry;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;         // Power of two
+    uint32_t count;
+} FileCacheHeader;
+
+typedef struct {
+    int fd;                 // -1 when the cache could not be opened; lookups then miss
+    size_t mapLength;
+    FileCacheHeader *header;
+    FileCacheEntry *entries;
+    pthread_mutex_t mutex;  // Jobs run on several threads
+} FileCache;
+
+int fileCacheOpen(FileCache *cache, const char *directory);
+void fileCacheClose(FileCache *cache);
+// 1 and the entry when the file described by fileStat is cached, 0 otherwise
+int fileCacheLookup(FileCache *cache, const struct stat *fileStat, FileCacheEntry *entry);
+void fileCacheStore(FileCache *cache, const struct stat *fileStat, const uint8_t md5[MD5_SIZE], uint8_t type);
+void fileCacheForget(FileCache *cache, const struct stat *fileStat);
+
+uint8_t detectFileType(const uint8_t *head, size_t length);
+const char *detectedTypeName(uint8_t type);
+
+#endif
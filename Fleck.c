@@ -11,87 +11,83 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <arpa/inet.h>
-#include <dirent.h>
 #include "Protocol.h"
+#include "Transfer.h"
 #include "Common.h"
+#include "Log.h"
+#include "Stats.h"
+#include "FileCache.h"
+#include "FolderIndex.h"
+#include "JobTable.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 int sockfd = -1; // Socket descriptor for Gotham connection
-pthread_t workerThread; // Worker communication thread
-bool workerActive = false; // Indicates if a worker thread is active
+FileCache fileCache; // Digests of files in the user folder, reused across distortions
+FolderIndex folderIndex; // Listable files of the user folder, kept current with inotify
+JobTable jobTable; // Distortions queued, running and finished, served by runner threads
+pthread_mutex_t gothamMutex = PTHREAD_MUTEX_INITIALIZER; // Serializes writes on the Gotham socket
+pthread_mutex_t gothamRequestMutex = PTHREAD_MUTEX_INITIALIZER; // Pairs each distortion request with its reply
 
+// How the files of one DISTORT command are queued
 typedef struct {
+    int factor;
+    bool waitForRoom;   // Scripts wait for finished jobs to make room instead of being refused
+} DistortBatch;
+
+#define PREHASH_LANES 8 // Files hashed side by side by md5HashBuffers() (one AVX2 lane each)
+
+// Files a DISTORT pattern matched; the names go on to the thread hashing the batch
+typedef struct {
+    char **names;
+    FileType *types;
+    size_t count;
+    size_t capacity;
+    size_t skip;        // Leading files whose uploads start at once and hash them as they stream
+} MatchedFiles;
+
+pthread_mutex_t prehashMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t prehashFinished = PTHREAD_COND_INITIALIZER; // Signalled when a hashing thread ends
+int prehashRunning = 0; // Hashing threads alive
+bool prehashStop = false; // Set on exit, when the digests are no longer worth computing
+
+typedef struct {
+    Job *job;
     char workerIp[128];
     int workerPort;
+    unsigned int workerCapabilities; // Worker options reported by Gotham with the redirection
+    char fileName[128];
+    int factor;
 } WorkerInfo;
 
-typedef enum {
-    FILE_TYPE_TEXT,
-    FILE_TYPE_MEDIA
-} FileType;
-
 Fleck *user;
 
 // Function declarations
-bool isFileOfType(const char *filename, FileType type);
-void listFiles(const char *directory, FileType type);
 void sendConnectionRequest(const char *username, const char *ip, int port);
 void handleServerResponse();
 void sendLogoutRequest(const char *username);
-void handleCommands(Fleck *user);
-void sendFrame(int socket, const Frame *frame);
+void handleCommands(Fleck *user, int inputFd, bool interactive);
+void sendFrame(int socket, const uint8_t *buffer, size_t size);
+void sendGothamFrame(uint8_t *buffer, uint8_t type, size_t dataLength);
+void sendJobFinished(const char *workerIp, int workerPort);
 ssize_t readAll(int socket, uint8_t *buffer, size_t length);
-void *workerCommunication(void *arg);
+int exchangeFileWithWorker(int workerSock, int fileFd, const struct stat *fileStat, const FileCacheEntry *cached,
+    const WorkerInfo *workerInfo);
+int workerCommunication(WorkerInfo *workerInfo);
 void sendDistortionRequest(const char *mediaType, const char *fileName);
-void handleDistortionResponse();
-
-// Check if a file is of the specified type
-bool isFileOfType(const char *filename, FileType type) {
-    const char *ext = strrchr(filename, '.');
-    if (ext == NULL) {
-        return false;
-    }
-    switch (type) {
-        case FILE_TYPE_TEXT:
-            return (strcasecmp(ext, ".txt") == 0);
-        case FILE_TYPE_MEDIA:
-            return (strcasecmp(ext, ".wav") == 0 || strcasecmp(ext, ".mp3") == 0 ||
-                    strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0 ||
-                    strcasecmp(ext, ".png") == 0);
-        default:
-            return false;
-    }
-}
-
-// List files of a specific type
-void listFiles(const char *directory, FileType type) {
-    DIR *dir;
-    struct dirent *entry;
-    const char *typeStr = (type == FILE_TYPE_TEXT) ? "text" : "media";
-
-    char *message;
-
-    dir = opendir(directory);
-    if (dir == NULL) {
-        asprintf(&message, "Error: Cannot open directory %s\n", directory);
-        printF(message);
-        free(message);
-        return;
-    }
-
-    asprintf(&message, "Listing %s files:\n", typeStr);
-    printF(message);
-    free(message);
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_type == DT_REG && isFileOfType(entry->d_name, type)) {
-            asprintf(&message, "- %s\n", entry->d_name);
-            printF(message);
-            free(message);
-        }
-    }
-    closedir(dir);
-}
+int handleDistortionResponse(WorkerInfo *workerInfo);
+void queueDistortion(const char *fileName, FileType type, DistortBatch *batch);
+void collectMatchedFile(const char *name, FileType type, void *context);
+void prehashGroup(char *const names[], size_t count);
+void *prehashFiles(void *arg);
+void startPrehash(MatchedFiles *matched);
+void stopPrehash(void);
+void *runDistortions(void *arg);
+void showGothamStats(void);
+void showWorkerStats(const char *address);
 
 // Reliable frame sending
 ssize_t sendAll(int socket, const uint8_t *buffer, size_t length) {
@@ -121,52 +117,79 @@ ssize_t readAll(int socket, uint8_t *buffer, size_t length) {
     return totalRead;
 }
 
-// Send a frame to the server
-void sendFrame(int socket, const Frame *frame) {
-    uint8_t buffer[FRAME_SIZE] = {0};
-    serializeFrame(frame, buffer);
+// Send a frame already built in its wire buffer
+void sendFrame(int socket, const uint8_t *buffer, size_t size) {
+    ssize_t bytesWritten = sendAll(socket, buffer, size);
+    if (bytesWritten != (ssize_t)size) {
+        LOG_ERROR("Error: Frame not fully sent (sent %ld bytes, expected %zu)\n", bytesWritten, size);
+    }
+}
 
-    ssize_t bytesWritten = sendAll(socket, buffer, FRAME_SIZE);
-    if (bytesWritten != FRAME_SIZE) {
-        char *message;
-        asprintf(&message, "Error: Frame not fully sent (sent %ld bytes, expected %d)\n", bytesWritten, FRAME_SIZE);
-        printF(message);
-        free(message);
+// Finish and send a frame to Gotham with the negotiated options; worker threads report back on the same socket
+void sendGothamFrame(uint8_t *buffer, uint8_t type, size_t dataLength) {
+    pthread_mutex_lock(&gothamMutex);
+    if (sockfd != -1) {
+        size_t size = finishFrameWith(buffer, type, dataLength, protocolGetOptions(sockfd));
+        sendFrame(sockfd, buffer, size);
     }
+    pthread_mutex_unlock(&gothamMutex);
+}
+
+// Tell Gotham a distortion on a worker is over so it can rebalance (TYPE: 0x11)
+void sendJobFinished(const char *workerIp, int workerPort) {
+    uint8_t buffer[FRAME_SIZE];
+    size_t length;
+
+    pthread_mutex_lock(&gothamMutex);
+    unsigned int options = (sockfd != -1) ? protocolGetOptions(sockfd) : 0;
+    pthread_mutex_unlock(&gothamMutex);
+    if (options & PROTO_CAP_TLV) {
+        JobFinished finished = {0};
+        strncpy(finished.ip, workerIp, sizeof(finished.ip) - 1);
+        finished.port = workerPort;
+        length = encodeJobFinished(&finished, framePayload(buffer), FRAME_DATA_SIZE);
+    } else {
+        length = formatPayload(buffer, "%s&%d", workerIp, workerPort);
+    }
+    sendGothamFrame(buffer, 0x11, length);
 }
 
 // Send connection request to Gotham
 void sendConnectionRequest(const char *username, const char *ip, int port) {
-    Frame frame = {0};
-    frame.type = 0x01; // Connection request frame type
-    frame.timestamp = time(NULL);
-    snprintf(frame.data, sizeof(frame.data), "%s&%s&%d", username, ip, port);
-    frame.dataLength = strlen(frame.data);
-    frame.checksum = calculateChecksum(&frame);
-
-    
-
-    sendFrame(sockfd, &frame);
+    uint8_t buffer[FRAME_SIZE];
+    size_t length = formatPayload(buffer, "%s&%s&%d&%u", username, ip, port, PROTO_SUPPORTED_CAPS);
+    sendGothamFrame(buffer, 0x01, length); // Connection request frame type
 }
 
 // Handle server response
 void handleServerResponse() {
     uint8_t buffer[FRAME_SIZE];
-    ssize_t bytesRead = read(sockfd, buffer, FRAME_SIZE);
+    FrameView response;
+    int result = receiveFrame(sockfd, buffer, sizeof(buffer), &response);
 
-    if (bytesRead != FRAME_SIZE) {
+    if (result == FRAME_CLOSED) {
         perror("Error: Invalid response frame size received\n");
         return;
     }
-
-    Frame response;
-    deserializeFrame(buffer, &response);
+    if (result != FRAME_OK) {
+        printF("Corrupted response frame received during connection.\n");
+        return;
+    }
 
     if (response.type == 0x01 && response.dataLength == 0) {
         printF("Connected to Gotham.\n");
+    } else if (response.type == 0x01 && !frameViewEquals(&response, "CON_KO")) {
+        // Gotham acknowledged with the capabilities it accepted
+        if (protocolSetOptions(sockfd, parseCapabilities(&response)) < 0) {
+            printF("Connection failed: cannot keep the negotiated options.\n");
+            close(sockfd);
+            sockfd = -1;
+            return;
+        }
+        printF("Connected to Gotham.\n");
     } else if (response.type == 0x01) {
         char *message;
-        asprintf(&message, "Connection failed: %s\n", response.data);
+        asprintf(&message, "Connection failed: %.*s\n", response.dataLength, (const char *)response.data);
         printF(message);
         free(message);
     } else {
@@ -177,27 +200,168 @@ void handleServerResponse() {
 
 // Send logout request
 void sendLogoutRequest(const char *username) {
-    Frame frame = {0};
-    frame.type = 0x07; // Logout frame type
-    frame.timestamp = time(NULL);
-    snprintf(frame.data, sizeof(frame.data), "%s", username);
-    frame.dataLength = strlen(frame.data);
-    frame.checksum = calculateChecksum(&frame);
+    uint8_t buffer[FRAME_SIZE];
+    size_t length = strlen(username);
+    memcpy(framePayload(buffer), username, length < FRAME_DATA_SIZE ? length : FRAME_DATA_SIZE);
+    sendGothamFrame(buffer, 0x07, length); // Logout frame type
+}
 
-    
+// Distorted file being downloaded while the upload may still be running
+typedef struct {
+    TransferSession *session;
+    int fileFd;
+    uint64_t *receivedBytes;    // Job progress, read by CHECK STATUS
+    uint64_t written;
+    uint64_t expected;
+    Md5Context hash;            // Result bytes as they are written
+    uint8_t expectedMd5[MD5_SIZE];
+    uint8_t head[64];           // First result bytes, to record the content type
+    size_t headLength;
+    bool finished;
+} ResultDownload;
+
+// Store result frames the moment they arrive; the worker streams them back during the upload
+int handleResultFrame(void *context, const FrameView *view) {
+    ResultDownload *download = (ResultDownload *)context;
+
+    if (view->type == 0x05 && !download->finished) {
+        size_t total = 0;
+        while (total < view->dataLength) {
+            ssize_t count = write(download->fileFd, view->data + total, view->dataLength - total);
+            if (count <= 0) {
+                return -1;
+            }
+            total += count;
+        }
+        if (download->headLength < sizeof(download->head)) {
+            size_t take = sizeof(download->head) - download->headLength;
+            take = take < total ? take : total;
+            memcpy(download->head + download->headLength, view->data, take);
+            download->headLength += take;
+        }
+        download->written += total;
+        __atomic_fetch_add(download->receivedBytes, total, __ATOMIC_RELAXED);
+        md5Update(&download->hash, view->data, view->dataLength);
+        return transferConsumed(download->session, 0);
+    }
+    if (view->type == 0x06 && !download->finished) {
+        if (parseTransferEnd(view, &download->expected, download->expectedMd5) < 0) {
+            return -1;
+        }
+        download->finished = true;
+        return transferFlushAcks(download->session);
+    }
+    return -1;
+}
 
-    sendFrame(sockfd, &frame);
+// Upload the file and download the distorted result over the same connection, hashing both on the
+// way through, and replace the original only once the result is complete and matches its MD5.
+// A file already in the cache is not hashed again; both digests are cached for the next run.
+int exchangeFileWithWorker(int workerSock, int fileFd, const struct stat *fileStat, const FileCacheEntry *cached,
+    const WorkerInfo *workerInfo) {
+    uint64_t fileSize = fileStat->st_size;
+    char *path, *partialPath;
+    asprintf(&path, "%s/%s", user->userFile, workerInfo->fileName);
+    asprintf(&partialPath, "%s.part", path);
+
+    int result = -1;
+    int resultFd = open(partialPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    TransferSession session;
+
+    if (resultFd < 0) {
+        perror("Error creating distorted file");
+    } else if (transferSessionInit(&session, workerSock, user->transferWindow) == 0) {
+        ResultDownload download = { .session = &session, .fileFd = resultFd,
+                                    .receivedBytes = &workerInfo->job->receivedBytes };
+        Md5Context uploadHash;
+        uint8_t uploadMd5[MD5_SIZE];
+        md5Init(&download.hash);
+        md5Init(&uploadHash);
+        session.onFrame = handleResultFrame;
+        session.context = &download;
+        session.sendHash = cached != NULL ? NULL : &uploadHash;
+        session.sentBytes = &workerInfo->job->sentBytes;
+
+        result = transferSendFile(&session, fileFd, fileSize);
+        if (result == 0) {
+            if (cached != NULL) {
+                memcpy(uploadMd5, cached->md5, MD5_SIZE);
+            } else {
+                md5Final(&uploadHash, uploadMd5);
+                uint8_t head[64];
+                ssize_t headLength = pread(fileFd, head, sizeof(head), 0);
+                fileCacheStore(&fileCache, fileStat, uploadMd5, detectFileType(head, headLength > 0 ? headLength : 0));
+            }
+        }
+        if (result == 0 && (session.options & PROTO_CAP_MD5)) {
+            // The worker checks what it received against this before confirming its result
+            result = transferSendEnd(&session, fileSize, uploadMd5);
+        }
+        if (result == 0) {
+            result = transferFlush(&session);
+        }
+        while (result == 0 && !download.finished) {
+            result = transferPump(&session);
+        }
+        if (result == 0 && download.written != download.expected) {
+            result = -1;
+        }
+        if (result == 0) {
+            uint8_t resultMd5[MD5_SIZE];
+            struct stat resultStat;
+            md5Final(&download.hash, resultMd5);
+            if (md5IsKnown(download.expectedMd5) && memcmp(resultMd5, download.expectedMd5, MD5_SIZE) != 0) {
+                LOG_INFO("Distorted file failed its MD5 check.\n");
+                result = -1;
+            } else if (fstat(resultFd, &resultStat) == 0) {
+                // The rename below keeps the inode and mtime, so the entry describes the final file
+                fileCacheStore(&fileCache, &resultStat, resultMd5, detectFileType(download.head, download.headLength));
+            }
+        }
+        transferSessionDestroy(&session);
+    }
+
+    if (resultFd >= 0) {
+        close(resultFd);
+        if (result == 0 && rename(partialPath, path) < 0) {
+            perror("Error storing distorted file");
+            result = -1;
+        }
+        if (result < 0) {
+            unlink(partialPath);
+        }
+    }
+
+    free(path);
+    free(partialPath);
+    return result;
 }
 
-// Worker communication thread
-void *workerCommunication(void *arg) {
-    WorkerInfo *workerInfo = (WorkerInfo *)arg;
+// Distort one file on the worker Gotham assigned; 0 once the result replaced the original
+int workerCommunication(WorkerInfo *workerInfo) {
+    char *path;
+    asprintf(&path, "%s/%s", user->userFile, workerInfo->fileName);
+    int fileFd = open(path, O_RDONLY);
+    free(path);
+
+    struct stat fileStat;
+    if (fileFd < 0 || fstat(fileFd, &fileStat) < 0) {
+        LOG_INFO("Cannot read %s from the user folder.\n", workerInfo->fileName);
+        if (fileFd >= 0) {
+            close(fileFd);
+        }
+        sendJobFinished(workerInfo->workerIp, workerInfo->workerPort);
+        return -1;
+    }
+    unsigned long long fileSize = fileStat.st_size;
+    FileCacheEntry cached;
+    bool isCached = fileCacheLookup(&fileCache, &fileStat, &cached);
 
     int workerSock = socket(AF_INET, SOCK_STREAM, 0);
     if (workerSock < 0) {
         perror("Socket creation failed for worker");
-        free(workerInfo);
-        return NULL;
+        close(fileFd);
+        return -1;
     }
 
     struct sockaddr_in workerAddr = {0};
@@ -208,135 +372,413 @@ void *workerCommunication(void *arg) {
     if (connect(workerSock, (struct sockaddr *)&workerAddr, sizeof(workerAddr)) < 0) {
         perror("Connection to worker failed");
         close(workerSock);
-        free(workerInfo);
-        return NULL;
+        close(fileFd);
+        sendJobFinished(workerInfo->workerIp, workerInfo->workerPort);
+        return -1;
     }
 
-    char *message;
-    asprintf(&message, "Connected to worker at %s:%d.\n", workerInfo->workerIp, workerInfo->workerPort);
-    printF(message);
-    free(message);
-
-    // Prepare TYPE: 0x03 frame with file metadata
-    Frame fileRequestFrame = {0};
-    fileRequestFrame.type = 0x03; // Worker connection with file metadata
-    fileRequestFrame.timestamp = time(NULL);
-    snprintf(fileRequestFrame.data, sizeof(fileRequestFrame.data), "%s&hello.txt&1024&<MD5SUM>&<factor>",user->name); // Example data
-    fileRequestFrame.dataLength = strlen(fileRequestFrame.data);
-    fileRequestFrame.checksum = calculateChecksum(&fileRequestFrame);
+    LOG_INFO("Connected to worker at %s:%d.\n", workerInfo->workerIp, workerInfo->workerPort);
 
+    // Prepare TYPE: 0x03 frame with file metadata and the transfer window
     uint8_t buffer[FRAME_SIZE];
-    serializeFrame(&fileRequestFrame, buffer);
+    size_t length;
+    if (workerInfo->workerCapabilities & PROTO_CAP_TLV) {
+        JobRequest request = {0};
+        strncpy(request.username, user->name, sizeof(request.username) - 1);
+        strncpy(request.fileName, workerInfo->fileName, sizeof(request.fileName) - 1);
+        request.fileSize = fileSize;
+        if (isCached) {
+            memcpy(request.md5, cached.md5, MD5_SIZE);
+        }
+        request.factor = workerInfo->factor;
+        request.capabilities = PROTO_SUPPORTED_CAPS;
+        request.window = user->transferWindow;
+        length = encodeJobRequest(&request, framePayload(buffer), FRAME_DATA_SIZE);
+    } else {
+        char md5Hex[MD5_HEX_SIZE] = "<MD5SUM>";
+        if (isCached) {
+            md5ToHex(cached.md5, md5Hex);
+        }
+        length = formatPayload(buffer, "%s&%s&%llu&%s&%d&%u&%d", user->name, workerInfo->fileName,
+            fileSize, md5Hex, workerInfo->factor, PROTO_SUPPORTED_CAPS, user->transferWindow);
+    }
+    finishFrame(buffer, 0x03, length); // Worker connection with file metadata
 
     if (write(workerSock, buffer, FRAME_SIZE) < 0) {
         perror("Error sending file request to worker");
     } else {
-        asprintf(&message, "File request sent to worker: Type=0x03, Data=%s\n", fileRequestFrame.data);
-        printF(message);
-        free(message);
+        LOG_INFO("File request sent to worker: Type=0x03, File=%s, Size=%llu, Factor=%d\n",
+            workerInfo->fileName, fileSize, workerInfo->factor);
     }
 
-    // Wait for worker's response
-    if (readAll(workerSock, buffer, FRAME_SIZE) > 0) {
-        Frame response;
-        deserializeFrame(buffer, &response);
-
+    // Wait for worker's response; workers predating file transfer acknowledge without capabilities
+    FrameView response;
+    bool accepted = false;
+    if (receiveFrame(workerSock, buffer, sizeof(buffer), &response) == FRAME_OK) {
         if (response.type == 0x03 && response.dataLength == 0) {
-            printF("Worker accepted the connection. Start file distortion.\n");
+            LOG_INFO("Worker does not support file transfer.\n");
+        } else if (response.type == 0x03 && frameViewEquals(&response, "BUSY")) {
+            LOG_INFO("Worker is busy, try again later.\n");
+        } else if (response.type == 0x03 && !frameViewEquals(&response, "CON_KO")) {
+            if (protocolSetOptions(workerSock, parseCapabilities(&response)) < 0) {
+                LOG_INFO("Cannot keep the options negotiated with the worker.\n");
+            } else {
+                LOG_INFO("Worker accepted the connection. Start file distortion.\n");
+                accepted = true;
+            }
         } else if (response.type == 0x03) {
-            asprintf(&message, "Worker rejected the connection: %s\n", response.data);
-            printF(message);
-            free(message);
+            LOG_INFO("Worker rejected the connection: %.*s\n", response.dataLength, (const char *)response.data);
         } else {
-            asprintf(&message, "Unexpected response from worker: Type=0x%02x\n", response.type);
-            printF(message);
-            free(message);
+            LOG_INFO("Unexpected response from worker: Type=0x%02x\n", response.type);
         }
     } else {
-        printF("Worker did not respond.\n");
+        LOG_INFO("Worker did not respond.\n");
+    }
+
+    bool distorted = false;
+    if (accepted) {
+        jobTableStartTransfer(&jobTable, workerInfo->job, workerInfo->workerIp, workerInfo->workerPort, fileSize);
+        if (exchangeFileWithWorker(workerSock, fileFd, &fileStat, isCached ? &cached : NULL, workerInfo) < 0) {
+            LOG_INFO("File transfer with worker failed.\n");
+            if (isCached) {
+                // Hash the file again next time in case the cached digest is what the worker rejected
+                fileCacheForget(&fileCache, &fileStat);
+            }
+        } else {
+            TransferCounters counters;
+            transferGetCounters(&counters);
+            LOG_INFO("Distortion of %s completed (upload totals: %llu bytes zero-copy, %llu bytes copied).\n",
+                workerInfo->fileName, (unsigned long long)counters.zeroCopyBytes, (unsigned long long)counters.copiedBytes);
+            distorted = true;
+        }
     }
 
+    protocolSetOptions(workerSock, 0);
     close(workerSock);
-    free(workerInfo);
-    return NULL;
+    close(fileFd);
+    sendJobFinished(workerInfo->workerIp, workerInfo->workerPort);
+    return distorted ? 0 : -1;
 }
 
 
 // Send distortion request
 void sendDistortionRequest(const char *mediaType, const char *fileName) {
-    Frame frame = {0};
-    frame.type = 0x10; // Distortion request type
-    frame.timestamp = time(NULL);
-    snprintf(frame.data, sizeof(frame.data), "%s&%s", mediaType, fileName);
-    frame.dataLength = strlen(frame.data);
-    frame.checksum = calculateChecksum(&frame);
-
-    sendFrame(sockfd, &frame);
+    uint8_t buffer[FRAME_SIZE];
+    size_t length;
+
+    if (protocolGetOptions(sockfd) & PROTO_CAP_TLV) {
+        DistortRequest request = {0};
+        strncpy(request.mediaType, mediaType, sizeof(request.mediaType) - 1);
+        strncpy(request.fileName, fileName, sizeof(request.fileName) - 1);
+        length = encodeDistortRequest(&request, framePayload(buffer), FRAME_DATA_SIZE);
+    } else {
+        length = formatPayload(buffer, "%s&%s", mediaType, fileName);
+    }
+    sendGothamFrame(buffer, 0x10, length); // Distortion request type
 }
 
-// Handle distortion response
-void handleDistortionResponse() {
-    uint8_t buffer[FRAME_SIZE] = {0};
-    ssize_t bytesRead = readAll(sockfd, buffer, FRAME_SIZE);
+// Read Gotham's reply to a distortion request into workerInfo; 0 when a worker was assigned
+int handleDistortionResponse(WorkerInfo *workerInfo) {
+    uint8_t buffer[FRAME_SIZE];
+    FrameView view;
+    int result = receiveFrame(sockfd, buffer, sizeof(buffer), &view);
+
+    if (result == FRAME_CLOSED) {
+        LOG_INFO("Error: Connection to Gotham lost while waiting for the distortion response\n");
+        return -1;
+    }
+    if (result != FRAME_OK) {
+        LOG_INFO("Corrupted distortion response received.\n");
+        return -1;
+    }
+
+    if (view.type != 0x10) {
+        LOG_INFO("Unexpected frame type received.\n");
+        return -1;
+    }
 
-    if (bytesRead != FRAME_SIZE) {
+    DistortRedirect redirect = {0};
+    if (isTlvPayload(view.data, view.dataLength)) {
+        if (decodeDistortRedirect(view.data, view.dataLength, &redirect) < 0) {
+            LOG_INFO("Invalid worker redirection data from Gotham.\n");
+            return -1;
+        }
+    } else if (view.dataLength == 0 || frameViewEquals(&view, "DISTORT_KO")) {
+        redirect.status = REDIRECT_DISTORT_KO;
+    } else if (frameViewEquals(&view, "MEDIA_KO")) {
+        redirect.status = REDIRECT_MEDIA_KO;
+    } else {
+        // The redirection is parsed with sscanf, so this one needs a NUL-terminated copy
+        Frame response;
+        frameFromView(&view, &response);
+
+        int port;
+        if (sscanf(response.data, "%127[^&]&%d", redirect.ip, &port) != 2) {
+            LOG_INFO("Invalid worker redirection data from Gotham.\n");
+            return -1;
+        }
+        redirect.port = port;
+    }
+
+    if (redirect.status == REDIRECT_DISTORT_KO) {
+        LOG_INFO("No workers available for this distortion type.\n");
+        return -1;
+    } else if (redirect.status != REDIRECT_OK) {
+        LOG_INFO("Invalid media type for distortion.\n");
+        return -1;
+    }
+
+    strcpy(workerInfo->workerIp, redirect.ip);
+    workerInfo->workerPort = redirect.port;
+    workerInfo->workerCapabilities = redirect.workerCapabilities;
+    return 0;
+}
+
+// Queue a distortion; a runner asks Gotham for a worker while the prompt stays free
+void queueDistortion(const char *fileName, FileType type, DistortBatch *batch) {
+    int startRunner;
+    int id = jobTableAdd(&jobTable, fileName, type == FILE_TYPE_TEXT ? "Text" : "Media", batch->factor,
+        batch->waitForRoom, &startRunner);
+    if (id < 0) {
+        printF("Too many unfinished distortions, try again later.\n");
+    } else {
         char *message;
-        asprintf(&message, "Error: Invalid response frame size received (%ld bytes)\n", bytesRead);
+        asprintf(&message, "Distortion %d of %s queued.\n", id, fileName);
         printF(message);
         free(message);
-        return;
     }
 
-    Frame response;
-    deserializeFrame(buffer, &response);
+    pthread_t runner;
+    if (startRunner && pthread_create(&runner, NULL, runDistortions, NULL) != 0) {
+        perror("Failed to create distortion thread");
+        runDistortions(NULL); // Serve it from the prompt rather than leave it queued
+    } else if (startRunner) {
+        pthread_detach(runner);
+    }
+}
 
-    if (response.type != 0x10) {
-        printF("Unexpected frame type received.\n");
+void collectMatchedFile(const char *name, FileType type, void *context) {
+    MatchedFiles *matched = (MatchedFiles *)context;
+    if (matched->count == matched->capacity) {
+        size_t capacity = matched->capacity ? matched->capacity * 2 : 16;
+        char **names = realloc(matched->names, capacity * sizeof(char *));
+        if (names != NULL) {
+            matched->names = names;
+        }
+        FileType *types = realloc(matched->types, capacity * sizeof(FileType));
+        if (types != NULL) {
+            matched->types = types;
+        }
+        if (names == NULL || types == NULL) {
+            perror("Memory allocation failed");
+            return;
+        }
+        matched->capacity = capacity;
+    }
+    char *copy = strdup(name);
+    if (copy == NULL) {
+        perror("Memory allocation failed");
         return;
     }
+    matched->names[matched->count] = copy;
+    matched->types[matched->count] = type;
+    matched->count++;
+}
+
+// Hash up to PREHASH_LANES files that are not cached yet side by side in SIMD lanes and cache the digests
+void prehashGroup(char *const names[], size_t count) {
+    static const uint8_t empty[1];
+    const uint8_t *data[PREHASH_LANES];
+    size_t lengths[PREHASH_LANES];
+    struct stat stats[PREHASH_LANES];
+    int lanes = 0;
+
+    for (size_t i = 0; i < count && i < PREHASH_LANES; i++) {
+        char *path;
+        if (asprintf(&path, "%s/%s", user->userFile, names[i]) < 0) {
+            continue;
+        }
+        int fd = open(path, O_RDONLY);
+        free(path);
+        FileCacheEntry cached;
+        if (fd < 0) {
+            continue;
+        }
+        if (fstat(fd, &stats[lanes]) < 0 || !S_ISREG(stats[lanes].st_mode) ||
+            fileCacheLookup(&fileCache, &stats[lanes], &cached)) {
+            close(fd);
+            continue;
+        }
+        lengths[lanes] = stats[lanes].st_size;
+        data[lanes] = (lengths[lanes] > 0) ? mmap(NULL, lengths[lanes], PROT_READ, MAP_PRIVATE, fd, 0) : empty;
+        close(fd);
+        if (data[lanes] == MAP_FAILED) {
+            continue; // The upload hashes it as it streams
+        }
+        lanes++;
+    }
 
-    if (response.dataLength == 0 || strcmp(response.data, "DISTORT_KO") == 0) {
-        printF("No workers available for this distortion type.\n");
-        return;
-    } else if (strcmp(response.data, "MEDIA_KO") == 0) {
-        printF("Invalid media type for distortion.\n");
-        return;
+    uint8_t digests[PREHASH_LANES][MD5_SIZE];
+    md5HashBuffers(data, lengths, lanes, digests);
+    for (int lane = 0; lane < lanes; lane++) {
+        size_t headLength = lengths[lane] < 64 ? lengths[lane] : 64;
+        fileCacheStore(&fileCache, &stats[lane], digests[lane], detectFileType(data[lane], headLength));
+        if (lengths[lane] > 0) {
+            munmap((void *)data[lane], lengths[lane]);
+        }
     }
+}
 
-    WorkerInfo *workerInfo = malloc(sizeof(WorkerInfo));
-    if (workerInfo == NULL) {
-        perror("Memory allocation failed");
-        return;
+// Hashing thread: while the runners upload a batch front to back, hash it from the back a group at a
+// time, so uploads that reach those files start with their MD5 known and the two meet in the middle
+// instead of both reading the same files
+void *prehashFiles(void *arg) {
+    MatchedFiles *matched = (MatchedFiles *)arg;
+    size_t end = matched->count;
+    while (end > matched->skip) {
+        pthread_mutex_lock(&prehashMutex);
+        bool stop = prehashStop;
+        pthread_mutex_unlock(&prehashMutex);
+        if (stop) {
+            break;
+        }
+        size_t first = (end - matched->skip > PREHASH_LANES) ? end - PREHASH_LANES : matched->skip;
+        prehashGroup(matched->names + first, end - first);
+        end = first;
     }
 
-    if (sscanf(response.data, "%127[^&]&%d", workerInfo->workerIp, &workerInfo->workerPort) != 2) {
-        printF("Invalid worker redirection data from Gotham.\n");
-        free(workerInfo);
-        return;
+    for (size_t i = 0; i < matched->count; i++) {
+        free(matched->names[i]);
     }
+    free(matched->names);
+    free(matched);
 
-    if (pthread_create(&workerThread, NULL, workerCommunication, workerInfo) != 0) {
-        perror("Failed to create worker thread");
-        free(workerInfo);
-    } else {
-        pthread_detach(workerThread); // Detach to allow main thread to continue
+    pthread_mutex_lock(&prehashMutex);
+    prehashRunning--;
+    pthread_cond_broadcast(&prehashFinished);
+    pthread_mutex_unlock(&prehashMutex);
+    return NULL;
+}
+
+// Hand a queued batch's names to a hashing thread, which frees them; without one the uploads hash alone
+void startPrehash(MatchedFiles *matched) {
+    MatchedFiles *batch = NULL;
+    pthread_t hasher;
+    if (matched->count > matched->skip && (batch = malloc(sizeof(MatchedFiles))) != NULL) {
+        *batch = *matched;
+        batch->types = NULL;
+        pthread_mutex_lock(&prehashMutex);
+        prehashRunning++;
+        pthread_mutex_unlock(&prehashMutex);
+        if (pthread_create(&hasher, NULL, prehashFiles, batch) == 0) {
+            pthread_detach(hasher);
+            return;
+        }
+        perror("Failed to create hashing thread");
+        pthread_mutex_lock(&prehashMutex);
+        prehashRunning--;
+        pthread_mutex_unlock(&prehashMutex);
+        free(batch);
+    }
+    for (size_t i = 0; i < matched->count; i++) {
+        free(matched->names[i]);
+    }
+    free(matched->names);
+}
+
+// Stop hashing threads after their current group and wait for them, before the file cache goes away
+void stopPrehash(void) {
+    pthread_mutex_lock(&prehashMutex);
+    prehashStop = true;
+    while (prehashRunning > 0) {
+        pthread_cond_wait(&prehashFinished, &prehashMutex);
+    }
+    pthread_mutex_unlock(&prehashMutex);
+}
+
+// Runner thread: serve queued distortions one after another until none is left
+void *runDistortions(void *arg) {
+    (void)arg;
+    Job *job;
+    while ((job = jobTableNext(&jobTable)) != NULL) {
+        WorkerInfo workerInfo = { .job = job, .factor = job->factor };
+        strcpy(workerInfo.fileName, job->fileName);
+
+        // Gotham answers requests in order, so each request holds the socket until its reply is in
+        int assigned = -1;
+        pthread_mutex_lock(&gothamRequestMutex);
+        if (sockfd != -1) {
+            sendDistortionRequest(job->mediaType, job->fileName);
+            assigned = handleDistortionResponse(&workerInfo);
+        } else {
+            LOG_INFO("You must connect to Gotham first.\n");
+        }
+        pthread_mutex_unlock(&gothamRequestMutex);
+
+        jobTableFinish(&jobTable, job, assigned == 0 && workerCommunication(&workerInfo) == 0);
+    }
+    return NULL;
+}
+
+// STATS: Gotham's counters, asked for between distortion requests so its reply is not taken for a redirection
+void showGothamStats(void) {
+    uint8_t buffer[FRAME_SIZE];
+    int result = -1;
+
+    pthread_mutex_lock(&gothamRequestMutex);
+    if (sockfd != -1) {
+        sendGothamFrame(buffer, 0x13, 0);
+        result = statsReceive(sockfd, STDOUT_FILENO);
+    }
+    pthread_mutex_unlock(&gothamRequestMutex);
+
+    if (result < 0) {
+        printF("Could not get statistics from Gotham.\n");
     }
 }
 
+// STATS <ip>:<port>: a worker's counters, over a connection of their own
+void showWorkerStats(const char *address) {
+    char ip[128];
+    int port;
+    if (sscanf(address, "%127[^:]:%d", ip, &port) != 2) {
+        printF("Usage: STATS [<ip>:<port>]\n");
+        return;
+    }
+
+    struct sockaddr_in workerAddr = {0};
+    workerAddr.sin_family = AF_INET;
+    workerAddr.sin_port = htons(port);
+    int workerSock = socket(AF_INET, SOCK_STREAM, 0);
+    if (workerSock < 0 || inet_pton(AF_INET, ip, &workerAddr.sin_addr) != 1 ||
+            connect(workerSock, (struct sockaddr *)&workerAddr, sizeof(workerAddr)) < 0 ||
+            statsQuery(workerSock, STDOUT_FILENO) < 0) {
+        printF("Could not get statistics from the worker.\n");
+    }
+    if (workerSock >= 0) {
+        close(workerSock);
+    }
+}
 
 // Handle user commands
-void handleCommands(Fleck *user) {
+// Commands come from the prompt, or from a command file in batch mode; the end of the input ends the loop
+void handleCommands(Fleck *user, int inputFd, bool interactive) {
+    LineReader input;
     char *command;
+    size_t length;
 
+    lineReaderInit(&input, inputFd);
     while (1) {
-        printF("$ ");
+        if (interactive) {
+            printF("$ ");
+        }
 
-        command = readUntil(STDIN_FILENO, '\n');
-        
-        if (command == NULL || strlen(command) == 0) {
-            if (command != NULL) {
-                free(command);
-            }
+        // The line lives in the reader's buffer until the next command is read
+        command = lineReaderNext(&input, '\n', &length);
+        if (command == NULL) {
+            break;
+        }
+        if (length == 0) {
             continue;
         }
         
@@ -346,7 +788,6 @@ void handleCommands(Fleck *user) {
                 sockfd = socket(AF_INET, SOCK_STREAM, 0);
                 if (sockfd < 0) {
                     perror("Socket creation failed");
-                    free(command);
                     continue;
                 }
                 struct sockaddr_in serverAddr = {0};
@@ -367,9 +808,17 @@ void handleCommands(Fleck *user) {
             
         } else if (strcasecmp(command, "LOGOUT") == 0) {
             if (sockfd != -1) {
+                // Distortions still queued or running report their end to Gotham, which counts them
+                // against their workers until then, so the connection stays up until they are over
+                jobTableWaitIdle(&jobTable);
                 sendLogoutRequest(user->name);
+                pthread_mutex_lock(&gothamRequestMutex); // Let a pending distortion request get its reply
+                pthread_mutex_lock(&gothamMutex);
+                protocolSetOptions(sockfd, 0);
                 close(sockfd);
                 sockfd = -1;
+                pthread_mutex_unlock(&gothamMutex);
+                pthread_mutex_unlock(&gothamRequestMutex);
             }
         }else if (strncasecmp(command, "DISTORT ", 8) == 0) { // Ensure exact case-sensitive match
             if (sockfd != -1) {
@@ -387,53 +836,67 @@ void handleCommands(Fleck *user) {
 
                 if (fileName == NULL || factor == NULL || strlen(fileName) == 0 || strlen(factor) == 0) {
                     printF("Usage: DISTORT <file.xxx> <factor>\n");
-                    free(command);
                     continue;
                 }
 
-                const char *ext = strrchr(fileName, '.');
-                char mediaType[16] = {0};
-                if (ext != NULL) {
-                    if (strcasecmp(ext, ".txt") == 0) {
-                        strcpy(mediaType, "Text");
-                    } else if (strcasecmp(ext, ".wav") == 0 || strcasecmp(ext, ".mp3") == 0 ||
-                            strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0 ||
-                            strcasecmp(ext, ".png") == 0) {
-                        strcpy(mediaType, "Media");
-                    } else {
-                        printF("Unsupported file type\n");
-                        free(command);
-                        continue;
+                DistortBatch batch = { .factor = atoi(factor), .waitForRoom = !interactive };
+                if (strpbrk(fileName, "*?[") != NULL) {
+                    // A pattern queues every listed text and media file it matches, hashed together alongside
+                    MatchedFiles matched = { .skip = (size_t)user->maxJobs };
+                    if (folderIndexMatch(&folderIndex, fileName, collectMatchedFile, &matched) == 0) {
+                        printF("No files match the pattern.\n");
                     }
-                } else {
+                    for (size_t i = 0; i < matched.count; i++) {
+                        queueDistortion(matched.names[i], matched.types[i], &batch);
+                    }
+                    free(matched.types);
+                    startPrehash(&matched);
+                } else if (strrchr(fileName, '.') == NULL) {
                     printF("Invalid file name, missing extension)\n");
-                    free(command);
-                    continue;
+                } else if (fileTypeOf(fileName) == FILE_TYPE_NONE) {
+                    printF("Unsupported file type\n");
+                } else {
+                    queueDistortion(fileName, fileTypeOf(fileName), &batch);
                 }
-
-                // Construct and send the distortion request
-                sendDistortionRequest(mediaType, fileName);
-                handleDistortionResponse();
             } else {
                 printf("You must connect to Gotham first.\n");
             }
+        } else if (strcasecmp(command, "STATS") == 0) {
+            if (sockfd != -1) {
+                showGothamStats();
+            } else {
+                printF("You must connect to Gotham first.\n");
+            }
+        } else if (strncasecmp(command, "STATS ", 6) == 0) {
+            showWorkerStats(command + 6);
+        } else if (strcasecmp(command, "CHECK STATUS") == 0) {
+            jobTableRender(&jobTable, STDOUT_FILENO);
         } else if (strcasecmp(command, "LIST MEDIA") == 0) {
-            listFiles(user->userFile, FILE_TYPE_MEDIA);
+            folderIndexList(&folderIndex, FILE_TYPE_MEDIA, STDOUT_FILENO);
         } else if (strcasecmp(command, "LIST TEXT") == 0) {
-            listFiles(user->userFile, FILE_TYPE_TEXT);
+            folderIndexList(&folderIndex, FILE_TYPE_TEXT, STDOUT_FILENO);
         } else {
             printF("Unknown command.\n");
         }
-
-        free(command);
     }
+    lineReaderDestroy(&input);
 }
 
+// Usage: Fleck <config> [commandFile [summaryFile]]. With a command file Fleck runs in batch mode: it
+// executes the file's commands, waits for every distortion it queued, writes the per-job summary
+// (to summaryFile, or stdout) and exits with status 1 if any of them failed.
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
+    if (argc < 2 || argc > 4) {
         perror("Error: You need to provide a configuration file\n");
         return -1;
     }
+    int inputFd = STDIN_FILENO;
+    if (argc >= 3 && (inputFd = open(argv[2], O_RDONLY)) < 0) {
+        perror("Error opening the command file");
+        return -1;
+    }
+    bool interactive = argc < 3;
+    int status = 0;
 
     user = (Fleck *)readConfigFile(argv[1], "Fleck");
     if (user != NULL) {
@@ -441,9 +904,39 @@ int main(int argc, char *argv[]) {
         asprintf(&message, "%s user initialized\n", user->name);
         printF(message);
         free(message);
-        handleCommands(user);
+        if (fileCacheOpen(&fileCache, user->userFile) < 0) {
+            perror("Error opening the file cache, digests will be computed on every run");
+        }
+        folderIndexOpen(&folderIndex, user->userFile);
+        jobTableInit(&jobTable, user->maxJobs);
+        if (!interactive) {
+            jobTableRecord(&jobTable);
+        }
+        handleCommands(user, inputFd, interactive);
+
+        // Input is over either way: let queued and running distortions finish before leaving
+        jobTableWaitIdle(&jobTable);
+        if (!interactive) {
+            int summaryFd = (argc == 4) ? open(argv[3], O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+            if (summaryFd < 0) {
+                perror("Error creating the summary file");
+                summaryFd = STDOUT_FILENO;
+            }
+            status = jobTableSummary(&jobTable, summaryFd) > 0 ? 1 : 0;
+            if (summaryFd != STDOUT_FILENO) {
+                close(summaryFd);
+            }
+            close(inputFd);
+        }
+        if (sockfd != -1) {
+            sendLogoutRequest(user->name);
+            close(sockfd);
+        }
+        stopPrehash();
+        folderIndexClose(&folderIndex);
+        fileCacheClose(&fileCache);
         free(user);
     }
 
-    return 0;
+    return status;
 }
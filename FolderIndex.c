@@ -0,0 +1,346 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "FolderIndex.h"
+
+#define FOLDER_INITIAL_SLOTS 1024
+#define FOLDER_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static const char *typeNames[FILE_TYPE_COUNT] = { "text", "media" };
+
+// Extension lookup without a strcasecmp chain: the lowercased extension is compared once
+FileType fileTypeOf(const char *name) {
+    const char *ext = strrchr(name, '.');
+    if (ext == NULL) {
+        return FILE_TYPE_NONE;
+    }
+    char lower[6];
+    size_t length = 0;
+    for (ext++; ext[length] != '\0'; length++) {
+        if (length == sizeof(lower) - 1) {
+            return FILE_TYPE_NONE;
+        }
+        char c = ext[length];
+        lower[length] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+    lower[length] = '\0';
+
+    switch (length) {
+        case 3:
+            if (strcmp(lower, "txt") == 0) {
+                return FILE_TYPE_TEXT;
+            }
+            if (strcmp(lower, "wav") == 0 || strcmp(lower, "mp3") == 0 || strcmp(lower, "jpg") == 0 ||
+                    strcmp(lower, "png") == 0) {
+                return FILE_TYPE_MEDIA;
+            }
+            return FILE_TYPE_NONE;
+        case 4:
+            return strcmp(lower, "jpeg") == 0 ? FILE_TYPE_MEDIA : FILE_TYPE_NONE;
+        default:
+            return FILE_TYPE_NONE;
+    }
+}
+
+static uint32_t hashName(const char *name) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (; *name != '\0'; name++) {
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+    }
+    return hash;
+}
+
+// Slot holding name, or the empty slot where it would go
+static FolderSlot *findSlot(FolderIndex *index, const char *name, uint32_t hash) {
+    uint32_t mask = index->slotCount - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        FolderSlot *slot = &index->slots[i];
+        if (!slot->used ||
+                (slot->hash == hash && strcmp(index->lists[slot->type].names[slot->position], name) == 0)) {
+            return slot;
+        }
+    }
+}
+
+static int growSlots(FolderIndex *index) {
+    FolderSlot *old = index->slots;
+    uint32_t oldCount = index->slotCount;
+    FolderSlot *slots = calloc((size_t)oldCount * 2, sizeof(FolderSlot));
+    if (slots == NULL) {
+        return -1;
+    }
+    index->slots = slots;
+    index->slotCount = oldCount * 2;
+    for (uint32_t i = 0; i < oldCount; i++) {
+        if (old[i].used) {
+            uint32_t mask = index->slotCount - 1, j = old[i].hash & mask;
+            while (slots[j].used) {
+                j = (j + 1) & mask;
+            }
+            slots[j] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static void addFile(FolderIndex *index, const char *name) {
+    FileType type = fileTypeOf(name);
+    if (type == FILE_TYPE_NONE) {
+        return;
+    }
+    if ((index->used + 1) * 4 > index->slotCount * 3 && growSlots(index) < 0) {
+        return;
+    }
+    uint32_t hash = hashName(name);
+    FolderSlot *slot = findSlot(index, name, hash);
+    if (slot->used) {
+        return; // Already listed, e.g. a create seen both by the scan and by inotify
+    }
+
+    FolderList *list = &index->lists[type];
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+        char **names = realloc(list->names, capacity * sizeof(char *));
+        if (names == NULL) {
+            return;
+        }
+        list->names = names;
+        list->capacity = capacity;
+    }
+    char *copy = strdup(name);
+    if (copy == NULL) {
+        return;
+    }
+    list->names[list->count] = copy;
+    *slot = (FolderSlot){ .hash = hash, .position = list->count, .type = type, .used = 1 };
+    list->count++;
+    list->dirty = 1;
+    index->used++;
+}
+
+static void removeFile(FolderIndex *index, const char *name) {
+    if (fileTypeOf(name) == FILE_TYPE_NONE) {
+        return;
+    }
+    uint32_t hash = hashName(name);
+    FolderSlot *slot = findSlot(index, name, hash);
+    if (!slot->used) {
+        return;
+    }
+
+    // Swap the last name into the hole and repoint its slot
+    FolderList *list = &index->lists[slot->type];
+    uint32_t position = slot->position;
+    free(list->names[position]);
+    list->count--;
+    if (position != list->count) {
+        char *moved = list->names[list->count];
+        list->names[position] = moved;
+        findSlot(index, moved, hashName(moved))->position = position;
+    }
+    list->dirty = 1;
+
+    // Backward-shift deletion keeps every later entry of the probe run reachable
+    uint32_t mask = index->slotCount - 1;
+    uint32_t hole = slot - index->slots;
+    for (uint32_t i = (hole + 1) & mask; index->slots[i].used; i = (i + 1) & mask) {
+        uint32_t home = index->slots[i].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            index->slots[hole] = index->slots[i];
+            hole = i;
+        }
+    }
+    index->slots[hole].used = 0;
+    index->used--;
+}
+
+static void clearIndex(FolderIndex *index) {
+    for (int type = 0; type < FILE_TYPE_COUNT; type++) {
+        FolderList *list = &index->lists[type];
+        for (size_t i = 0; i < list->count; i++) {
+            free(list->names[i]);
+        }
+        list->count = 0;
+        list->dirty = 1;
+    }
+    memset(index->slots, 0, (size_t)index->slotCount * sizeof(FolderSlot));
+    index->used = 0;
+}
+
+// Only regular files are listed, as the readdir scan always did
+static int isRegularFile(FolderIndex *index, const char *name) {
+    struct stat fileStat;
+    char *path;
+    asprintf(&path, "%s/%s", index->directory, name);
+    int regular = lstat(path, &fileStat) == 0 && S_ISREG(fileStat.st_mode);
+    free(path);
+    return regular;
+}
+
+static int scanFolder(FolderIndex *index) {
+    if (index->inotifyFd >= 0 && index->watch < 0) {
+        // Watch before reading so nothing created during the scan is missed; duplicates are ignored
+        index->watch = inotify_add_watch(index->inotifyFd, index->directory, FOLDER_WATCH_MASK);
+    }
+
+    DIR *dir = opendir(index->directory);
+    if (dir == NULL) {
+        return -1;
+    }
+    clearIndex(index);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        int regular = entry->d_type == DT_REG ||
+                      (entry->d_type == DT_UNKNOWN && isRegularFile(index, entry->d_name));
+        if (regular) {
+            addFile(index, entry->d_name);
+        }
+    }
+    closedir(dir);
+    index->stale = index->inotifyFd < 0 || index->watch < 0;
+    return 0;
+}
+
+// Apply every queued inotify event without blocking
+static void drainEvents(FolderIndex *index) {
+    char buffer[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+
+    while ((length = read(index->inotifyFd, buffer, sizeof(buffer))) > 0) {
+        for (char *cursor = buffer; cursor < buffer + length;) {
+            const struct inotify_event *event = (const struct inotify_event *)cursor;
+            cursor += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                index->stale = 1;
+            } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                // The folder itself went away or was replaced: watch it again on the next scan
+                if (index->watch >= 0 && !(event->mask & IN_IGNORED)) {
+                    inotify_rm_watch(index->inotifyFd, index->watch);
+                }
+                index->watch = -1;
+                index->stale = 1;
+            } else if (event->len == 0 || (event->mask & IN_ISDIR)) {
+                continue;
+            } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                if (isRegularFile(index, event->name)) {
+                    addFile(index, event->name);
+                }
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                removeFile(index, event->name);
+            }
+        }
+    }
+}
+
+int folderIndexOpen(FolderIndex *index, const char *directory) {
+    memset(index, 0, sizeof(*index));
+    index->directory = strdup(directory);
+    index->watch = -1;
+    index->slotCount = FOLDER_INITIAL_SLOTS;
+    index->slots = calloc(index->slotCount, sizeof(FolderSlot));
+    index->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (index->inotifyFd < 0) {
+        perror("inotify unavailable, listings will rescan the user folder");
+    }
+    index->stale = 1;
+    return scanFolder(index);
+}
+
+void folderIndexClose(FolderIndex *index) {
+    clearIndex(index);
+    for (int type = 0; type < FILE_TYPE_COUNT; type++) {
+        free(index->lists[type].names);
+        free(index->lists[type].rendered);
+    }
+    if (index->inotifyFd >= 0) {
+        close(index->inotifyFd);
+    }
+    free(index->slots);
+    free(index->directory);
+}
+
+static int renderList(FolderList *list, FileType type) {
+    size_t length = strlen("Listing  files:\n") + strlen(typeNames[type]);
+    for (size_t i = 0; i < list->count; i++) {
+        length += strlen(list->names[i]) + 3; // "- " and newline
+    }
+    char *rendered = malloc(length + 1);
+    if (rendered == NULL) {
+        return -1;
+    }
+
+    char *cursor = rendered + sprintf(rendered, "Listing %s files:\n", typeNames[type]);
+    for (size_t i = 0; i < list->count; i++) {
+        size_t nameLength = strlen(list->names[i]);
+        *cursor++ = '-';
+        *cursor++ = ' ';
+        memcpy(cursor, list->names[i], nameLength);
+        cursor += nameLength;
+        *cursor++ = '\n';
+    }
+    free(list->rendered);
+    list->rendered = rendered;
+    list->renderedLength = cursor - rendered;
+    list->dirty = 0;
+    return 0;
+}
+
+// Bring the index up to date before it is read
+static int refreshIndex(FolderIndex *index) {
+    if (index->inotifyFd >= 0) {
+        drainEvents(index);
+    }
+    return (index->stale && scanFolder(index) < 0) ? -1 : 0;
+}
+
+int folderIndexList(FolderIndex *index, FileType type, int fd) {
+    if (refreshIndex(index) < 0) {
+        char *message;
+        asprintf(&message, "Error: Cannot open directory %s\n", index->directory);
+        write(fd, message, strlen(message));
+        free(message);
+        return -1;
+    }
+
+    FolderList *list = &index->lists[type];
+    if (list->dirty && renderList(list, type) < 0) {
+        return -1;
+    }
+    size_t total = 0;
+    while (total < list->renderedLength) {
+        ssize_t count = write(fd, list->rendered + total, list->renderedLength - total);
+        if (count <= 0) {
+            return -1;
+        }
+        total += count;
+    }
+    return 0;
+}
+
+size_t folderIndexMatch(FolderIndex *index, const char *pattern,
+        void (*visit)(const char *name, FileType type, void *context), void *context) {
+    size_t matches = 0;
+    if (refreshIndex(index) < 0) {
+        return 0;
+    }
+    for (int type = 0; type < FILE_TYPE_COUNT; type++) {
+        FolderList *list = &index->lists[type];
+        for (size_t i = 0; i < list->count; i++) {
+            if (fnmatch(pattern, list->names[i], FNM_PERIOD) == 0) {
+                visit(list->names[i], type, context);
+                matches++;
+            }
+        }
+    }
+    return matches;
+}
@@ -0,0 +1,53 @@
+#ifndef FOLDER_INDEX_H
+#define FOLDER_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    FILE_TYPE_TEXT,
+    FILE_TYPE_MEDIA,
+    FILE_TYPE_COUNT,
+    FILE_TYPE_NONE = FILE_TYPE_COUNT // Any other extension
+} FileType;
+
+// Listable files of one type; positions are stable until a file of that type is removed
+typedef struct {
+    char **names;
+    size_t count;
+    size_t capacity;
+    char *rendered;         // Listing text, rebuilt only after the list changed
+    size_t renderedLength;
+    int dirty;
+} FolderList;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t position;      // Index in lists[type]
+    uint8_t type;
+    uint8_t used;
+} FolderSlot;
+
+// In-memory index of the user folder: scanned once, then kept current from inotify events that are
+// drained whenever a listing is requested, so LIST never walks the directory again
+typedef struct {
+    char *directory;
+    int inotifyFd;          // -1 when inotify is unavailable: every listing rescans
+    int watch;
+    int stale;              // Rescan before the next listing (start, queue overflow, folder replaced)
+    FolderList lists[FILE_TYPE_COUNT];
+    FolderSlot *slots;      // Open addressing on the name hash
+    uint32_t slotCount;     // Power of two
+    uint32_t used;
+} FolderIndex;
+
+FileType fileTypeOf(const char *name);
+int folderIndexOpen(FolderIndex *index, const char *directory);
+void folderIndexClose(FolderIndex *index);
+// Write the listing of one type to fd with a single write
+int folderIndexList(FolderIndex *index, FileType type, int fd);
+// Call visit for every listed file whose name matches the fnmatch() pattern; returns the match count
+size_t folderIndexMatch(FolderIndex *index, const char *pattern,
+    void (*visit)(const char *name, FileType type, void *context), void *context);
+
+#endif
@@ -8,8 +8,98 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include "Protocol.h"
 #include "Common.h"
+#include "Transfer.h"
+#include "AudioDistort.h"
+#include "ImageDistort.h"
+#include "Worker.h"
 
+// Images are decoded whole, so larger uploads are returned unchanged
+#define MAX_IMAGE_FILE_SIZE (256ULL * 1024 * 1024)
+
+static unsigned int imageTileSize = IMAGE_DEFAULT_TILE_SIZE;
+static int imageThreads = 1;
+
+static int hasExtension(const char *fileName, const char *extension) {
+    const char *dot = strrchr(fileName, '.');
+    return dot != NULL && strcasecmp(dot, extension) == 0;
+}
+
+// Distort a PNG upload: receive it whole, shrink it `factor` times on tiles spread over
+// imageThreads threads and send back the re-encoded image. Undecodable files come back as they were.
+int distortImageJob(TransferSession *session, const WorkerJob *job, WorkerResult *jobResult) {
+    uint8_t *file = malloc(job->fileSize > 0 ? job->fileSize : 1);
+    uint8_t *frame = malloc(transferBufferSize(session->options));
+    uint64_t received = 0;
+    int result = (file != NULL && frame != NULL) ? 0 : -1;
+
+    while (result == 0 && received < job->fileSize) {
+        FrameView view;
+        if (transferReceive(session, frame, &view) < 0 || view.type != 0x05 ||
+                view.dataLength == 0 || view.dataLength > job->fileSize - received) {
+            result = -1;
+            break;
+        }
+        memcpy(file + received, view.data, view.dataLength);
+        md5Update(&jobResult->uploadHash, view.data, view.dataLength);
+        received += view.dataLength;
+        if (transferConsumed(session, received == job->fileSize) < 0) {
+            result = -1;
+        }
+    }
+    free(frame);
+
+    if (result == 0) {
+        Image source, target = {0};
+        uint8_t *png = NULL;
+        size_t pngLength = 0;
+        if (pngDecode(file, job->fileSize, &source) == 0) {
+            if (downscaleImage(&source, &target, job->factor, imageTileSize, imageThreads) == 0) {
+                png = pngEncode(&target, &pngLength);
+            }
+            imageFree(&source);
+            imageFree(&target);
+        }
+
+        const uint8_t *output = (png != NULL) ? png : file;
+        jobResult->size = (png != NULL) ? pngLength : job->fileSize;
+        md5Update(&jobResult->resultHash, output, jobResult->size);
+        result = transferSend(session, output, jobResult->size);
+        free(png);
+    }
+    free(file);
+    return result;
+}
+
+// WAV uploads stream through the worker pipeline: samples lose `factor` bits of depth
+// frame by frame, anything that is not PCM WAV is sent back unchanged.
+static void *startAudioStream(const WorkerJob *job, size_t *outputSlack) {
+    WavDistortStream *stream = malloc(sizeof(WavDistortStream));
+    if (stream == NULL) {
+        return NULL;
+    }
+    wavStreamInit(stream, job->factor);
+    *outputSlack = sizeof(stream->carry);
+    return stream;
+}
+
+static size_t distortAudioChunk(void *state, const uint8_t *input, size_t length, uint8_t *output, int final) {
+    return wavStreamDistort((WavDistortStream *)state, input, length, output, final);
+}
+
+static const WorkerStreamStage audioStage = {
+    .start = startAudioStream,
+    .process = distortAudioChunk,
+    .finish = free,
+};
+
+int distortMediaJob(TransferSession *session, const WorkerJob *job, WorkerResult *result) {
+    if (hasExtension(job->fileName, ".png") && job->fileSize <= MAX_IMAGE_FILE_SIZE) {
+        return distortImageJob(session, job, result);
+    }
+    return runPipelinedJob(session, job, &audioStage, result);
+}
 
 int main(int argc, char *argv[])
 {
@@ -32,30 +122,23 @@ int main(int argc, char *argv[])
         return -3;
     }
 
-    //DISPLAY THE HARLEY INFORMATIONS
-    printF("Harley Information:\n");
-    char *message;
-    asprintf(&message, "gotham ip address: %s\n", harley->gothamIpAddress);
-    printF(message);
-    
-    asprintf(&message, "gotham port: %d\n", harley->gothamPort);
-    printF(message);
-
-    asprintf(&message, "fleck IP Address: %s\n", harley->fleckIpAddress);
-    printF(message);
-
-    asprintf(&message, "fleck port: %d\n", harley->fleckPort);
-    printF(message);
+    imageTileSize = harley->tileSize;
+    imageThreads = harley->imageThreads;
 
-    asprintf(&message, "folder name: %s\n", harley->folderName);
-    printF(message);
+    WorkerSettings settings = {
+        .name = "Harley",
+        .media = "media",
+        .gothamIp = harley->gothamIpAddress,
+        .gothamPort = harley->gothamPort,
+        .workerType = harley->workerType,
+        .fleckIp = harley->fleckIpAddress,
+        .fleckPort = harley->fleckPort,
+        .poolSize = harley->poolSize,
+        .queueCapacity = harley->queueCapacity,
+        .handler = distortMediaJob,
+    };
 
-    asprintf(&message, "worker type: %s\n", harley->workerType);
-    printF(message);
-    
-    free(message);
-
-    
+    int result = runWorker(&settings);
     free(harley);
-    return 0;
+    return result;
 }
@@ -0,0 +1,659 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ImageCodec.h"
+
+static const uint8_t pngSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+// Deflate length and distance alphabets (RFC 1951, 3.2.5)
+static const uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                          257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                          8193, 12289, 16385, 24577};
+static const uint8_t distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                          7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// CRC-32 (ISO-HDLC polynomial) for PNG chunks, not the CRC32C used by our frames
+static uint32_t crcTable[256];
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+static void initCrcTable(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crcTable[n] = c;
+    }
+}
+
+static uint32_t pngCrc(const uint8_t *bytes, size_t length) {
+    pthread_once(&crcOnce, initCrcTable);
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++) {
+        crc = crcTable[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static uint32_t adler32(const uint8_t *bytes, size_t length) {
+    uint32_t a = 1, b = 0;
+    while (length > 0) {
+        size_t block = length < 5552 ? length : 5552; // Largest run before the sums overflow
+        length -= block;
+        while (block-- > 0) {
+            a += *bytes++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+static uint32_t readBe32(const uint8_t *bytes) {
+    return ((uint32_t)bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+static void writeBe32(uint8_t *bytes, uint32_t value) {
+    bytes[0] = value >> 24;
+    bytes[1] = (value >> 16) & 0xFF;
+    bytes[2] = (value >> 8) & 0xFF;
+    bytes[3] = value & 0xFF;
+}
+
+/* ---- Inflate ---- */
+
+typedef struct {
+    const uint8_t *input;
+    size_t inputLength;
+    size_t inputPosition;
+    uint32_t bitBuffer;
+    int bitCount;
+    uint8_t *output;
+    size_t outputLength;
+    size_t outputPosition;
+    int error;
+} Inflater;
+
+typedef struct {
+    uint16_t count[16];     // Codes of each length
+    uint16_t symbol[288];   // Symbols ordered by code
+} Huffman;
+
+static uint32_t readBits(Inflater *inflater, int need) {
+    uint32_t value = inflater->bitBuffer;
+    while (inflater->bitCount < need) {
+        if (inflater->inputPosition == inflater->inputLength) {
+            inflater->error = 1;
+            return 0;
+        }
+        value |= (uint32_t)inflater->input[inflater->inputPosition++] << inflater->bitCount;
+        inflater->bitCount += 8;
+    }
+    inflater->bitBuffer = value >> need;
+    inflater->bitCount -= need;
+    return value & ((1u << need) - 1);
+}
+
+// Canonical code from code lengths; fails on over-subscribed sets, incomplete ones are allowed
+static int buildHuffman(Huffman *huffman, const uint8_t *lengths, int count) {
+    uint16_t offsets[16];
+    memset(huffman->count, 0, sizeof(huffman->count));
+    for (int i = 0; i < count; i++) {
+        huffman->count[lengths[i]]++;
+    }
+    int left = 1;
+    for (int length = 1; length < 16; length++) {
+        left = (left << 1) - huffman->count[length];
+        if (left < 0) {
+            return -1;
+        }
+    }
+    offsets[1] = 0;
+    for (int length = 1; length < 15; length++) {
+        offsets[length + 1] = offsets[length] + huffman->count[length];
+    }
+    for (int i = 0; i < count; i++) {
+        if (lengths[i] != 0) {
+            huffman->symbol[offsets[lengths[i]]++] = i;
+        }
+    }
+    return 0;
+}
+
+static int decodeSymbol(Inflater *inflater, const Huffman *huffman) {
+    int code = 0, first = 0, index = 0;
+    for (int length = 1; length < 16; length++) {
+        code |= readBits(inflater, 1);
+        int count = huffman->count[length];
+        if (code - count < first) {
+            return huffman->symbol[index + (code - first)];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    inflater->error = 1;
+    return -1;
+}
+
+static int inflateCodes(Inflater *inflater, const Huffman *lengthCode, const Huffman *distanceCode) {
+    for (;;) {
+        int symbol = decodeSymbol(inflater, lengthCode);
+        if (inflater->error) {
+            return -1;
+        }
+        if (symbol < 256) {
+            if (inflater->outputPosition == inflater->outputLength) {
+                return -1;
+            }
+            inflater->output[inflater->outputPosition++] = symbol;
+        } else if (symbol == 256) {
+            return 0;
+        } else {
+            symbol -= 257;
+            if (symbol >= 29) {
+                return -1;
+            }
+            size_t length = lengthBase[symbol] + readBits(inflater, lengthExtra[symbol]);
+            int distanceSymbol = decodeSymbol(inflater, distanceCode);
+            if (inflater->error || distanceSymbol < 0 || distanceSymbol >= 30) {
+                return -1;
+            }
+            size_t distance = distanceBase[distanceSymbol] + readBits(inflater, distanceExtra[distanceSymbol]);
+            if (inflater->error || distance > inflater->outputPosition ||
+                    length > inflater->outputLength - inflater->outputPosition) {
+                return -1;
+            }
+            // Byte by byte: overlapping copies repeat the recent output
+            uint8_t *to = inflater->output + inflater->outputPosition;
+            const uint8_t *from = to - distance;
+            for (size_t i = 0; i < length; i++) {
+                to[i] = from[i];
+            }
+            inflater->outputPosition += length;
+        }
+    }
+}
+
+static int inflateStored(Inflater *inflater) {
+    inflater->bitBuffer = 0;
+    inflater->bitCount = 0;
+    if (inflater->inputLength - inflater->inputPosition < 4) {
+        return -1;
+    }
+    const uint8_t *header = inflater->input + inflater->inputPosition;
+    size_t length = header[0] | (header[1] << 8);
+    if ((header[2] | (header[3] << 8)) != (~length & 0xFFFF)) {
+        return -1;
+    }
+    inflater->inputPosition += 4;
+    if (length > inflater->inputLength - inflater->inputPosition ||
+            length > inflater->outputLength - inflater->outputPosition) {
+        return -1;
+    }
+    memcpy(inflater->output + inflater->outputPosition, inflater->input + inflater->inputPosition, length);
+    inflater->inputPosition += length;
+    inflater->outputPosition += length;
+    return 0;
+}
+
+static Huffman fixedLengthCode, fixedDistanceCode;
+static pthread_once_t fixedOnce = PTHREAD_ONCE_INIT;
+
+static void initFixedCodes(void) {
+    uint8_t lengths[288];
+    int symbol = 0;
+    for (; symbol < 144; symbol++) lengths[symbol] = 8;
+    for (; symbol < 256; symbol++) lengths[symbol] = 9;
+    for (; symbol < 280; symbol++) lengths[symbol] = 7;
+    for (; symbol < 288; symbol++) lengths[symbol] = 8;
+    buildHuffman(&fixedLengthCode, lengths, 288);
+    memset(lengths, 5, 30);
+    buildHuffman(&fixedDistanceCode, lengths, 30);
+}
+
+static int inflateFixed(Inflater *inflater) {
+    pthread_once(&fixedOnce, initFixedCodes);
+    return inflateCodes(inflater, &fixedLengthCode, &fixedDistanceCode);
+}
+
+static int inflateDynamic(Inflater *inflater) {
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    uint8_t lengths[320];
+    Huffman lengthCode, distanceCode;
+
+    int literalCount = readBits(inflater, 5) + 257;
+    int distanceCount = readBits(inflater, 5) + 1;
+    int codeCount = readBits(inflater, 4) + 4;
+    if (inflater->error || literalCount > 286 || distanceCount > 30) {
+        return -1;
+    }
+
+    memset(lengths, 0, 19);
+    for (int i = 0; i < codeCount; i++) {
+        lengths[order[i]] = readBits(inflater, 3);
+    }
+    if (inflater->error || buildHuffman(&lengthCode, lengths, 19) < 0) {
+        return -1;
+    }
+
+    int index = 0;
+    while (index < literalCount + distanceCount) {
+        int symbol = decodeSymbol(inflater, &lengthCode);
+        if (inflater->error) {
+            return -1;
+        }
+        if (symbol < 16) {
+            lengths[index++] = symbol;
+            continue;
+        }
+        int repeat;
+        uint8_t value = 0;
+        if (symbol == 16) {
+            if (index == 0) {
+                return -1;
+            }
+            value = lengths[index - 1];
+            repeat = 3 + readBits(inflater, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + readBits(inflater, 3);
+        } else {
+            repeat = 11 + readBits(inflater, 7);
+        }
+        if (inflater->error || index + repeat > literalCount + distanceCount) {
+            return -1;
+        }
+        while (repeat-- > 0) {
+            lengths[index++] = value;
+        }
+    }
+
+    if (lengths[256] == 0 || buildHuffman(&lengthCode, lengths, literalCount) < 0 ||
+            buildHuffman(&distanceCode, lengths + literalCount, distanceCount) < 0) {
+        return -1;
+    }
+    return inflateCodes(inflater, &lengthCode, &distanceCode);
+}
+
+// zlib stream into a buffer of exactly the expected size
+static int zlibInflate(const uint8_t *input, size_t inputLength, uint8_t *output, size_t outputLength) {
+    if (inputLength < 6 || (input[0] & 0x0F) != 8 || (input[1] & 0x20) || ((input[0] << 8) | input[1]) % 31 != 0) {
+        return -1;
+    }
+    Inflater inflater = {input, inputLength - 4, 2, 0, 0, output, outputLength, 0, 0};
+
+    int last;
+    do {
+        last = readBits(&inflater, 1);
+        int type = readBits(&inflater, 2);
+        int result;
+        if (inflater.error) {
+            return -1;
+        }
+        if (type == 0) {
+            result = inflateStored(&inflater);
+        } else if (type == 1) {
+            result = inflateFixed(&inflater);
+        } else if (type == 2) {
+            result = inflateDynamic(&inflater);
+        } else {
+            result = -1;
+        }
+        if (result < 0) {
+            return -1;
+        }
+    } while (!last);
+
+    if (inflater.outputPosition != outputLength) {
+        return -1;
+    }
+    // The checksum follows the last whole byte of the deflate stream
+    size_t checksumAt = inflater.inputPosition - inflater.bitCount / 8;
+    if (checksumAt + 4 > inputLength || readBe32(input + checksumAt) != adler32(output, outputLength)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* ---- Deflate (single fixed-Huffman block, greedy LZ77) ---- */
+
+typedef struct {
+    uint8_t *output;
+    size_t position;
+    uint32_t bitBuffer;
+    int bitCount;
+} BitWriter;
+
+static void putBits(BitWriter *writer, uint32_t value, int count) {
+    writer->bitBuffer |= value << writer->bitCount;
+    writer->bitCount += count;
+    while (writer->bitCount >= 8) {
+        writer->output[writer->position++] = writer->bitBuffer & 0xFF;
+        writer->bitBuffer >>= 8;
+        writer->bitCount -= 8;
+    }
+}
+
+// Huffman codes go out most significant bit first
+static void putCode(BitWriter *writer, uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < length; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    putBits(writer, reversed, length);
+}
+
+static void putLiteral(BitWriter *writer, int symbol) {
+    if (symbol < 144) {
+        putCode(writer, 0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        putCode(writer, 0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        putCode(writer, symbol - 256, 7);
+    } else {
+        putCode(writer, 0xC0 + symbol - 280, 8);
+    }
+}
+
+static void putMatch(BitWriter *writer, size_t length, size_t distance) {
+    int code = 28;
+    while (lengthBase[code] > length) {
+        code--;
+    }
+    putLiteral(writer, 257 + code);
+    putBits(writer, length - lengthBase[code], lengthExtra[code]);
+
+    code = 29;
+    while (distanceBase[code] > distance) {
+        code--;
+    }
+    putCode(writer, code, 5);
+    putBits(writer, distance - distanceBase[code], distanceExtra[code]);
+}
+
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_HASH_BITS 15
+
+static uint32_t hash3(const uint8_t *bytes) {
+    return ((bytes[0] << 16 | bytes[1] << 8 | bytes[2]) * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+// zlib stream of `input` into `output`, which holds at least input + input/8 + 64 bytes
+static size_t zlibDeflate(const uint8_t *input, size_t length, uint8_t *output) {
+    int64_t *head = malloc(sizeof(int64_t) << DEFLATE_HASH_BITS);
+    if (head == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < ((size_t)1 << DEFLATE_HASH_BITS); i++) {
+        head[i] = -1;
+    }
+
+    BitWriter writer = {output, 0, 0, 0};
+    output[writer.position++] = 0x78;
+    output[writer.position++] = 0x01;
+    putBits(&writer, 1, 1); // Final block
+    putBits(&writer, 1, 2); // Fixed Huffman codes
+
+    size_t i = 0;
+    while (i < length) {
+        size_t best = 0;
+        if (i + 3 <= length) {
+            uint32_t h = hash3(input + i);
+            int64_t candidate = head[h];
+            head[h] = i;
+            if (candidate >= 0 && i - candidate <= DEFLATE_WINDOW) {
+                size_t limit = length - i < 258 ? length - i : 258;
+                while (best < limit && input[candidate + best] == input[i + best]) {
+                    best++;
+                }
+            }
+            if (best >= 3) {
+                putMatch(&writer, best, i - candidate);
+                for (size_t k = 1; k < best && i + k + 3 <= length; k++) {
+                    head[hash3(input + i + k)] = i + k;
+                }
+                i += best;
+                continue;
+            }
+        }
+        putLiteral(&writer, input[i++]);
+    }
+    putLiteral(&writer, 256);
+    if (writer.bitCount > 0) {
+        output[writer.position++] = writer.bitBuffer; // Last partial byte, zero padded
+    }
+    free(head);
+
+    writeBe32(output + writer.position, adler32(input, length));
+    return writer.position + 4;
+}
+
+/* ---- PNG ---- */
+
+int isPng(const uint8_t *data, size_t length) {
+    return length >= sizeof(pngSignature) && memcmp(data, pngSignature, sizeof(pngSignature)) == 0;
+}
+
+static uint8_t paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return (pb <= pc) ? b : c;
+}
+
+static int unfilter(uint8_t *raw, uint32_t height, size_t rowBytes, size_t bpp) {
+    uint8_t *previous = NULL;
+    for (uint32_t y = 0; y < height; y++) {
+        uint8_t *row = raw + y * (rowBytes + 1);
+        uint8_t filter = row[0];
+        row++;
+        for (size_t x = 0; x < rowBytes; x++) {
+            int a = (x >= bpp) ? row[x - bpp] : 0;
+            int b = previous ? previous[x] : 0;
+            int c = (previous && x >= bpp) ? previous[x - bpp] : 0;
+            switch (filter) {
+                case 0: break;
+                case 1: row[x] += a; break;
+                case 2: row[x] += b; break;
+                case 3: row[x] += (a + b) >> 1; break;
+                case 4: row[x] += paeth(a, b, c); break;
+                default: return -1;
+            }
+        }
+        previous = row;
+    }
+    return 0;
+}
+
+int pngDecode(const uint8_t *data, size_t length, Image *image) {
+    memset(image, 0, sizeof(*image));
+    if (!isPng(data, length)) {
+        return -1;
+    }
+
+    uint32_t width = 0, height = 0;
+    int depth = 0, colorType = -1, interlace = 0;
+    uint8_t palette[256][4];
+    int paletteSize = 0, paletteAlpha = 0;
+    uint8_t *compressed = NULL;
+    size_t compressedLength = 0;
+
+    // Walk the chunks; IDAT contents are concatenated into one zlib stream
+    size_t offset = sizeof(pngSignature);
+    int ended = 0;
+    while (!ended && offset + 12 <= length) {
+        uint32_t chunkLength = readBe32(data + offset);
+        const uint8_t *type = data + offset + 4;
+        const uint8_t *chunk = data + offset + 8;
+        if (chunkLength > length - offset - 12 || readBe32(chunk + chunkLength) != pngCrc(type, chunkLength + 4)) {
+            break;
+        }
+
+        if (memcmp(type, "IHDR", 4) == 0 && chunkLength == 13) {
+            width = readBe32(chunk);
+            height = readBe32(chunk + 4);
+            depth = chunk[8];
+            colorType = chunk[9];
+            interlace = chunk[12];
+        } else if (memcmp(type, "PLTE", 4) == 0 && chunkLength % 3 == 0 && chunkLength <= 768) {
+            paletteSize = chunkLength / 3;
+            for (int i = 0; i < paletteSize; i++) {
+                memcpy(palette[i], chunk + 3 * i, 3);
+                palette[i][3] = 0xFF;
+            }
+        } else if (memcmp(type, "tRNS", 4) == 0 && colorType == 3) {
+            // Colour-key transparency of gray/RGB images is not kept
+            for (uint32_t i = 0; i < chunkLength && i < (uint32_t)paletteSize; i++) {
+                palette[i][3] = chunk[i];
+            }
+            paletteAlpha = 1;
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            uint8_t *grown = realloc(compressed, compressedLength + chunkLength);
+            if (grown == NULL) {
+                break;
+            }
+            compressed = grown;
+            memcpy(compressed + compressedLength, chunk, chunkLength);
+            compressedLength += chunkLength;
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            ended = 1;
+        }
+        offset += 12 + chunkLength;
+    }
+
+    int fileChannels;
+    switch (colorType) {
+        case 0: fileChannels = 1; break;
+        case 2: fileChannels = 3; break;
+        case 3: fileChannels = 1; break;
+        case 4: fileChannels = 2; break;
+        case 6: fileChannels = 4; break;
+        default: fileChannels = 0; break;
+    }
+    int depthOk = (depth == 8) || (depth == 16 && colorType != 3) ||
+                  ((depth == 1 || depth == 2 || depth == 4) && (colorType == 0 || colorType == 3));
+    if (!ended || fileChannels == 0 || !depthOk || interlace != 0 || width == 0 || height == 0 ||
+            (uint64_t)width * height > IMAGE_MAX_PIXELS || (colorType == 3 && paletteSize == 0)) {
+        free(compressed);
+        return -1;
+    }
+
+    size_t rowBytes = ((size_t)width * fileChannels * depth + 7) / 8;
+    size_t bpp = (fileChannels * depth + 7) / 8;
+    uint8_t *raw = malloc((rowBytes + 1) * height);
+    if (raw == NULL || zlibInflate(compressed, compressedLength, raw, (rowBytes + 1) * height) < 0 ||
+            unfilter(raw, height, rowBytes, bpp) < 0) {
+        free(compressed);
+        free(raw);
+        return -1;
+    }
+    free(compressed);
+
+    image->width = width;
+    image->height = height;
+    image->channels = (colorType == 3) ? (paletteAlpha ? 4 : 3) : fileChannels;
+    image->pixels = malloc((size_t)width * height * image->channels);
+    if (image->pixels == NULL) {
+        free(raw);
+        return -1;
+    }
+
+    // Expand every sample to 8 bits: high byte of 16-bit samples, scaled low depths, palette lookups
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *row = raw + y * (rowBytes + 1) + 1;
+        uint8_t *out = image->pixels + (size_t)y * width * image->channels;
+        if (depth == 8 && colorType != 3) {
+            memcpy(out, row, rowBytes);
+        } else if (depth == 16) {
+            for (size_t i = 0; i < (size_t)width * fileChannels; i++) {
+                out[i] = row[2 * i];
+            }
+        } else {
+            int perByte = 8 / depth;
+            int maximum = (1 << depth) - 1;
+            for (uint32_t x = 0; x < width; x++) {
+                int shift = 8 - depth * (x % perByte + 1);
+                int value = (depth == 8) ? row[x] : (row[x / perByte] >> shift) & maximum;
+                if (colorType == 3) {
+                    if (value >= paletteSize) {
+                        value = 0;
+                    }
+                    memcpy(out + x * image->channels, palette[value], image->channels);
+                } else {
+                    out[x] = value * 255 / maximum;
+                }
+            }
+        }
+    }
+    free(raw);
+    return 0;
+}
+
+static uint8_t *putChunk(uint8_t *out, const char *type, const uint8_t *chunk, uint32_t length) {
+    writeBe32(out, length);
+    memcpy(out + 4, type, 4);
+    if (length > 0) {
+        memmove(out + 8, chunk, length);
+    }
+    writeBe32(out + 8 + length, pngCrc(out + 4, length + 4));
+    return out + 12 + length;
+}
+
+uint8_t *pngEncode(const Image *image, size_t *length) {
+    static const uint8_t colorTypes[5] = {0, 0, 4, 2, 6};
+    size_t rowBytes = (size_t)image->width * image->channels;
+    size_t rawLength = (rowBytes + 1) * image->height;
+
+    // Sub filter on every row: cheap and it turns smooth gradients into runs for LZ77
+    uint8_t *raw = malloc(rawLength);
+    size_t deflateMax = rawLength + rawLength / 8 + 64;
+    uint8_t *png = malloc(sizeof(pngSignature) + 25 + 12 + deflateMax + 12);
+    if (raw == NULL || png == NULL) {
+        free(raw);
+        free(png);
+        return NULL;
+    }
+    for (uint32_t y = 0; y < image->height; y++) {
+        const uint8_t *row = image->pixels + y * rowBytes;
+        uint8_t *filtered = raw + y * (rowBytes + 1);
+        filtered[0] = 1;
+        for (size_t x = 0; x < rowBytes; x++) {
+            filtered[x + 1] = row[x] - ((x >= (size_t)image->channels) ? row[x - image->channels] : 0);
+        }
+    }
+
+    uint8_t header[13];
+    writeBe32(header, image->width);
+    writeBe32(header + 4, image->height);
+    header[8] = 8;
+    header[9] = colorTypes[image->channels];
+    header[10] = header[11] = header[12] = 0;
+
+    uint8_t *out = png;
+    memcpy(out, pngSignature, sizeof(pngSignature));
+    out = putChunk(out + sizeof(pngSignature), "IHDR", header, sizeof(header));
+    // Compress straight into the IDAT body, then frame it
+    size_t compressedLength = zlibDeflate(raw, rawLength, out + 8);
+    free(raw);
+    if (compressedLength == 0) {
+        free(png);
+        return NULL;
+    }
+    out = putChunk(out, "IDAT", out + 8, compressedLength);
+    out = putChunk(out, "IEND", NULL, 0);
+
+    *length = out - png;
+    return png;
+}
+
+void imageFree(Image *image) {
+    free(image->pixels);
+    image->pixels = NULL;
+}
@@ -0,0 +1,25 @@
+#ifndef IMAGE_CODEC_H
+#define IMAGE_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Self-contained PNG codec (no zlib): decodes every non-interlaced PNG colour type and depth
+// to 8-bit channels, encodes 8-bit gray/gray-alpha/RGB/RGBA with fixed-Huffman deflate.
+#define IMAGE_MAX_PIXELS (1u << 26)
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    int channels;       // 1 gray, 2 gray+alpha, 3 RGB, 4 RGBA
+    uint8_t *pixels;    // Row-major, width * channels bytes per row
+} Image;
+
+int isPng(const uint8_t *data, size_t length);
+// 0 on success, -1 for corrupt or unsupported (interlaced) images
+int pngDecode(const uint8_t *data, size_t length, Image *image);
+// Returns a malloc'd PNG file or NULL
+uint8_t *pngEncode(const Image *image, size_t *length);
+void imageFree(Image *image);
+
+#endif
@@ -0,0 +1,109 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include "ImageDistort.h"
+
+typedef struct {
+    const Image *source;
+    Image *target;
+    unsigned int factor;
+    unsigned int tileSize;
+    uint32_t tilesAcross;
+    uint32_t tileCount;
+    uint32_t nextTile;      // Claimed with an atomic increment
+} DownscaleJob;
+
+static void downscaleTile(const DownscaleJob *job, uint32_t tile) {
+    const Image *source = job->source;
+    Image *target = job->target;
+    int channels = source->channels;
+    uint32_t x0 = (tile % job->tilesAcross) * job->tileSize;
+    uint32_t y0 = (tile / job->tilesAcross) * job->tileSize;
+    uint32_t x1 = (x0 + job->tileSize < target->width) ? x0 + job->tileSize : target->width;
+    uint32_t y1 = (y0 + job->tileSize < target->height) ? y0 + job->tileSize : target->height;
+    uint64_t sums[4 * 256];  // Up to 256 output pixels of one tile row are summed at a time
+
+    for (uint32_t y = y0; y < y1; y++) {
+        uint32_t sourceTop = y * job->factor;
+        uint32_t sourceBottom = (sourceTop + job->factor < source->height) ? sourceTop + job->factor : source->height;
+
+        for (uint32_t xs = x0; xs < x1; xs += 256) {
+            uint32_t xe = (xs + 256 < x1) ? xs + 256 : x1;
+            uint32_t sourceLeft = xs * job->factor;
+            uint32_t sourceRight = (xe * job->factor < source->width) ? xe * job->factor : source->width;
+
+            // Walk the source block row by row so reads stay sequential
+            for (uint32_t i = 0; i < (xe - xs) * channels; i++) {
+                sums[i] = 0;
+            }
+            for (uint32_t sy = sourceTop; sy < sourceBottom; sy++) {
+                const uint8_t *row = source->pixels + ((size_t)sy * source->width + sourceLeft) * channels;
+                for (uint32_t sx = 0; sx < sourceRight - sourceLeft; sx++) {
+                    uint64_t *sum = sums + (sx / job->factor) * channels;
+                    for (int c = 0; c < channels; c++) {
+                        sum[c] += row[sx * channels + c];
+                    }
+                }
+            }
+
+            uint8_t *out = target->pixels + ((size_t)y * target->width + xs) * channels;
+            for (uint32_t x = xs; x < xe; x++) {
+                uint32_t blockLeft = x * job->factor;
+                uint32_t blockRight = (blockLeft + job->factor < source->width) ? blockLeft + job->factor : source->width;
+                uint32_t count = (blockRight - blockLeft) * (sourceBottom - sourceTop);
+                for (int c = 0; c < channels; c++) {
+                    *out++ = (sums[(x - xs) * channels + c] + count / 2) / count;
+                }
+            }
+        }
+    }
+}
+
+static void *downscaleWorker(void *arg) {
+    DownscaleJob *job = (DownscaleJob *)arg;
+    for (;;) {
+        uint32_t tile = __atomic_fetch_add(&job->nextTile, 1, __ATOMIC_RELAXED);
+        if (tile >= job->tileCount) {
+            return NULL;
+        }
+        downscaleTile(job, tile);
+    }
+}
+
+int downscaleImage(const Image *source, Image *target, unsigned int factor, unsigned int tileSize, int threads) {
+    if (factor < 1) {
+        factor = 1;
+    }
+    if (tileSize < 1) {
+        tileSize = IMAGE_DEFAULT_TILE_SIZE;
+    }
+
+    target->width = (source->width + factor - 1) / factor;
+    target->height = (source->height + factor - 1) / factor;
+    target->channels = source->channels;
+    target->pixels = malloc((size_t)target->width * target->height * target->channels);
+    if (target->pixels == NULL) {
+        return -1;
+    }
+
+    DownscaleJob job = {source, target, factor, tileSize, 0, 0, 0};
+    job.tilesAcross = (target->width + tileSize - 1) / tileSize;
+    job.tileCount = job.tilesAcross * ((target->height + tileSize - 1) / tileSize);
+
+    if (threads > (int)job.tileCount) {
+        threads = job.tileCount;
+    }
+    pthread_t *helpers = (threads > 1) ? malloc(sizeof(pthread_t) * (threads - 1)) : NULL;
+    int started = 0;
+    for (int i = 0; helpers != NULL && i < threads - 1; i++) {
+        if (pthread_create(&helpers[i], NULL, downscaleWorker, &job) != 0) {
+            break; // The threads we have (at least this one) finish the tiles
+        }
+        started++;
+    }
+    downscaleWorker(&job);
+    for (int i = 0; i < started; i++) {
+        pthread_join(helpers[i], NULL);
+    }
+    free(helpers);
+    return 0;
+}
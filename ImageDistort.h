@@ -0,0 +1,13 @@
+#ifndef IMAGE_DISTORT_H
+#define IMAGE_DISTORT_H
+
+#include "ImageCodec.h"
+
+#define IMAGE_DEFAULT_TILE_SIZE 64
+
+// Shrink `source` by `factor` in both directions, each output pixel the rounded mean of its
+// factor x factor block. The output is cut into tileSize x tileSize tiles that `threads`
+// threads (the caller included) claim one at a time, so one large image keeps every core busy.
+int downscaleImage(const Image *source, Image *target, unsigned int factor, unsigned int tileSize, int threads);
+
+#endif
@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "JobTable.h"
+
+static const char *stateNames[] = { "queued", "requesting worker", "transferring", "done", "failed" };
+
+void jobTableInit(JobTable *table, int maxRunning) {
+    memset(table, 0, sizeof(*table));
+    pthread_mutex_init(&table->mutex, NULL);
+    pthread_cond_init(&table->finished, NULL);
+    table->nextId = 1;
+    table->maxRunning = maxRunning;
+}
+
+static double secondsBetween(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+// A free slot, or else the oldest finished job makes room
+static Job *findRoom(JobTable *table) {
+    Job *slot = NULL;
+    for (int i = 0; i < JOB_TABLE_SIZE; i++) {
+        Job *job = &table->jobs[i];
+        if (job->id == 0) {
+            return job;
+        }
+        if ((job->state == JOB_DONE || job->state == JOB_FAILED) && (slot == NULL || job->id < slot->id)) {
+            slot = job;
+        }
+    }
+    return slot;
+}
+
+int jobTableAdd(JobTable *table, const char *fileName, const char *mediaType, int factor, int waitForRoom,
+        int *startRunner) {
+    pthread_mutex_lock(&table->mutex);
+    Job *slot;
+    while ((slot = findRoom(table)) == NULL && waitForRoom) {
+        pthread_cond_wait(&table->finished, &table->mutex);
+    }
+    if (slot == NULL) {
+        pthread_mutex_unlock(&table->mutex);
+        *startRunner = 0;
+        return -1;
+    }
+
+    memset(slot, 0, sizeof(*slot));
+    slot->id = table->nextId++;
+    slot->state = JOB_QUEUED;
+    strncpy(slot->fileName, fileName, sizeof(slot->fileName) - 1);
+    strncpy(slot->mediaType, mediaType, sizeof(slot->mediaType) - 1);
+    slot->factor = factor;
+    clock_gettime(CLOCK_MONOTONIC, &slot->queuedAt);
+
+    *startRunner = table->running < table->maxRunning;
+    if (*startRunner) {
+        table->running++;
+    }
+    int id = slot->id;
+    pthread_mutex_unlock(&table->mutex);
+    return id;
+}
+
+Job *jobTableNext(JobTable *table) {
+    pthread_mutex_lock(&table->mutex);
+    Job *next = NULL;
+    for (int i = 0; i < JOB_TABLE_SIZE; i++) {
+        Job *job = &table->jobs[i];
+        if (job->id != 0 && job->state == JOB_QUEUED && (next == NULL || job->id < next->id)) {
+            next = job;
+        }
+    }
+    if (next != NULL) {
+        next->state = JOB_REQUESTING;
+    } else {
+        table->running--;
+    }
+    pthread_mutex_unlock(&table->mutex);
+    return next;
+}
+
+void jobTableStartTransfer(JobTable *table, Job *job, const char *workerIp, int workerPort, uint64_t fileSize) {
+    pthread_mutex_lock(&table->mutex);
+    strncpy(job->workerIp, workerIp, sizeof(job->workerIp) - 1);
+    job->workerPort = workerPort;
+    job->fileSize = fileSize;
+    clock_gettime(CLOCK_MONOTONIC, &job->startedAt);
+    job->state = JOB_TRANSFERRING;
+    pthread_mutex_unlock(&table->mutex);
+}
+
+void jobTableFinish(JobTable *table, Job *job, int succeeded) {
+    pthread_mutex_lock(&table->mutex);
+    clock_gettime(CLOCK_MONOTONIC, &job->endedAt);
+    if (job->startedAt.tv_sec == 0 && job->startedAt.tv_nsec == 0) {
+        job->startedAt = job->endedAt; // Never reached a worker
+    }
+    job->state = succeeded ? JOB_DONE : JOB_FAILED;
+    if (table->summary != NULL) {
+        fprintf(table->summary, "%d\t%s\t%d\t%s\t%.0f\t%llu\t%llu\n", job->id, job->fileName, job->factor,
+            succeeded ? "ok" : "failed", secondsBetween(&job->queuedAt, &job->endedAt) * 1000,
+            (unsigned long long)__atomic_load_n(&job->sentBytes, __ATOMIC_RELAXED),
+            (unsigned long long)__atomic_load_n(&job->receivedBytes, __ATOMIC_RELAXED));
+        table->failed += !succeeded;
+    }
+    pthread_cond_broadcast(&table->finished);
+    pthread_mutex_unlock(&table->mutex);
+}
+
+// Human-readable byte count into a small buffer
+static const char *formatBytes(char *buffer, size_t size, double bytes) {
+    static const char *units[] = { "B", "KB", "MB", "GB", "TB" };
+    int unit = 0;
+    while (bytes >= 1024 && unit < 4) {
+        bytes /= 1024;
+        unit++;
+    }
+    snprintf(buffer, size, unit == 0 ? "%.0f %s" : "%.1f %s", bytes, units[unit]);
+    return buffer;
+}
+
+static void renderJob(FILE *out, const Job *job, const struct timespec *now) {
+    char sent[32], received[32], total[32], rate[32];
+    uint64_t sentBytes = __atomic_load_n(&job->sentBytes, __ATOMIC_RELAXED);
+    uint64_t receivedBytes = __atomic_load_n(&job->receivedBytes, __ATOMIC_RELAXED);
+
+    fprintf(out, "#%d %s (factor %d): %s", job->id, job->fileName, job->factor, stateNames[job->state]);
+    if (job->state == JOB_QUEUED || job->state == JOB_REQUESTING) {
+        fprintf(out, " for %.1f s\n", secondsBetween(&job->queuedAt, now));
+        return;
+    }
+
+    const struct timespec *end = (job->state == JOB_TRANSFERRING) ? now : &job->endedAt;
+    double elapsed = secondsBetween(&job->startedAt, end);
+    double throughput = elapsed > 0 ? (sentBytes + receivedBytes) / elapsed : 0;
+    if (job->workerPort != 0) {
+        fprintf(out, " on %s:%d", job->workerIp, job->workerPort);
+    }
+
+    if (job->state == JOB_TRANSFERRING) {
+        double percent = job->fileSize > 0 ? 100.0 * sentBytes / job->fileSize : 100.0;
+        fprintf(out, ", %.0f%% of %s sent, %s received, %s/s",
+            percent, formatBytes(total, sizeof(total), job->fileSize),
+            formatBytes(received, sizeof(received), receivedBytes), formatBytes(rate, sizeof(rate), throughput));
+        if (sentBytes < job->fileSize && sentBytes > 0) {
+            // Remaining upload at the upload rate so far; the result streams back alongside it
+            fprintf(out, ", ETA %.1f s\n", (job->fileSize - sentBytes) * elapsed / sentBytes);
+        } else {
+            fprintf(out, sentBytes > 0 ? ", waiting for the result\n" : "\n");
+        }
+    } else {
+        fprintf(out, ", %s sent, %s received in %.2f s (%s/s)\n",
+            formatBytes(sent, sizeof(sent), sentBytes), formatBytes(received, sizeof(received), receivedBytes),
+            elapsed, formatBytes(rate, sizeof(rate), throughput));
+    }
+}
+
+static void writeAll(int fd, const char *text, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t written = write(fd, text + total, length - total);
+        if (written <= 0) {
+            break;
+        }
+        total += written;
+    }
+}
+
+static int compareJobIds(const void *a, const void *b) {
+    return (*(const Job *const *)a)->id - (*(const Job *const *)b)->id;
+}
+
+void jobTableRender(JobTable *table, int fd) {
+    char *text = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&text, &length);
+    if (out == NULL) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&table->mutex);
+
+    // Oldest first
+    const Job *jobs[JOB_TABLE_SIZE];
+    int count = 0, active = 0, queued = 0;
+    for (int i = 0; i < JOB_TABLE_SIZE; i++) {
+        if (table->jobs[i].id != 0) {
+            jobs[count++] = &table->jobs[i];
+        }
+    }
+    qsort(jobs, count, sizeof(jobs[0]), compareJobIds);
+    for (int i = 0; i < count; i++) {
+        renderJob(out, jobs[i], &now);
+        active += jobs[i]->state == JOB_REQUESTING || jobs[i]->state == JOB_TRANSFERRING;
+        queued += jobs[i]->state == JOB_QUEUED;
+    }
+    fprintf(out, count == 0 ? "No distortions yet.\n" : "%d running, %d queued (limit %d at once).\n",
+        active, queued, table->maxRunning);
+    pthread_mutex_unlock(&table->mutex);
+
+    fclose(out);
+    writeAll(fd, text, length);
+    free(text);
+}
+
+void jobTableWaitIdle(JobTable *table) {
+    pthread_mutex_lock(&table->mutex);
+    for (;;) {
+        int busy = 0;
+        for (int i = 0; i < JOB_TABLE_SIZE && !busy; i++) {
+            JobState state = table->jobs[i].state;
+            busy = table->jobs[i].id != 0 && state != JOB_DONE && state != JOB_FAILED;
+        }
+        if (!busy) {
+            break;
+        }
+        pthread_cond_wait(&table->finished, &table->mutex);
+    }
+    pthread_mutex_unlock(&table->mutex);
+}
+
+int jobTableRecord(JobTable *table) {
+    pthread_mutex_lock(&table->mutex);
+    if (table->summary == NULL) {
+        table->summary = open_memstream(&table->summaryText, &table->summaryLength);
+    }
+    pthread_mutex_unlock(&table->mutex);
+    return table->summary != NULL ? 0 : -1;
+}
+
+int jobTableSummary(JobTable *table, int fd) {
+    static const char header[] = "id\tfile\tfactor\tresult\tlatency_ms\tsent_bytes\treceived_bytes\n";
+    pthread_mutex_lock(&table->mutex);
+    int failed = table->failed;
+    writeAll(fd, header, sizeof(header) - 1);
+    if (table->summary != NULL && fflush(table->summary) == 0) {
+        writeAll(fd, table->summaryText, table->summaryLength);
+    }
+    pthread_mutex_unlock(&table->mutex);
+    return failed;
+}
@@ -0,0 +1,69 @@
+#ifndef JOB_TABLE_H
+#define JOB_TABLE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+// Distortions Fleck has been asked for, most recent JOB_TABLE_SIZE kept for CHECK STATUS.
+// At most maxRunning are served at once by runner threads that pick queued jobs in order.
+#define JOB_TABLE_SIZE 256
+
+typedef enum {
+    JOB_QUEUED,
+    JOB_REQUESTING,     // Asking Gotham for a worker
+    JOB_TRANSFERRING,   // Exchanging the file with the worker
+    JOB_DONE,
+    JOB_FAILED
+} JobState;
+
+typedef struct {
+    int id;                 // 0 for a free slot
+    JobState state;
+    char fileName[128];
+    char mediaType[16];
+    int factor;
+    char workerIp[128];
+    int workerPort;
+    uint64_t fileSize;
+    uint64_t sentBytes;     // Updated atomically by the runner while transferring
+    uint64_t receivedBytes;
+    struct timespec queuedAt;
+    struct timespec startedAt;  // Transfer start
+    struct timespec endedAt;
+} Job;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t finished;    // Signalled whenever a job ends
+    Job jobs[JOB_TABLE_SIZE];
+    int nextId;
+    int running;            // Runner threads alive
+    int maxRunning;
+    FILE *summary;          // When recording, one line per finished job (not bounded by the table)
+    char *summaryText;
+    size_t summaryLength;
+    int failed;
+} JobTable;
+
+void jobTableInit(JobTable *table, int maxRunning);
+// Queue a job; returns its id and sets *startRunner when the caller should start a runner thread for it.
+// When the table is full of unfinished jobs it waits for one to end if waitForRoom is set, else returns -1.
+int jobTableAdd(JobTable *table, const char *fileName, const char *mediaType, int factor, int waitForRoom,
+    int *startRunner);
+// Next queued job for a runner, marked JOB_REQUESTING; NULL (and the runner counted out) when none is left
+Job *jobTableNext(JobTable *table);
+void jobTableStartTransfer(JobTable *table, Job *job, const char *workerIp, int workerPort, uint64_t fileSize);
+void jobTableFinish(JobTable *table, Job *job, int succeeded);
+// Progress of every job, rendered and written to fd at once
+void jobTableRender(JobTable *table, int fd);
+// Block until no job is queued or running
+void jobTableWaitIdle(JobTable *table);
+// Record every job finished from now on for jobTableSummary()
+int jobTableRecord(JobTable *table);
+// Tab-separated line per recorded job (id, file, factor, result, latency from queueing in ms, bytes sent
+// and received) after a header, for scripts; returns the number of failed jobs
+int jobTableSummary(JobTable *table, int fd);
+
+#endif
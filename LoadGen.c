@@ -0,0 +1,526 @@
+/*
+@Author: Matéo Martin
+*/
+
+// End-to-end load generator (make bench). Registers stand-in Text and Media workers with a running
+// Gotham, then plays simulated Fleck sessions against it over loopback: connect, DISTORT, transfer
+// to the assigned worker and back, logout. The stand-ins echo every upload, so the numbers cover
+// routing and transfer rather than distortion.
+//
+// Usage: LoadGen <gothamIp> <fleckPort> <workerPort> [sessions [concurrency [payloadBytes [window]]]]
+// Prints one TSV row per phase (count, failures, throughput, latency percentiles in microseconds)
+// and exits with status 1 if any session failed.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "Protocol.h"
+#include "Transfer.h"
+#include "Md5.h"
+#include "Stats.h"
+
+typedef enum {
+    PHASE_CONNECT,      // TCP connect to Gotham and the acknowledged 0x01
+    PHASE_ROUTE,        // Distortion request (0x10) until the redirection arrives
+    PHASE_TRANSFER,     // Worker connection, upload, echoed result and the 0x11 report
+    PHASE_LOGOUT,       // 0x07 and close
+    PHASE_SESSION,      // All of the above
+    PHASE_COUNT
+} Phase;
+
+static const char *phaseNames[PHASE_COUNT] = {"connect", "route", "transfer", "logout", "session"};
+
+typedef struct {
+    const char *gothamIp;
+    int fleckPort;
+    int workerPort;
+    int sessions;
+    int concurrency;
+    size_t payloadBytes;
+    unsigned int window;
+} LoadSettings;
+
+// Stand-in worker: listens on an ephemeral loopback port and stays registered while the run lasts
+typedef struct {
+    const char *workerType;
+    int listenSock;
+    int gothamSock;
+    int port;
+} StandInWorker;
+
+// Result stream of one session, consumed while the upload is still running
+typedef struct {
+    TransferSession *session;
+    uint64_t received;
+    uint64_t expected;
+    Md5Context hash;
+    uint8_t expectedMd5[MD5_SIZE];
+    bool finished;
+} EchoDownload;
+
+static LoadSettings settings = {
+    .sessions = 1000,
+    .concurrency = 32,
+    .payloadBytes = 64 * 1024,
+    .window = TRANSFER_DEFAULT_WINDOW,
+};
+static Histogram latencyUs[PHASE_COUNT];
+static uint64_t failures[PHASE_COUNT];
+static uint64_t nextSession = 0;
+static uint8_t *payload;
+static uint8_t payloadMd5[MD5_SIZE];
+
+// Blocking TCP connection to ip:port, -1 on failure
+static int connectTo(const char *ip, int port) {
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &address.sin_addr) != 1) {
+        return -1;
+    }
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Send a frame with the socket's negotiated options
+static int sendPayload(int sock, uint8_t *buffer, uint8_t type, size_t length) {
+    size_t size = finishFrameWith(buffer, type, length, protocolGetOptions(sock));
+    return sendFrameBuffer(sock, buffer, size) < 0 ? -1 : 0;
+}
+
+// Worker side of a job: echo the upload back as the result, checking its MD5 like a real worker
+static int echoUpload(int sock, const JobRequest *request) {
+    TransferSession session;
+    if (transferSessionInit(&session, sock, request->window) < 0) {
+        return -1;
+    }
+
+    uint8_t *wire = malloc(transferBufferSize(session.options));
+    Md5Context uploadHash, resultHash;
+    uint8_t uploadMd5[MD5_SIZE], resultMd5[MD5_SIZE];
+    md5Init(&uploadHash);
+    md5Init(&resultHash);
+    session.sendHash = &resultHash;
+
+    int result = (wire != NULL) ? 0 : -1;
+    uint64_t received = 0;
+    while (result == 0 && received < request->fileSize) {
+        FrameView view;
+        if (transferReceive(&session, wire, &view) < 0 || view.type != 0x05) {
+            result = -1;
+            break;
+        }
+        md5Update(&uploadHash, view.data, view.dataLength);
+        received += view.dataLength;
+        result = transferConsumed(&session, received >= request->fileSize);
+        if (result == 0) {
+            result = transferSend(&session, view.data, view.dataLength);
+        }
+    }
+    md5Final(&uploadHash, uploadMd5);
+    md5Final(&resultHash, resultMd5);
+
+    if (result == 0 && (session.options & PROTO_CAP_MD5)) {
+        FrameView view;
+        uint8_t announced[MD5_SIZE];
+        uint64_t totalBytes;
+        if (transferReceive(&session, wire, &view) < 0 || view.type != 0x06 ||
+                parseTransferEnd(&view, &totalBytes, announced) < 0 || totalBytes != received ||
+                memcmp(announced, uploadMd5, MD5_SIZE) != 0) {
+            result = -1;
+        }
+    }
+    if (result == 0 && md5IsKnown(request->md5) && memcmp(request->md5, uploadMd5, MD5_SIZE) != 0) {
+        result = -1;
+    }
+    if (result == 0) {
+        result = transferSendEnd(&session, received, resultMd5);
+    }
+    if (result == 0) {
+        result = transferFlush(&session);
+    }
+
+    free(wire);
+    transferSessionDestroy(&session);
+    return result;
+}
+
+// One connection to a stand-in worker: the job request (TYPE: 0x03), its acknowledgment and the echo
+static void *serveStandInJob(void *arg) {
+    int sock = (int)(intptr_t)arg;
+    uint8_t buffer[FRAME_SIZE];
+    FrameView view;
+    JobRequest request;
+
+    if (receiveFrame(sock, buffer, sizeof(buffer), &view) == FRAME_OK && view.type == 0x03 &&
+            decodeJobRequest(view.data, view.dataLength, &request) == 0) {
+        unsigned int accepted = negotiateSocketCapabilities(sock, request.capabilities);
+        finishFrame(buffer, 0x03, formatPayload(buffer, "%u", accepted));
+        if (sendFrameBuffer(sock, buffer, FRAME_SIZE) == FRAME_SIZE) {
+            protocolSetOptions(sock, accepted);
+            echoUpload(sock, &request);
+        }
+    }
+
+    protocolSetOptions(sock, 0);
+    close(sock);
+    return NULL;
+}
+
+static void *acceptStandInJobs(void *arg) {
+    StandInWorker *worker = (StandInWorker *)arg;
+
+    while (1) {
+        int sock = accept(worker->listenSock, NULL, NULL);
+        if (sock < 0) {
+            perror("Stand-in worker accept failed");
+            continue;
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serveStandInJob, (void *)(intptr_t)sock) != 0) {
+            close(sock);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+// Listen on loopback and register with Gotham the way Enigma and Harley do (TYPE: 0x02)
+static int startStandIn(StandInWorker *worker, const char *workerType) {
+    struct sockaddr_in address = {0};
+    socklen_t length = sizeof(address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    worker->workerType = workerType;
+    worker->listenSock = socket(AF_INET, SOCK_STREAM, 0);
+    if (worker->listenSock < 0 || bind(worker->listenSock, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+            listen(worker->listenSock, SOMAXCONN) < 0 ||
+            getsockname(worker->listenSock, (struct sockaddr *)&address, &length) < 0) {
+        perror("Stand-in worker socket setup failed");
+        return -1;
+    }
+    worker->port = ntohs(address.sin_port);
+
+    worker->gothamSock = connectTo(settings.gothamIp, settings.workerPort);
+    if (worker->gothamSock < 0) {
+        perror("Stand-in worker could not reach Gotham");
+        return -1;
+    }
+
+    uint8_t buffer[FRAME_SIZE];
+    FrameView ack;
+    finishFrame(buffer, 0x02,
+        formatPayload(buffer, "%s&127.0.0.1&%d&%u", workerType, worker->port, PROTO_SUPPORTED_CAPS));
+    if (sendFrameBuffer(worker->gothamSock, buffer, FRAME_SIZE) < 0 ||
+            receiveFrame(worker->gothamSock, buffer, sizeof(buffer), &ack) != FRAME_OK || ack.type != 0x02) {
+        fprintf(stderr, "Gotham did not accept the %s stand-in worker\n", workerType);
+        return -1;
+    }
+    if (protocolSetOptions(worker->gothamSock, ack.dataLength == 0 ? 0 : parseCapabilities(&ack)) < 0) {
+        fprintf(stderr, "Cannot keep the options Gotham negotiated with the %s stand-in worker\n", workerType);
+        return -1;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, acceptStandInJobs, worker) != 0) {
+        perror("Failed to create stand-in worker thread");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+// Result frames of the echo, taken as they arrive so neither side stalls on a full window
+static int handleEchoFrame(void *context, const FrameView *view) {
+    EchoDownload *download = (EchoDownload *)context;
+
+    if (view->type == 0x05 && !download->finished) {
+        md5Update(&download->hash, view->data, view->dataLength);
+        download->received += view->dataLength;
+        return transferConsumed(download->session, 0);
+    }
+    if (view->type == 0x06 && !download->finished) {
+        if (parseTransferEnd(view, &download->expected, download->expectedMd5) < 0) {
+            return -1;
+        }
+        download->finished = true;
+        return transferFlushAcks(download->session);
+    }
+    return -1;
+}
+
+// Upload the payload and wait for its echo, which must come back byte for byte
+static int exchangePayload(int workerSock) {
+    TransferSession session;
+    if (transferSessionInit(&session, workerSock, settings.window) < 0) {
+        return -1;
+    }
+
+    EchoDownload download = { .session = &session };
+    md5Init(&download.hash);
+    session.onFrame = handleEchoFrame;
+    session.context = &download;
+
+    int result = transferSend(&session, payload, settings.payloadBytes);
+    if (result == 0 && (session.options & PROTO_CAP_MD5)) {
+        result = transferSendEnd(&session, settings.payloadBytes, payloadMd5);
+    }
+    if (result == 0) {
+        result = transferFlush(&session);
+    }
+    while (result == 0 && !download.finished) {
+        result = transferPump(&session);
+    }
+
+    uint8_t resultMd5[MD5_SIZE];
+    md5Final(&download.hash, resultMd5);
+    if (result == 0 && (download.received != settings.payloadBytes || download.expected != settings.payloadBytes ||
+            memcmp(resultMd5, payloadMd5, MD5_SIZE) != 0)) {
+        result = -1;
+    }
+
+    transferSessionDestroy(&session);
+    return result;
+}
+
+// Connect to Gotham as a Fleck user and negotiate capabilities (TYPE: 0x01)
+static int sessionConnect(const char *username) {
+    int sock = connectTo(settings.gothamIp, settings.fleckPort);
+    if (sock < 0) {
+        return -1;
+    }
+
+    uint8_t buffer[FRAME_SIZE];
+    FrameView ack;
+    finishFrame(buffer, 0x01, formatPayload(buffer, "%s&127.0.0.1&0&%u", username, PROTO_SUPPORTED_CAPS));
+    if (sendFrameBuffer(sock, buffer, FRAME_SIZE) < 0 ||
+            receiveFrame(sock, buffer, sizeof(buffer), &ack) != FRAME_OK || ack.type != 0x01 ||
+            frameViewEquals(&ack, "CON_KO")) {
+        close(sock);
+        return -1;
+    }
+    if (protocolSetOptions(sock, ack.dataLength == 0 ? 0 : parseCapabilities(&ack)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Ask Gotham for a worker (TYPE: 0x10); the generator only speaks the TLV form
+static int sessionRoute(int sock, const char *mediaType, const char *fileName, DistortRedirect *redirect) {
+    if (!(protocolGetOptions(sock) & PROTO_CAP_TLV)) {
+        return -1;
+    }
+
+    uint8_t buffer[FRAME_SIZE];
+    DistortRequest request = {0};
+    strncpy(request.mediaType, mediaType, sizeof(request.mediaType) - 1);
+    strncpy(request.fileName, fileName, sizeof(request.fileName) - 1);
+    if (sendPayload(sock, buffer, 0x10, encodeDistortRequest(&request, framePayload(buffer), FRAME_DATA_SIZE)) < 0) {
+        return -1;
+    }
+
+    FrameView view;
+    if (receiveFrame(sock, buffer, sizeof(buffer), &view) != FRAME_OK || view.type != 0x10 ||
+            decodeDistortRedirect(view.data, view.dataLength, redirect) < 0 || redirect->status != REDIRECT_OK) {
+        return -1;
+    }
+    return 0;
+}
+
+// Run the job on the assigned worker, then tell Gotham it is over (TYPE: 0x11)
+static int sessionTransfer(int gothamSock, const char *username, const char *fileName, const DistortRedirect *redirect) {
+    int workerSock = connectTo(redirect->ip, redirect->port);
+    if (workerSock < 0) {
+        return -1;
+    }
+
+    uint8_t buffer[FRAME_SIZE];
+    JobRequest request = {0};
+    strncpy(request.username, username, sizeof(request.username) - 1);
+    strncpy(request.fileName, fileName, sizeof(request.fileName) - 1);
+    request.fileSize = settings.payloadBytes;
+    memcpy(request.md5, payloadMd5, MD5_SIZE);
+    request.factor = 1;
+    request.capabilities = PROTO_SUPPORTED_CAPS;
+    request.window = settings.window;
+    finishFrame(buffer, 0x03, encodeJobRequest(&request, framePayload(buffer), FRAME_DATA_SIZE));
+
+    int result = -1;
+    FrameView ack;
+    if (sendFrameBuffer(workerSock, buffer, FRAME_SIZE) == FRAME_SIZE &&
+            receiveFrame(workerSock, buffer, sizeof(buffer), &ack) == FRAME_OK && ack.type == 0x03 &&
+            !frameViewEquals(&ack, "BUSY") &&
+            protocolSetOptions(workerSock, ack.dataLength == 0 ? 0 : parseCapabilities(&ack)) == 0) {
+        result = exchangePayload(workerSock);
+    }
+    protocolSetOptions(workerSock, 0);
+    close(workerSock);
+
+    JobFinished finished = {0};
+    strcpy(finished.ip, redirect->ip);
+    finished.port = redirect->port;
+    if (sendPayload(gothamSock, buffer, 0x11, encodeJobFinished(&finished, framePayload(buffer), FRAME_DATA_SIZE)) < 0) {
+        result = -1;
+    }
+    return result;
+}
+
+static int sessionLogout(int sock, const char *username) {
+    uint8_t buffer[FRAME_SIZE];
+    int result = sendPayload(sock, buffer, 0x07, formatPayload(buffer, "%s", username));
+    protocolSetOptions(sock, 0);
+    close(sock);
+    return result;
+}
+
+// Time one phase; a failed phase is counted and ends the session
+static bool timePhase(Phase phase, struct timespec *start, int result) {
+    if (result < 0) {
+        statsAdd(&failures[phase], 1);
+        statsAdd(&failures[PHASE_SESSION], 1);
+        return false;
+    }
+    histogramRecord(&latencyUs[phase], statsElapsedUs(start));
+    clock_gettime(CLOCK_MONOTONIC, start);
+    return true;
+}
+
+// Sessions alternate between text and media jobs so both stand-ins are exercised
+static void runSession(int index) {
+    char username[32], fileName[32];
+    const char *mediaType = (index % 2 == 0) ? "Text" : "Media";
+    snprintf(username, sizeof(username), "load%d", index);
+    snprintf(fileName, sizeof(fileName), (index % 2 == 0) ? "load%d.txt" : "load%d.wav", index);
+
+    struct timespec sessionStart, start;
+    clock_gettime(CLOCK_MONOTONIC, &sessionStart);
+    start = sessionStart;
+
+    int sock = sessionConnect(username);
+    if (!timePhase(PHASE_CONNECT, &start, sock)) {
+        return;
+    }
+
+    DistortRedirect redirect;
+    if (!timePhase(PHASE_ROUTE, &start, sessionRoute(sock, mediaType, fileName, &redirect)) ||
+            !timePhase(PHASE_TRANSFER, &start, sessionTransfer(sock, username, fileName, &redirect))) {
+        sessionLogout(sock, username);
+        return;
+    }
+
+    if (timePhase(PHASE_LOGOUT, &start, sessionLogout(sock, username))) {
+        histogramRecord(&latencyUs[PHASE_SESSION], statsElapsedUs(&sessionStart));
+    }
+}
+
+static void *runSessions(void *arg) {
+    (void)arg;
+    uint64_t index;
+    while ((index = __atomic_fetch_add(&nextSession, 1, __ATOMIC_RELAXED)) < (uint64_t)settings.sessions) {
+        runSession((int)index);
+    }
+    return NULL;
+}
+
+static void printReport(double elapsedSeconds) {
+    printf("phase\tcount\tfailed\tper_sec\tp50_us\tp99_us\tp999_us\tmax_us\n");
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        uint64_t count = statsLoad(&latencyUs[phase].count);
+        printf("%s\t%llu\t%llu\t%.1f\t%llu\t%llu\t%llu\t%llu\n", phaseNames[phase],
+               (unsigned long long)count, (unsigned long long)statsLoad(&failures[phase]), count / elapsedSeconds,
+               (unsigned long long)histogramPercentile(&latencyUs[phase], 50),
+               (unsigned long long)histogramPercentile(&latencyUs[phase], 99),
+               (unsigned long long)histogramPercentile(&latencyUs[phase], 99.9),
+               (unsigned long long)statsLoad(&latencyUs[phase].max));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4 || argc > 8) {
+        fprintf(stderr, "Usage: %s <gothamIp> <fleckPort> <workerPort> [sessions [concurrency [payloadBytes [window]]]]\n",
+                argv[0]);
+        return -1;
+    }
+    settings.gothamIp = argv[1];
+    settings.fleckPort = atoi(argv[2]);
+    settings.workerPort = atoi(argv[3]);
+    if (argc > 4) settings.sessions = atoi(argv[4]);
+    if (argc > 5) settings.concurrency = atoi(argv[5]);
+    if (argc > 6) settings.payloadBytes = strtoul(argv[6], NULL, 10);
+    if (argc > 7) settings.window = atoi(argv[7]);
+    if (settings.sessions <= 0 || settings.concurrency <= 0) {
+        fprintf(stderr, "Sessions and concurrency must be positive\n");
+        return -1;
+    }
+
+    // A peer closing early must fail a session, not end the run
+    signal(SIGPIPE, SIG_IGN);
+
+    payload = malloc(settings.payloadBytes > 0 ? settings.payloadBytes : 1);
+    if (payload == NULL) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    srand(42);
+    for (size_t i = 0; i < settings.payloadBytes; i++) {
+        payload[i] = rand() & 0xFF;
+    }
+    Md5Context hash;
+    md5Init(&hash);
+    md5Update(&hash, payload, settings.payloadBytes);
+    md5Final(&hash, payloadMd5);
+
+    StandInWorker textWorker, mediaWorker;
+    if (startStandIn(&textWorker, "Text") < 0 || startStandIn(&mediaWorker, "Media") < 0) {
+        return -2;
+    }
+    fprintf(stderr, "Stand-in workers on ports %d (Text) and %d (Media); %d sessions, %d at once, %zu-byte payload\n",
+            textWorker.port, mediaWorker.port, settings.sessions, settings.concurrency, settings.payloadBytes);
+
+    pthread_t *threads = calloc(settings.concurrency, sizeof(pthread_t));
+    if (threads == NULL) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int started = 0;
+    for (int i = 0; i < settings.concurrency; i++) {
+        if (pthread_create(&threads[i], NULL, runSessions, NULL) != 0) {
+            perror("Failed to create session thread");
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsedSeconds = statsElapsedUs(&start) / 1e6;
+
+    printReport(elapsedSeconds);
+    free(threads);
+    free(payload);
+    return statsLoad(&failures[PHASE_SESSION]) > 0 ? 1 : 0;
+}
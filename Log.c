@@ -0,0 +1,510 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include "Log.h"
+
+#define LOG_RING_SIZE 256           // Records per thread, power of two
+#define LOG_RECORD_SIZE 256
+#define LOG_RECORD_DATA (LOG_RECORD_SIZE - 24)
+#define LOG_OUTPUT_SIZE (64 * 1024) // Rendered text written per write()
+#define LOG_RECORD_TEXT 2048        // Longest rendering of one record
+#define LOG_IDLE_WAIT_NS 100000000  // Writer wakes up at least every 100 ms
+
+// One log call: the format it was made with and its arguments, packed in format order
+// (integers and doubles as 8 bytes, strings as a 2-byte length and their bytes)
+typedef struct {
+    uint64_t timestamp;     // CLOCK_MONOTONIC nanoseconds, to merge the rings in order
+    const char *format;
+    uint16_t length;        // Data bytes used
+    uint8_t level;
+    uint8_t truncated;      // Arguments that did not fit were dropped
+    uint8_t data[LOG_RECORD_DATA];
+} LogSlot;
+
+// Ring owned by one producer thread and drained by whoever holds drainMutex
+typedef struct LogRing {
+    LogSlot slots[LOG_RING_SIZE];
+    _Alignas(64) uint32_t tail;     // Next slot the producer fills
+    _Alignas(64) uint32_t head;     // Next slot the consumer renders
+    int orphaned;                   // The owning thread exited; freed once drained
+    struct LogRing *next;
+} LogRing;
+
+static LogRing *rings;              // Pushed lock-free by new threads, unlinked only by the consumer
+static __thread LogRing *threadRing;
+static pthread_key_t ringKey;
+static pthread_once_t startOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t drainMutex = PTHREAD_MUTEX_INITIALIZER;
+static sem_t wake;
+static int writerSleeping;
+static uint64_t recordsWritten;
+static uint64_t producerStalls;
+
+static char output[LOG_OUTPUT_SIZE];
+static size_t outputLength;
+
+static uint64_t nowNanoseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now); // vDSO, no syscall
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Conversion specification as both the producer and the renderer walk it
+typedef struct {
+    char flags[8];
+    int width;              // -1 when absent, -2 when given as '*'
+    int precision;          // Same
+    char size;              // 'H' hh, 'h', 'l', 'L' ll, 'z', 'j', 't', or 0
+    char conversion;
+} LogSpec;
+
+// Parse the specification after a '%'; returns the character following it
+static const char *parseSpec(const char *format, LogSpec *spec) {
+    size_t flags = 0;
+    memset(spec, 0, sizeof(*spec));
+    while (*format != '\0' && strchr("-+ #0", *format) != NULL) {
+        if (flags < sizeof(spec->flags) - 1) {
+            spec->flags[flags++] = *format;
+        }
+        format++;
+    }
+
+    spec->width = -1;
+    if (*format == '*') {
+        spec->width = -2;
+        format++;
+    } else if (*format >= '0' && *format <= '9') {
+        spec->width = 0;
+        while (*format >= '0' && *format <= '9') {
+            spec->width = spec->width * 10 + (*format++ - '0');
+        }
+    }
+
+    spec->precision = -1;
+    if (*format == '.') {
+        format++;
+        spec->precision = 0;
+        if (*format == '*') {
+            spec->precision = -2;
+            format++;
+        }
+        while (*format >= '0' && *format <= '9') {
+            spec->precision = spec->precision * 10 + (*format++ - '0');
+        }
+    }
+
+    if (format[0] == 'h' && format[1] == 'h') {
+        spec->size = 'H';
+        format += 2;
+    } else if (format[0] == 'l' && format[1] == 'l') {
+        spec->size = 'L';
+        format += 2;
+    } else if (*format != '\0' && strchr("hlzjt", *format) != NULL) {
+        spec->size = *format++;
+    }
+    spec->conversion = *format;
+    return (*format != '\0') ? format + 1 : format;
+}
+
+static int putValue(LogSlot *slot, uint64_t value) {
+    if (slot->length + sizeof(value) > LOG_RECORD_DATA) {
+        slot->truncated = 1;
+        return -1;
+    }
+    memcpy(slot->data + slot->length, &value, sizeof(value));
+    slot->length += sizeof(value);
+    return 0;
+}
+
+static int putString(LogSlot *slot, const char *value, int precision) {
+    if (value == NULL) {
+        value = "(null)";
+    }
+    if (slot->length + sizeof(uint16_t) > LOG_RECORD_DATA) {
+        slot->truncated = 1;
+        return -1;
+    }
+    size_t room = LOG_RECORD_DATA - slot->length - sizeof(uint16_t);
+    size_t length = strnlen(value, (precision >= 0 && (size_t)precision < room) ? (size_t)precision : room);
+    uint16_t stored = length;
+    memcpy(slot->data + slot->length, &stored, sizeof(stored));
+    memcpy(slot->data + slot->length + sizeof(stored), value, length);
+    slot->length += sizeof(stored) + length;
+    return 0;
+}
+
+static uint64_t readSigned(va_list *args, char size) {
+    switch (size) {
+        case 'H': return (int64_t)(signed char)va_arg(*args, int);
+        case 'h': return (int64_t)(short)va_arg(*args, int);
+        case 'l': return (int64_t)va_arg(*args, long);
+        case 'L': return (int64_t)va_arg(*args, long long);
+        case 'z': return (int64_t)va_arg(*args, ssize_t);
+        case 'j': return (int64_t)va_arg(*args, intmax_t);
+        case 't': return (int64_t)va_arg(*args, ptrdiff_t);
+        default: return (int64_t)va_arg(*args, int);
+    }
+}
+
+static uint64_t readUnsigned(va_list *args, char size) {
+    switch (size) {
+        case 'H': return (unsigned char)va_arg(*args, unsigned int);
+        case 'h': return (unsigned short)va_arg(*args, unsigned int);
+        case 'l': return va_arg(*args, unsigned long);
+        case 'L': return va_arg(*args, unsigned long long);
+        case 'z': return va_arg(*args, size_t);
+        case 'j': return va_arg(*args, uintmax_t);
+        case 't': return (uint64_t)va_arg(*args, ptrdiff_t);
+        default: return va_arg(*args, unsigned int);
+    }
+}
+
+// Pack the arguments of format into the slot; nothing is formatted here
+static void captureArguments(LogSlot *slot, const char *format, va_list *args) {
+    while ((format = strchr(format, '%')) != NULL) {
+        LogSpec spec;
+        format = parseSpec(format + 1, &spec);
+        if (spec.conversion == '%' || spec.conversion == '\0') {
+            continue;
+        }
+
+        int precision = spec.precision;
+        if (spec.width == -2 && putValue(slot, (int64_t)va_arg(*args, int)) < 0) {
+            return;
+        }
+        if (spec.precision == -2) {
+            precision = va_arg(*args, int);
+            if (putValue(slot, (int64_t)precision) < 0) {
+                return;
+            }
+        }
+
+        int result;
+        switch (spec.conversion) {
+            case 'd': case 'i':
+                result = putValue(slot, readSigned(args, spec.size));
+                break;
+            case 'u': case 'x': case 'X': case 'o':
+                result = putValue(slot, readUnsigned(args, spec.size));
+                break;
+            case 'c':
+                result = putValue(slot, (uint64_t)va_arg(*args, int));
+                break;
+            case 'p':
+                result = putValue(slot, (uintptr_t)va_arg(*args, void *));
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+                double value = va_arg(*args, double);
+                uint64_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                result = putValue(slot, bits);
+                break;
+            }
+            case 's':
+                result = putString(slot, va_arg(*args, const char *), precision);
+                break;
+            default:
+                slot->truncated = 1; // Unsupported conversion: the rest cannot be read safely
+                return;
+        }
+        if (result < 0) {
+            return;
+        }
+    }
+}
+
+static void freeOrphanedRings(void);
+static void *writerMain(void *arg);
+
+static void orphanRing(void *ring) {
+    __atomic_store_n(&((LogRing *)ring)->orphaned, 1, __ATOMIC_RELEASE);
+}
+
+static void startWriter(void) {
+    pthread_t writer;
+    sem_init(&wake, 0, 0);
+    pthread_key_create(&ringKey, orphanRing);
+    if (pthread_create(&writer, NULL, writerMain, NULL) == 0) {
+        pthread_detach(writer);
+    }
+    atexit(logFlush);
+}
+
+static LogRing *threadLogRing(void) {
+    if (threadRing == NULL) {
+        pthread_once(&startOnce, startWriter);
+        LogRing *ring = calloc(1, sizeof(LogRing));
+        if (ring == NULL) {
+            return NULL;
+        }
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+        pthread_setspecific(ringKey, ring);
+        threadRing = ring;
+    }
+    return threadRing;
+}
+
+static void wakeWriter(void) {
+    if (__atomic_exchange_n(&writerSleeping, 0, __ATOMIC_SEQ_CST)) {
+        sem_post(&wake);
+    }
+}
+
+void logRecord(int level, const char *format, ...) {
+    LogRing *ring = threadLogRing();
+    if (ring == NULL) {
+        return;
+    }
+
+    // A full ring waits for the writer rather than lose the record
+    uint32_t tail = ring->tail;
+    while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == LOG_RING_SIZE) {
+        __atomic_fetch_add(&producerStalls, 1, __ATOMIC_RELAXED);
+        wakeWriter();
+        sched_yield();
+    }
+
+    LogSlot *slot = &ring->slots[tail & (LOG_RING_SIZE - 1)];
+    slot->timestamp = nowNanoseconds();
+    slot->format = format;
+    slot->level = level;
+    slot->length = 0;
+    slot->truncated = 0;
+    va_list args;
+    va_start(args, format);
+    captureArguments(slot, format, &args);
+    va_end(args);
+
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+    wakeWriter();
+}
+
+static void writeOutput(void) {
+    size_t written = 0;
+    while (written < outputLength) {
+        ssize_t count = write(STDOUT_FILENO, output + written, outputLength - written);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+        written += count;
+    }
+    outputLength = 0;
+}
+
+static int takeValue(const LogSlot *slot, size_t *offset, uint64_t *value) {
+    if (*offset + sizeof(*value) > slot->length) {
+        return -1;
+    }
+    memcpy(value, slot->data + *offset, sizeof(*value));
+    *offset += sizeof(*value);
+    return 0;
+}
+
+static void appendText(char **cursor, char *end, const char *text, size_t length) {
+    if (length > (size_t)(end - *cursor)) {
+        length = end - *cursor;
+    }
+    memcpy(*cursor, text, length);
+    *cursor += length;
+}
+
+// Append the formatted record: the format is walked again, each specification printed on its own
+static void renderSlot(const LogSlot *slot) {
+    if (LOG_OUTPUT_SIZE - outputLength < LOG_RECORD_TEXT) {
+        writeOutput();
+    }
+    char *cursor = output + outputLength;
+    char *end = cursor + LOG_RECORD_TEXT - 1;
+    const char *format = slot->format;
+    size_t offset = 0;
+    int complete = 1;
+
+    while (*format != '\0' && cursor < end) {
+        const char *percent = strchr(format, '%');
+        if (percent == NULL) {
+            appendText(&cursor, end, format, strlen(format));
+            break;
+        }
+        appendText(&cursor, end, format, percent - format);
+
+        LogSpec spec;
+        format = parseSpec(percent + 1, &spec);
+        if (spec.conversion == '%') {
+            appendText(&cursor, end, "%", 1);
+            continue;
+        }
+
+        uint64_t width = 0, precision = 0, value = 0;
+        if ((spec.width == -2 && takeValue(slot, &offset, &width) < 0) ||
+                (spec.precision == -2 && takeValue(slot, &offset, &precision) < 0) ||
+                (spec.conversion != 's' && takeValue(slot, &offset, &value) < 0) ||
+                (spec.conversion == 's' && offset + sizeof(uint16_t) > slot->length)) {
+            complete = 0;
+            break;
+        }
+
+        // Rebuild the specification with explicit widths and 64-bit arguments
+        char conversion[32];
+        int length = snprintf(conversion, sizeof(conversion), "%%%s", spec.flags);
+        if (spec.width != -1) {
+            length += snprintf(conversion + length, sizeof(conversion) - length, "%d",
+                spec.width == -2 ? (int)(int64_t)width : spec.width);
+        }
+        if (spec.precision != -1 && spec.conversion != 's') {
+            length += snprintf(conversion + length, sizeof(conversion) - length, ".%d",
+                spec.precision == -2 ? (int)(int64_t)precision : spec.precision);
+        }
+
+        size_t room = end - cursor + 1;
+        int printed;
+        switch (spec.conversion) {
+            case 'd': case 'i':
+                snprintf(conversion + length, sizeof(conversion) - length, "lld");
+                printed = snprintf(cursor, room, conversion, (long long)(int64_t)value);
+                break;
+            case 'u': case 'x': case 'X': case 'o':
+                snprintf(conversion + length, sizeof(conversion) - length, "ll%c", spec.conversion);
+                printed = snprintf(cursor, room, conversion, (unsigned long long)value);
+                break;
+            case 'c':
+                snprintf(conversion + length, sizeof(conversion) - length, "c");
+                printed = snprintf(cursor, room, conversion, (int)value);
+                break;
+            case 'p':
+                snprintf(conversion + length, sizeof(conversion) - length, "p");
+                printed = snprintf(cursor, room, conversion, (void *)(uintptr_t)value);
+                break;
+            case 's': {
+                uint16_t stored;
+                memcpy(&stored, slot->data + offset, sizeof(stored));
+                offset += sizeof(stored);
+                snprintf(conversion + length, sizeof(conversion) - length, ".*s");
+                printed = snprintf(cursor, room, conversion, (int)stored, (const char *)slot->data + offset);
+                offset += stored;
+                break;
+            }
+            default: {
+                double number;
+                memcpy(&number, &value, sizeof(number));
+                snprintf(conversion + length, sizeof(conversion) - length, "%c", spec.conversion);
+                printed = snprintf(cursor, room, conversion, number);
+                break;
+            }
+        }
+        cursor += (printed < 0) ? 0 : ((size_t)printed < room ? (size_t)printed : room - 1);
+    }
+
+    if (!complete || slot->truncated) {
+        // Mark records whose arguments did not fit, keeping the line structure
+        appendText(&cursor, end + 1, "...\n", 4);
+    }
+    outputLength = cursor - output;
+}
+
+// Render every published record, oldest first across the rings; caller holds drainMutex
+static size_t drainRings(void) {
+    size_t rendered = 0;
+    while (1) {
+        LogRing *oldest = NULL;
+        const LogSlot *oldestSlot = NULL;
+        for (LogRing *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+            if (ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+                continue;
+            }
+            const LogSlot *slot = &ring->slots[ring->head & (LOG_RING_SIZE - 1)];
+            if (oldest == NULL || slot->timestamp < oldestSlot->timestamp) {
+                oldest = ring;
+                oldestSlot = slot;
+            }
+        }
+        if (oldest == NULL) {
+            break;
+        }
+        renderSlot(oldestSlot);
+        __atomic_store_n(&oldest->head, oldest->head + 1, __ATOMIC_RELEASE);
+        rendered++;
+    }
+    writeOutput();
+    __atomic_fetch_add(&recordsWritten, rendered, __ATOMIC_RELAXED);
+    freeOrphanedRings();
+    return rendered;
+}
+
+// Free drained rings of exited threads; the list head is left alone since producers push there
+static void freeOrphanedRings(void) {
+    LogRing *previous = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    if (previous == NULL) {
+        return;
+    }
+    for (LogRing *ring = previous->next; ring != NULL; ring = previous->next) {
+        if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE) &&
+                ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+            previous->next = ring->next;
+            free(ring);
+        } else {
+            previous = ring;
+        }
+    }
+}
+
+static int anyPending(void) {
+    for (LogRing *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        if (ring->head != __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *writerMain(void *arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&drainMutex);
+        size_t rendered = drainRings();
+        pthread_mutex_unlock(&drainMutex);
+        if (rendered > 0) {
+            continue;
+        }
+
+        // Announce the nap before the last look, so a producer publishing now posts the semaphore
+        __atomic_store_n(&writerSleeping, 1, __ATOMIC_SEQ_CST);
+        if (!anyPending()) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_IDLE_WAIT_NS;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            sem_timedwait(&wake, &deadline);
+        }
+        __atomic_store_n(&writerSleeping, 0, __ATOMIC_SEQ_CST);
+    }
+    return NULL;
+}
+
+void logFlush(void) {
+    pthread_mutex_lock(&drainMutex);
+    drainRings();
+    pthread_mutex_unlock(&drainMutex);
+}
+
+void logGetCounters(LogCounters *counters) {
+    counters->records = __atomic_load_n(&recordsWritten, __ATOMIC_RELAXED);
+    counters->stalls = __atomic_load_n(&producerStalls, __ATOMIC_RELAXED);
+}
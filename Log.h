@@ -0,0 +1,45 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+// Asynchronous logging shared by all binaries. A log call captures its arguments into a binary
+// record in the calling thread's own ring buffer (single producer, single consumer, no locks,
+// no allocation, no syscall); a background thread merges the rings in time order, renders the
+// records with their format and writes them to stdout in batches.
+//
+// The format must be a string literal: records keep a pointer to it and are rendered later.
+// Supported conversions: d i u x X o c s p f e g and %%, with flags, width, precision (also *)
+// and the hh h l ll z j t length modifiers. Strings are copied, truncated to fit a record.
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+// Calls below LOG_LEVEL compile to nothing; build with -DLOG_LEVEL=LOG_LEVEL_DEBUG to keep them
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_AT(level, format, ...) \
+    do { \
+        if ((level) >= LOG_LEVEL) { \
+            logRecord((level), "" format, ##__VA_ARGS__); \
+        } \
+    } while (0)
+#define LOG_DEBUG(format, ...) LOG_AT(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_AT(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_AT(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_AT(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+
+typedef struct {
+    uint64_t records;       // Records written out
+    uint64_t stalls;        // Times a producer found its ring full and waited for the writer
+} LogCounters;
+
+void logRecord(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+// Write out everything logged so far (called at exit as well)
+void logFlush(void);
+void logGetCounters(LogCounters *counters);
+
+#endif
@@ -0,0 +1,418 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Checksum.h"
+#include "Md5.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MD5_X86 1
+#include <immintrin.h>
+#endif
+
+// RFC 1321 sine table and per-step rotations
+static const uint32_t md5Constants[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+static const uint8_t md5Shifts[4][4] = {{7, 12, 17, 22}, {5, 9, 14, 20}, {4, 11, 16, 23}, {6, 10, 15, 21}};
+// Message word used by each step
+static const uint8_t md5Words[64] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    1, 6, 11, 0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12,
+    5, 8, 11, 14, 1, 4, 7, 10, 13, 0, 3, 6, 9, 12, 15, 2,
+    0, 7, 14, 5, 12, 3, 10, 1, 8, 15, 6, 13, 4, 11, 2, 9,
+};
+
+static uint32_t readLe32(const uint8_t *bytes) {
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+#define MD5_ROTATE(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define MD5_STEP(f, i) do { \
+        uint32_t t = a + (f) + md5Constants[i] + words[md5Words[i]]; \
+        a = d; \
+        d = c; \
+        c = b; \
+        b += MD5_ROTATE(t, md5Shifts[(i) / 16][(i) % 4]); \
+    } while (0)
+
+static void md5Block(uint32_t state[4], const uint8_t block[64]) {
+    uint32_t words[16];
+    for (int i = 0; i < 16; i++) {
+        words[i] = readLe32(block + 4 * i);
+    }
+
+    // One loop per round so each keeps a fixed mixing function, unrolled into constant shifts
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+#pragma GCC unroll 16
+    for (int i = 0; i < 16; i++) {
+        MD5_STEP(d ^ (b & (c ^ d)), i);
+    }
+#pragma GCC unroll 16
+    for (int i = 16; i < 32; i++) {
+        MD5_STEP(c ^ (d & (b ^ c)), i);
+    }
+#pragma GCC unroll 16
+    for (int i = 32; i < 48; i++) {
+        MD5_STEP(b ^ c ^ d, i);
+    }
+#pragma GCC unroll 16
+    for (int i = 48; i < 64; i++) {
+        MD5_STEP(c ^ (b | ~d), i);
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+void md5Init(Md5Context *context) {
+    context->state[0] = 0x67452301;
+    context->state[1] = 0xefcdab89;
+    context->state[2] = 0x98badcfe;
+    context->state[3] = 0x10325476;
+    context->length = 0;
+}
+
+void md5Update(Md5Context *context, const uint8_t *data, size_t length) {
+    size_t used = context->length % 64;
+    context->length += length;
+
+    if (used > 0) {
+        size_t take = (length < 64 - used) ? length : 64 - used;
+        memcpy(context->block + used, data, take);
+        data += take;
+        length -= take;
+        if (used + take < 64) {
+            return;
+        }
+        md5Block(context->state, context->block);
+    }
+    for (; length >= 64; data += 64, length -= 64) {
+        md5Block(context->state, data);
+    }
+    memcpy(context->block, data, length);
+}
+
+void md5Final(Md5Context *context, uint8_t digest[MD5_SIZE]) {
+    uint64_t bits = context->length * 8;
+    uint8_t padding[72] = {0x80};
+    size_t used = context->length % 64;
+    size_t padLength = (used < 56) ? 56 - used : 120 - used;
+
+    for (int i = 0; i < 8; i++) {
+        padding[padLength + i] = (bits >> (8 * i)) & 0xFF;
+    }
+    md5Update(context, padding, padLength + 8);
+
+    for (int i = 0; i < 4; i++) {
+        for (int k = 0; k < 4; k++) {
+            digest[4 * i + k] = (context->state[i] >> (8 * k)) & 0xFF;
+        }
+    }
+}
+
+void md5ToHex(const uint8_t digest[MD5_SIZE], char hex[MD5_HEX_SIZE]) {
+    for (int i = 0; i < MD5_SIZE; i++) {
+        sprintf(hex + 2 * i, "%02x", digest[i]);
+    }
+}
+
+int md5FromHex(const char *hex, uint8_t digest[MD5_SIZE]) {
+    for (int i = 0; i < MD5_SIZE; i++) {
+        unsigned int byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+            memset(digest, 0, MD5_SIZE);
+            return -1;
+        }
+        digest[i] = byte;
+    }
+    return 0;
+}
+
+int md5IsKnown(const uint8_t digest[MD5_SIZE]) {
+    for (int i = 0; i < MD5_SIZE; i++) {
+        if (digest[i] != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void md5HashBuffersScalar(const uint8_t *const data[], const size_t lengths[], int count, uint8_t digests[][MD5_SIZE]) {
+    for (int i = 0; i < count; i++) {
+        Md5Context context;
+        md5Init(&context);
+        md5Update(&context, data[i], lengths[i]);
+        md5Final(&context, digests[i]);
+    }
+}
+
+#ifdef MD5_X86
+// A batch spread over SIMD lanes: each lane hashes one message to its last padded block, then takes
+// the next one, so every lane stays busy until the batch runs out instead of stopping at the shortest
+typedef struct {
+    const uint8_t *const *data;
+    const size_t *lengths;
+    uint8_t (*digests)[MD5_SIZE];
+    int *order;             // Longest message first, so the short ones fill lanes while long ones run
+    int count;
+    int next;               // Position in order of the next message to start
+} Md5Batch;
+
+typedef struct {
+    int message;            // Index in the batch, -1 for a lane with nothing left to hash
+    const uint8_t *data;    // Next whole block, read in place
+    size_t wholeBlocks;     // Whole blocks left before the tail
+    int tailBlock;
+    int tailBlocks;         // 1 or 2: the last bytes, 0x80, zeros and the bit length
+    uint8_t tail[128];
+} Md5Lane;
+
+static const uint32_t md5InitialState[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+
+static int md5BatchInit(Md5Batch *batch, const uint8_t *const data[], const size_t lengths[], int count,
+                        uint8_t digests[][MD5_SIZE]) {
+    batch->data = data;
+    batch->lengths = lengths;
+    batch->digests = digests;
+    batch->count = count;
+    batch->next = 0;
+    batch->order = malloc(count * sizeof(int));
+    if (batch->order == NULL) {
+        return -1;
+    }
+    // Insertion sort: batches are a few files (a DISTORT pattern's group)
+    for (int i = 0; i < count; i++) {
+        int j = i;
+        for (; j > 0 && lengths[batch->order[j - 1]] < lengths[i]; j--) {
+            batch->order[j] = batch->order[j - 1];
+        }
+        batch->order[j] = i;
+    }
+    return 0;
+}
+
+// Start the batch's next message in a lane, from the initial state, or leave the lane idle
+static void md5LaneStart(Md5Batch *batch, Md5Lane *lane, uint32_t *laneStates, int lanes, int index) {
+    for (int i = 0; i < 4; i++) {
+        laneStates[i * lanes + index] = md5InitialState[i];
+    }
+    if (batch->next == batch->count) {
+        lane->message = -1;
+        return;
+    }
+    int message = batch->order[batch->next++];
+    size_t length = batch->lengths[message];
+    size_t rest = length % 64;
+    uint64_t bits = (uint64_t)length * 8;
+
+    lane->message = message;
+    lane->data = batch->data[message];
+    lane->wholeBlocks = length / 64;
+    lane->tailBlock = 0;
+    lane->tailBlocks = (rest < 56) ? 1 : 2;
+    memset(lane->tail, 0, sizeof(lane->tail));
+    if (rest > 0) {
+        memcpy(lane->tail, lane->data + length - rest, rest);
+    }
+    lane->tail[rest] = 0x80;
+    for (int i = 0; i < 8; i++) {
+        lane->tail[64 * lane->tailBlocks - 8 + i] = (bits >> (8 * i)) & 0xFF;
+    }
+}
+
+// Block the lane hashes next; idle lanes hash zeros that nobody reads
+static const uint8_t *md5LaneBlock(Md5Lane *lane) {
+    static const uint8_t idle[64];
+    if (lane->message < 0) {
+        return idle;
+    }
+    if (lane->wholeBlocks > 0) {
+        const uint8_t *block = lane->data;
+        lane->data += 64;
+        lane->wholeBlocks--;
+        return block;
+    }
+    return lane->tail + 64 * lane->tailBlock++;
+}
+
+static int md5LaneEnded(const Md5Lane *lane) {
+    return lane->message >= 0 && lane->wholeBlocks == 0 && lane->tailBlock == lane->tailBlocks;
+}
+
+static int md5LanesEnded(const Md5Lane *lanes, int laneCount) {
+    for (int index = 0; index < laneCount; index++) {
+        if (md5LaneEnded(&lanes[index])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Write the digest of every message that just ended and start the next one in its lane
+static void md5LanesAdvance(Md5Batch *batch, Md5Lane *lanes, uint32_t *laneStates, int laneCount) {
+    for (int index = 0; index < laneCount; index++) {
+        Md5Lane *lane = &lanes[index];
+        if (!md5LaneEnded(lane)) {
+            continue;
+        }
+        for (int i = 0; i < 4; i++) {
+            for (int k = 0; k < 4; k++) {
+                batch->digests[lane->message][4 * i + k] = (laneStates[i * laneCount + index] >> (8 * k)) & 0xFF;
+            }
+        }
+        md5LaneStart(batch, lane, laneStates, laneCount, index);
+    }
+}
+
+static int md5LanesBusy(const Md5Lane *lanes, int laneCount) {
+    for (int index = 0; index < laneCount; index++) {
+        if (lanes[index].message >= 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// One 32-bit lane per message; the step loops are unrolled so rotate counts are constants
+#define MD5_SIMD_STEP(VEC, ADD, OR, SLL, SRL, SET1, f, i) do { \
+        VEC t = ADD(ADD((f), a), ADD(SET1(md5Constants[i]), words[md5Words[i]])); \
+        int shift = md5Shifts[(i) / 16][(i) % 4]; \
+        a = d; \
+        d = c; \
+        c = b; \
+        b = ADD(b, OR(SLL(t, _mm_cvtsi32_si128(shift)), SRL(t, _mm_cvtsi32_si128(32 - shift)))); \
+    } while (0)
+
+#define MD5_SIMD_BODY(VEC, LANES, ADD, AND, OR, XOR, SLL, SRL, SET1, LOAD, STORE) \
+    Md5Lane lanes[LANES]; \
+    uint32_t laneStates[4 * LANES]; \
+    for (int lane = 0; lane < LANES; lane++) { \
+        md5LaneStart(batch, &lanes[lane], laneStates, LANES, lane); \
+    } \
+    VEC state[4]; \
+    for (int i = 0; i < 4; i++) { \
+        state[i] = LOAD(laneStates + i * LANES); \
+    } \
+    VEC ones = SET1(-1); \
+    while (md5LanesBusy(lanes, LANES)) { \
+        const uint8_t *blocks[LANES]; \
+        for (int lane = 0; lane < LANES; lane++) { \
+            blocks[lane] = md5LaneBlock(&lanes[lane]); \
+        } \
+        VEC words[16]; \
+        for (int w = 0; w < 16; w++) { \
+            uint32_t laneWords[LANES]; \
+            for (int lane = 0; lane < LANES; lane++) { \
+                laneWords[lane] = readLe32(blocks[lane] + 4 * w); \
+            } \
+            words[w] = LOAD(laneWords); \
+        } \
+        VEC a = state[0], b = state[1], c = state[2], d = state[3]; \
+        _Pragma("GCC unroll 16") \
+        for (int i = 0; i < 16; i++) { \
+            MD5_SIMD_STEP(VEC, ADD, OR, SLL, SRL, SET1, XOR(d, AND(b, XOR(c, d))), i); \
+        } \
+        _Pragma("GCC unroll 16") \
+        for (int i = 16; i < 32; i++) { \
+            MD5_SIMD_STEP(VEC, ADD, OR, SLL, SRL, SET1, XOR(c, AND(d, XOR(b, c))), i); \
+        } \
+        _Pragma("GCC unroll 16") \
+        for (int i = 32; i < 48; i++) { \
+            MD5_SIMD_STEP(VEC, ADD, OR, SLL, SRL, SET1, XOR(XOR(b, c), d), i); \
+        } \
+        _Pragma("GCC unroll 16") \
+        for (int i = 48; i < 64; i++) { \
+            MD5_SIMD_STEP(VEC, ADD, OR, SLL, SRL, SET1, XOR(c, OR(b, XOR(d, ones))), i); \
+        } \
+        state[0] = ADD(state[0], a); \
+        state[1] = ADD(state[1], b); \
+        state[2] = ADD(state[2], c); \
+        state[3] = ADD(state[3], d); \
+        \
+        /* Lane states only go through memory when a message ends */ \
+        if (md5LanesEnded(lanes, LANES)) { \
+            for (int i = 0; i < 4; i++) { \
+                STORE(laneStates + i * LANES, state[i]); \
+            } \
+            md5LanesAdvance(batch, lanes, laneStates, LANES); \
+            for (int i = 0; i < 4; i++) { \
+                state[i] = LOAD(laneStates + i * LANES); \
+            } \
+        } \
+    }
+
+#define SSE2_SET1(x) _mm_set1_epi32((int)(x))
+#define SSE2_LOAD(words) _mm_loadu_si128((const __m128i *)(words))
+#define SSE2_STORE(words, v) _mm_storeu_si128((__m128i *)(words), (v))
+#define AVX2_SET1(x) _mm256_set1_epi32((int)(x))
+#define AVX2_LOAD(words) _mm256_loadu_si256((const __m256i *)(words))
+#define AVX2_STORE(words, v) _mm256_storeu_si256((__m256i *)(words), (v))
+
+__attribute__((target("sse2")))
+static void md5Lanes4(Md5Batch *batch) {
+    MD5_SIMD_BODY(__m128i, 4, _mm_add_epi32, _mm_and_si128, _mm_or_si128, _mm_xor_si128,
+                  _mm_sll_epi32, _mm_srl_epi32, SSE2_SET1, SSE2_LOAD, SSE2_STORE)
+}
+
+__attribute__((target("avx2")))
+static void md5Lanes8(Md5Batch *batch) {
+    MD5_SIMD_BODY(__m256i, 8, _mm256_add_epi32, _mm256_and_si256, _mm256_or_si256,
+                  _mm256_xor_si256, _mm256_sll_epi32, _mm256_srl_epi32, AVX2_SET1, AVX2_LOAD, AVX2_STORE)
+}
+
+// A single message gains nothing from lanes, the rest share them until the longest is done
+void md5HashBuffersSse2(const uint8_t *const data[], const size_t lengths[], int count, uint8_t digests[][MD5_SIZE]) {
+    Md5Batch batch;
+    if (count < 2 || md5BatchInit(&batch, data, lengths, count, digests) < 0) {
+        md5HashBuffersScalar(data, lengths, count, digests);
+        return;
+    }
+    md5Lanes4(&batch);
+    free(batch.order);
+}
+
+// Batches that fit the SSE2 lanes leave half of the AVX2 ones idle, so they go there instead
+void md5HashBuffersAvx2(const uint8_t *const data[], const size_t lengths[], int count, uint8_t digests[][MD5_SIZE]) {
+    Md5Batch batch;
+    if (count <= 4 || md5BatchInit(&batch, data, lengths, count, digests) < 0) {
+        md5HashBuffersSse2(data, lengths, count, digests);
+        return;
+    }
+    md5Lanes8(&batch);
+    free(batch.order);
+}
+#else
+void md5HashBuffersSse2(const uint8_t *const data[], const size_t lengths[], int count, uint8_t digests[][MD5_SIZE]) {
+    md5HashBuffersScalar(data, lengths, count, digests);
+}
+
+void md5HashBuffersAvx2(const uint8_t *const data[], const size_t lengths[], int count, uint8_t digests[][MD5_SIZE]) {
+    md5HashBuffersScalar(data, lengths, count, digests);
+}
+#endif
+
+typedef void (*Md5BuffersFn)(const uint8_t *const[], const size_t[], int, uint8_t[][MD5_SIZE]);
+
+static Md5BuffersFn md5BuffersImpl = md5HashBuffersScalar;
+static pthread_once_t dispatchOnce = PTHREAD_ONCE_INIT;
+
+static void initDispatch(void) {
+#ifdef MD5_X86
+    __builtin_cpu_init();
+    md5BuffersImpl = cpuHasAvx2() ? md5HashBuffersAvx2 : md5HashBuffersSse2;
+#endif
+}
+
+void md5HashBuffers(const uint8_t *const data[], const size_t lengths[], int count, uint8_t digests[][MD5_SIZE]) {
+    pthread_once(&dispatchOnce, initDispatch);
+    md5BuffersImpl(data, lengths, count, digests);
+}
@@ -0,0 +1,35 @@
+#ifndef MD5_H
+#define MD5_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MD5_SIZE 16
+#define MD5_HEX_SIZE 33 // 32 hex digits and the terminator
+
+// Incremental MD5: fold data in as it is read, sent or received, no second pass over it
+typedef struct {
+    uint32_t state[4];
+    uint64_t length;        // Bytes folded in so far
+    uint8_t block[64];      // Partial block waiting for more data
+} Md5Context;
+
+void md5Init(Md5Context *context);
+void md5Update(Md5Context *context, const uint8_t *data, size_t length);
+void md5Final(Md5Context *context, uint8_t digest[MD5_SIZE]);
+void md5ToHex(const uint8_t digest[MD5_SIZE], char hex[MD5_HEX_SIZE]);
+// 0 on success; the all-zero digest stands for "not known"
+int md5FromHex(const char *hex, uint8_t digest[MD5_SIZE]);
+int md5IsKnown(const uint8_t digest[MD5_SIZE]);
+
+// Multi-buffer MD5: independent messages share SIMD lanes (4 with SSE2, 8 with AVX2), a lane taking
+// the next message as soon as its own is done, so hashing a batch of files costs about its total
+// length over the lane count, or its longest file when that one is bigger
+void md5HashBuffers(const uint8_t *const data[], const size_t lengths[], int count, uint8_t digests[][MD5_SIZE]);
+
+// Individual implementations (exposed for ProtocolBench)
+void md5HashBuffersScalar(const uint8_t *const data[], const size_t lengths[], int count, uint8_t digests[][MD5_SIZE]);
+void md5HashBuffersSse2(const uint8_t *const data[], const size_t lengths[], int count, uint8_t digests[][MD5_SIZE]);
+void md5HashBuffersAvx2(const uint8_t *const data[], const size_t lengths[], int count, uint8_t digests[][MD5_SIZE]);
+
+#endif
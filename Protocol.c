@@ -1,19 +1,56 @@
 #include "Protocol.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+
+// Options negotiated per socket, indexed by file descriptor: the first page covers the usual
+// descriptors, further pages are allocated on demand and kept until exit
+#define OPTIONS_PAGE_SIZE 65536
+#define OPTIONS_PAGES 1024
+static uint8_t firstOptionsPage[OPTIONS_PAGE_SIZE];
+static uint8_t *optionsPages[OPTIONS_PAGES] = { firstOptionsPage };
+
+// Sum of the bytes covered by the checksum: header, payload and (zero) padding
+static uint16_t sumBytes(const uint8_t *bytes, size_t length, uint16_t checksum) {
+    return checksum + byteSum(bytes, length); // Modulo 2^16
+}
+
+// CRC32C folded into the 16-bit checksum field
+static uint16_t foldedCrc32c(const uint8_t *bytes, size_t length) {
+    uint32_t crc = crc32c(0, bytes, length);
+    return (crc ^ (crc >> 16)) & 0xFFFF;
+}
+
+// Trailer checksum of a large frame: full CRC32C or 32-bit byte sum over header and payload
+static uint32_t largeFrameChecksum(const uint8_t *buffer, size_t dataLength, unsigned int options) {
+    if (options & PROTO_CAP_CRC32C) {
+        return crc32c(0, buffer, FRAME_HEADER_SIZE + dataLength);
+    }
+    return byteSum(buffer, FRAME_HEADER_SIZE + dataLength);
+}
 
 // Calculate checksum for a frame
 uint16_t calculateChecksum(const Frame *frame) {
-    uint16_t checksum = 0;
-    uint8_t buffer[FRAME_SIZE] = {0};
+    // Padding bytes are zero on the wire, so only the header and payload contribute
+    size_t dataLength = frame->dataLength;
+    if (dataLength > FRAME_DATA_SIZE) {
+        dataLength = FRAME_DATA_SIZE;
+    }
 
-    // Serialize the frame into a temporary buffer
-    serializeFrame(frame, buffer);
+    uint16_t checksum = frame->type + (frame->dataLength & 0xFF) + ((frame->dataLength >> 8) & 0xFF);
+    return sumBytes((const uint8_t *)frame->data, dataLength, checksum); // Modulo 2^16
+}
 
-    // Calculate the checksum over all bytes except the checksum fields
-    for (int i = 0; i < FRAME_SIZE - 6; i++) {
-        checksum += buffer[i];
-    }
+// Calculate the checksum of a serialized frame, over all bytes except the checksum fields
+uint16_t calculateBufferChecksum(const uint8_t *buffer) {
+    return calculateBufferChecksumWith(buffer, 0);
+}
 
-    return checksum % 65536; // Modulo 2^16
+uint16_t calculateBufferChecksumWith(const uint8_t *buffer, unsigned int options) {
+    if (options & PROTO_CAP_CRC32C) {
+        return foldedCrc32c(buffer, FRAME_CHECKSUM_OFFSET);
+    }
+    return sumBytes(buffer, FRAME_CHECKSUM_OFFSET, 0);
 }
 
 void serializeFrame(const Frame *frame, uint8_t *buffer) {
@@ -69,3 +106,250 @@ void deserializeFrame(const uint8_t *buffer, Frame *frame) {
     memcpy(&frame->timestamp, buffer + FRAME_SIZE - 4, sizeof(int32_t));
 }
 
+// Parse and verify a received frame in one pass without copying the payload
+int parseFrameView(const uint8_t *buffer, FrameView *view) {
+    return parseFrameViewWith(buffer, view, 0);
+}
+
+int parseFrameViewWith(const uint8_t *buffer, FrameView *view, unsigned int options) {
+    view->type = buffer[0];
+    view->dataLength = buffer[1] | (buffer[2] << 8);
+    view->data = buffer + FRAME_HEADER_SIZE;
+    view->unchecked = 0;
+
+    if (options & PROTO_CAP_LARGE_FRAMES) {
+        const uint8_t *trailer = view->data + view->dataLength;
+        view->checksum = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t)trailer[3] << 24);
+        view->timestamp = 0;
+        if (view->type & FRAME_FLAG_UNCHECKED) {
+            // Only data frames may skip the trailer, and only when the upload's MD5 will be checked
+            if (view->type != (0x05 | FRAME_FLAG_UNCHECKED) || !(options & PROTO_CAP_MD5)) {
+                return FRAME_BAD_CHECKSUM;
+            }
+            view->type &= ~FRAME_FLAG_UNCHECKED;
+            view->unchecked = 1;
+            return FRAME_OK;
+        }
+        return (largeFrameChecksum(buffer, view->dataLength, options) == view->checksum) ? FRAME_OK : FRAME_BAD_CHECKSUM;
+    }
+
+    view->checksum = buffer[FRAME_CHECKSUM_OFFSET] | (buffer[FRAME_CHECKSUM_OFFSET + 1] << 8);
+    memcpy(&view->timestamp, buffer + FRAME_TIMESTAMP_OFFSET, sizeof(int32_t));
+
+    if (view->dataLength > FRAME_DATA_SIZE) {
+        return FRAME_BAD_LENGTH;
+    }
+    if (calculateBufferChecksumWith(buffer, options) != view->checksum) {
+        return FRAME_BAD_CHECKSUM;
+    }
+    return FRAME_OK;
+}
+
+// Copy a verified view into a Frame for handlers that need a NUL-terminated payload
+int frameFromView(const FrameView *view, Frame *frame) {
+    if (view->dataLength > sizeof(frame->data)) {
+        return FRAME_BAD_LENGTH; // Large data frames never go through Frame
+    }
+    frame->type = view->type;
+    frame->dataLength = view->dataLength;
+    memcpy(frame->data, view->data, view->dataLength);
+    if (view->dataLength < sizeof(frame->data)) {
+        frame->data[view->dataLength] = '\0';
+    }
+    frame->checksum = view->checksum;
+    frame->timestamp = view->timestamp;
+    return FRAME_OK;
+}
+
+// Payload area of an outgoing buffer, to be filled before finishFrame()
+uint8_t *framePayload(uint8_t *buffer) {
+    return buffer + FRAME_HEADER_SIZE;
+}
+
+// Complete an outgoing frame in place: header, padding, checksum and timestamp
+void finishFrame(uint8_t *buffer, uint8_t type, size_t dataLength) {
+    finishFrameWith(buffer, type, dataLength, 0);
+}
+
+size_t finishFrameWith(uint8_t *buffer, uint8_t type, size_t dataLength, unsigned int options) {
+    if (dataLength > frameDataCapacity(options)) {
+        dataLength = frameDataCapacity(options);
+    }
+
+    buffer[0] = type;
+    buffer[1] = dataLength & 0xFF;
+    buffer[2] = (dataLength >> 8) & 0xFF;
+
+    if (options & PROTO_CAP_LARGE_FRAMES) {
+        uint32_t checksum = largeFrameChecksum(buffer, dataLength, options);
+        uint8_t *trailer = buffer + FRAME_HEADER_SIZE + dataLength;
+        trailer[0] = checksum & 0xFF;
+        trailer[1] = (checksum >> 8) & 0xFF;
+        trailer[2] = (checksum >> 16) & 0xFF;
+        trailer[3] = (checksum >> 24) & 0xFF;
+        return FRAME_HEADER_SIZE + dataLength + LARGE_FRAME_CHECKSUM_SIZE;
+    }
+
+    memset(buffer + FRAME_HEADER_SIZE + dataLength, 0, FRAME_DATA_SIZE - dataLength);
+
+    uint16_t checksum = (options & PROTO_CAP_CRC32C) ? foldedCrc32c(buffer, FRAME_CHECKSUM_OFFSET)
+                                                      : sumBytes(buffer, FRAME_HEADER_SIZE + dataLength, 0);
+    buffer[FRAME_CHECKSUM_OFFSET] = checksum & 0xFF;
+    buffer[FRAME_CHECKSUM_OFFSET + 1] = (checksum >> 8) & 0xFF;
+
+    int32_t timestamp = time(NULL);
+    memcpy(buffer + FRAME_TIMESTAMP_OFFSET, &timestamp, sizeof(int32_t));
+    return FRAME_SIZE;
+}
+
+// Build a complete frame with a single copy of the payload into the wire buffer
+void buildFrame(uint8_t *buffer, uint8_t type, const void *data, size_t dataLength) {
+    buildFrameWith(buffer, type, data, dataLength, 0);
+}
+
+size_t buildFrameWith(uint8_t *buffer, uint8_t type, const void *data, size_t dataLength, unsigned int options) {
+    if (dataLength > frameDataCapacity(options)) {
+        dataLength = frameDataCapacity(options);
+    }
+    if (dataLength > 0) {
+        memcpy(framePayload(buffer), data, dataLength);
+    }
+    return finishFrameWith(buffer, type, dataLength, options);
+}
+
+// Largest payload a frame can carry with the given options
+size_t frameDataCapacity(unsigned int options) {
+    return (options & PROTO_CAP_LARGE_FRAMES) ? LARGE_FRAME_DATA_SIZE : FRAME_DATA_SIZE;
+}
+
+// Total wire size of a frame once its FRAME_HEADER_SIZE header bytes are known
+size_t frameSizeFromHeader(const uint8_t *header, unsigned int options) {
+    if (options & PROTO_CAP_LARGE_FRAMES) {
+        return FRAME_HEADER_SIZE + (header[1] | (header[2] << 8)) + LARGE_FRAME_CHECKSUM_SIZE;
+    }
+    return FRAME_SIZE;
+}
+
+// Read exactly length bytes (0 on orderly close, -1 on error); non-blocking sockets wait for the rest
+static ssize_t readExactly(int sock, uint8_t *buffer, size_t length) {
+    size_t totalRead = 0;
+    while (totalRead < length) {
+        ssize_t bytesRead = read(sock, buffer + totalRead, length - totalRead);
+        if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && (fcntl(sock, F_GETFL, 0) & O_NONBLOCK)) {
+            struct pollfd pending = { .fd = sock, .events = POLLIN };
+            if (poll(&pending, 1, -1) < 0 && errno != EINTR) {
+                return -1;
+            }
+            continue;
+        }
+        if (bytesRead <= 0) {
+            return bytesRead;
+        }
+        totalRead += bytesRead;
+    }
+    return totalRead;
+}
+
+// Receive one frame with the socket's framing and verify it; the view points into buffer
+int receiveFrame(int sock, uint8_t *buffer, size_t capacity, FrameView *view) {
+    unsigned int options = protocolGetOptions(sock);
+
+    if (readExactly(sock, buffer, FRAME_HEADER_SIZE) != FRAME_HEADER_SIZE) {
+        return FRAME_CLOSED;
+    }
+    size_t size = frameSizeFromHeader(buffer, options);
+    if (size > capacity) {
+        return FRAME_BAD_LENGTH;
+    }
+    if (readExactly(sock, buffer + FRAME_HEADER_SIZE, size - FRAME_HEADER_SIZE) != (ssize_t)(size - FRAME_HEADER_SIZE)) {
+        return FRAME_CLOSED;
+    }
+    return parseFrameViewWith(buffer, view, options);
+}
+
+// Write a whole frame, retrying short writes
+ssize_t sendFrameBuffer(int sock, const uint8_t *buffer, size_t size) {
+    size_t totalSent = 0;
+    while (totalSent < size) {
+        ssize_t sent = write(sock, buffer + totalSent, size - totalSent);
+        if (sent <= 0) {
+            return -1;
+        }
+        totalSent += sent;
+    }
+    return totalSent;
+}
+
+// printf-style payload formatting straight into the wire buffer; returns the payload length
+size_t formatPayload(uint8_t *buffer, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf((char *)framePayload(buffer), FRAME_DATA_SIZE, format, args);
+    va_end(args);
+
+    if (length < 0) {
+        return 0;
+    }
+    return (length >= FRAME_DATA_SIZE) ? FRAME_DATA_SIZE - 1 : (size_t)length;
+}
+
+// Compare a view's payload with a string without NUL-terminating it
+int frameViewEquals(const FrameView *view, const char *text) {
+    size_t length = strlen(text);
+    return view->dataLength == length && memcmp(view->data, text, length) == 0;
+}
+
+// Capabilities we accept out of those a peer asked for
+unsigned int negotiateCapabilities(unsigned int requested) {
+    return requested & PROTO_SUPPORTED_CAPS;
+}
+
+// Capabilities carried by a connection acknowledgment (decimal payload)
+unsigned int parseCapabilities(const FrameView *view) {
+    char digits[16] = {0};
+    size_t length = view->dataLength < sizeof(digits) - 1 ? view->dataLength : sizeof(digits) - 1;
+    memcpy(digits, view->data, length);
+    return negotiateCapabilities(strtoul(digits, NULL, 10));
+}
+
+// Where fd's options live; with create, its page is allocated if needed. NULL when there is none.
+static uint8_t *optionsSlot(int fd, int create) {
+    if (fd < 0 || fd / OPTIONS_PAGE_SIZE >= OPTIONS_PAGES) {
+        return NULL;
+    }
+    uint8_t **page = &optionsPages[fd / OPTIONS_PAGE_SIZE];
+    uint8_t *entries = __atomic_load_n(page, __ATOMIC_ACQUIRE);
+    if (entries == NULL && create) {
+        uint8_t *fresh = calloc(OPTIONS_PAGE_SIZE, 1);
+        if (fresh == NULL) {
+            return NULL;
+        }
+        // Another thread may install the page first; then use its page
+        if (__atomic_compare_exchange_n(page, &entries, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            entries = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+    return (entries != NULL) ? entries + fd % OPTIONS_PAGE_SIZE : NULL;
+}
+
+// Capabilities we accept on a socket: none when its options could not be stored, so both ends stay legacy
+unsigned int negotiateSocketCapabilities(int fd, unsigned int requested) {
+    return (optionsSlot(fd, 1) != NULL) ? negotiateCapabilities(requested) : 0;
+}
+
+// Remember the options negotiated on a socket (reset to 0 when it is closed); -1 if they cannot be stored
+int protocolSetOptions(int fd, unsigned int options) {
+    uint8_t *slot = optionsSlot(fd, options != 0);
+    if (slot == NULL) {
+        return (options != 0) ? -1 : 0;
+    }
+    __atomic_store_n(slot, (uint8_t)options, __ATOMIC_RELEASE);
+    return 0;
+}
+
+unsigned int protocolGetOptions(int fd) {
+    const uint8_t *slot = optionsSlot(fd, 0);
+    return (slot != NULL) ? __atomic_load_n(slot, __ATOMIC_ACQUIRE) : 0;
+}
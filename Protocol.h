@@ -7,12 +7,43 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <time.h>
 #include "Common.h"
+#include "Checksum.h"
+#include "Tlv.h"
 
 
 #define FRAME_SIZE 256
 
+// Wire layout: type (1) | length (2, LE) | data | zero padding | checksum (2, LE) | timestamp (4)
+#define FRAME_HEADER_SIZE 3
+#define FRAME_DATA_SIZE (FRAME_SIZE - 9)
+#define FRAME_CHECKSUM_OFFSET (FRAME_SIZE - 6)
+#define FRAME_TIMESTAMP_OFFSET (FRAME_SIZE - 4)
+
+// Large-frame layout (PROTO_CAP_LARGE_FRAMES): type (1) | length (2, LE) | data | checksum (4, LE).
+// Same header as legacy frames so payloads always start at FRAME_HEADER_SIZE; no padding or timestamp.
+#define LARGE_FRAME_CHECKSUM_SIZE 4
+#define LARGE_FRAME_DATA_SIZE 65535
+#define LARGE_FRAME_MAX_SIZE (FRAME_HEADER_SIZE + LARGE_FRAME_DATA_SIZE + LARGE_FRAME_CHECKSUM_SIZE)
+
+// Large-frame mode only: set in the type byte of a data frame (0x05) whose trailer checksum was not
+// computed (payload sent zero-copy and covered by the end-to-end MD5 instead). Accepted only when
+// PROTO_CAP_MD5 was negotiated too; on any other frame it fails as FRAME_BAD_CHECKSUM.
+#define FRAME_FLAG_UNCHECKED 0x80
+
+// Capabilities requested as an extra '&'-field of the 0x01/0x02/0x03 connection frames.
+// The peer acknowledges with the accepted subset as payload; legacy peers ignore the field.
+#define PROTO_CAP_CRC32C 0x01 // Checksum field carries a CRC32C instead of the byte sum
+#define PROTO_CAP_LARGE_FRAMES 0x02 // Length-prefixed frames of up to 64 KB, compact control frames
+#define PROTO_CAP_TLV 0x04 // Request payloads are binary TLV (see Tlv.h) instead of '&' strings
+#define PROTO_CAP_MD5 0x08 // Uploads are followed by an end frame (0x06) carrying their MD5
+#define PROTO_SUPPORTED_CAPS (PROTO_CAP_CRC32C | PROTO_CAP_LARGE_FRAMES | PROTO_CAP_TLV | PROTO_CAP_MD5)
+
+// Seconds between worker heartbeats (TYPE: 0x12)
+#define HEARTBEAT_INTERVAL 2
+
 // Frame structure
 typedef struct {
     uint8_t type;              // Frame type
@@ -22,9 +53,55 @@ typedef struct {
     int32_t timestamp;         // Timestamp
 } Frame;
 
+// Read-only view over a received wire buffer (no copy of the payload)
+typedef struct {
+    uint8_t type;
+    uint16_t dataLength;
+    const uint8_t *data;       // Points into the wire buffer
+    uint32_t checksum;
+    int32_t timestamp;         // 0 for large frames
+    int unchecked;             // Large frame sent without a trailer checksum
+} FrameView;
+
+// Results of parseFrameView() / receiveFrame()
+#define FRAME_OK 0
+#define FRAME_BAD_LENGTH -1
+#define FRAME_BAD_CHECKSUM -2
+#define FRAME_CLOSED -3
+
 // Utility functions
 uint16_t calculateChecksum(const Frame *frame);
 void serializeFrame(const Frame *frame, uint8_t *buffer);
 void deserializeFrame(const uint8_t *buffer, Frame *frame);
 
+// Zero-copy codec working directly on FRAME_SIZE wire buffers
+uint16_t calculateBufferChecksum(const uint8_t *buffer);
+int parseFrameView(const uint8_t *buffer, FrameView *view);
+int frameFromView(const FrameView *view, Frame *frame);
+uint8_t *framePayload(uint8_t *buffer);
+void finishFrame(uint8_t *buffer, uint8_t type, size_t dataLength);
+void buildFrame(uint8_t *buffer, uint8_t type, const void *data, size_t dataLength);
+
+// Same codec for a connection with negotiated options (PROTO_CAP_* flags).
+// finish/build return the number of bytes to put on the wire.
+uint16_t calculateBufferChecksumWith(const uint8_t *buffer, unsigned int options);
+int parseFrameViewWith(const uint8_t *buffer, FrameView *view, unsigned int options);
+size_t finishFrameWith(uint8_t *buffer, uint8_t type, size_t dataLength, unsigned int options);
+size_t buildFrameWith(uint8_t *buffer, uint8_t type, const void *data, size_t dataLength, unsigned int options);
+size_t frameDataCapacity(unsigned int options);
+size_t frameSizeFromHeader(const uint8_t *header, unsigned int options);
+
+// Socket helpers honouring the framing negotiated on the socket
+int receiveFrame(int sock, uint8_t *buffer, size_t capacity, FrameView *view);
+ssize_t sendFrameBuffer(int sock, const uint8_t *buffer, size_t size);
+
+// Capability negotiation and per-socket options
+unsigned int negotiateCapabilities(unsigned int requested);
+unsigned int parseCapabilities(const FrameView *view);
+unsigned int negotiateSocketCapabilities(int fd, unsigned int requested);
+int protocolSetOptions(int fd, unsigned int options);
+unsigned int protocolGetOptions(int fd);
+size_t formatPayload(uint8_t *buffer, const char *format, ...) __attribute__((format(printf, 2, 3)));
+int frameViewEquals(const FrameView *view, const char *text);
+
 #endif
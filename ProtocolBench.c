@@ -0,0 +1,365 @@
+/*
+@Author: Matéo Martin
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "Protocol.h"
+#include "Checksum.h"
+#include "TextDistort.h"
+#include "AudioDistort.h"
+#include "Md5.h"
+
+// Keep the compiler from discarding benchmark results
+static volatile uint32_t sink;
+
+typedef struct {
+    const char *name;
+    uint32_t (*run)(const uint8_t *bytes, size_t length);
+    int available;
+} Kernel;
+
+static uint32_t runByteSumScalar(const uint8_t *bytes, size_t length) { return byteSumScalar(bytes, length); }
+static uint32_t runByteSumSse2(const uint8_t *bytes, size_t length) { return byteSumSse2(bytes, length); }
+static uint32_t runByteSumAvx2(const uint8_t *bytes, size_t length) { return byteSumAvx2(bytes, length); }
+static uint32_t runCrc32cTable(const uint8_t *bytes, size_t length) { return crc32cTable(0, bytes, length); }
+static uint32_t runCrc32cHardware(const uint8_t *bytes, size_t length) { return crc32cHardware(0, bytes, length); }
+
+// Text distortion with a factor of 4 into a scratch buffer
+static uint8_t distortOutput[65536];
+static uint32_t runDistortReference(const uint8_t *bytes, size_t length) { return distortTextReference(bytes, length, distortOutput, 4); }
+static uint32_t runDistortText(const uint8_t *bytes, size_t length) { return distortText(bytes, length, distortOutput, 4); }
+
+// 16-bit PCM losing 4 bits of depth, on a copy so every iteration sees the same samples
+static uint32_t runReduceBits16Scalar(const uint8_t *bytes, size_t length) { memcpy(distortOutput, bytes, length); reduceBits16Scalar(distortOutput, length / 2, 4); return distortOutput[0]; }
+static uint32_t runReduceBits16Sse2(const uint8_t *bytes, size_t length) { memcpy(distortOutput, bytes, length); reduceBits16Sse2(distortOutput, length / 2, 4); return distortOutput[0]; }
+static uint32_t runReduceBits16Avx2(const uint8_t *bytes, size_t length) { memcpy(distortOutput, bytes, length); reduceBits16Avx2(distortOutput, length / 2, 4); return distortOutput[0]; }
+
+// MD5 over 8 equal slices of the input, one message per lane
+static uint32_t runMd5(const uint8_t *bytes, size_t length,
+                       void (*hash)(const uint8_t *const[], const size_t[], int, uint8_t[][MD5_SIZE])) {
+    const uint8_t *slices[8];
+    size_t lengths[8];
+    uint8_t digests[8][MD5_SIZE];
+    for (int i = 0; i < 8; i++) {
+        slices[i] = bytes + i * (length / 8);
+        lengths[i] = length / 8;
+    }
+    hash(slices, lengths, 8, digests);
+    return digests[7][0];
+}
+static uint32_t runMd5Scalar(const uint8_t *bytes, size_t length) { return runMd5(bytes, length, md5HashBuffersScalar); }
+static uint32_t runMd5Sse2(const uint8_t *bytes, size_t length) { return runMd5(bytes, length, md5HashBuffersSse2); }
+static uint32_t runMd5Avx2(const uint8_t *bytes, size_t length) { return runMd5(bytes, length, md5HashBuffersAvx2); }
+
+// Frame codec operations on one frame of a given payload length, all sharing the same frame and wire buffer
+static Frame codecFrame;
+static uint8_t codecWire[FRAME_SIZE];
+static uint8_t codecPayload[FRAME_DATA_SIZE];
+
+static uint32_t runEncode(size_t length) {
+    codecFrame.dataLength = length;
+    codecFrame.checksum = calculateChecksum(&codecFrame);
+    serializeFrame(&codecFrame, codecWire);
+    return codecWire[FRAME_CHECKSUM_OFFSET];
+}
+static uint32_t runDecode(size_t length) { (void)length; deserializeFrame(codecWire, &codecFrame); return codecFrame.checksum; }
+static uint32_t runVerify(size_t length) { (void)length; return calculateChecksum(&codecFrame) == codecFrame.checksum; }
+static uint32_t runBuild(size_t length) { buildFrame(codecWire, 0x05, codecPayload, length); return codecWire[FRAME_CHECKSUM_OFFSET]; }
+static uint32_t runParse(size_t length) { (void)length; FrameView view; return parseFrameView(codecWire, &view); }
+static uint32_t runParseCrc(size_t length) { (void)length; FrameView view; return parseFrameViewWith(codecWire, &view, PROTO_CAP_CRC32C); }
+
+typedef struct {
+    const char *name;
+    uint32_t (*run)(size_t length);
+    void (*prepare)(size_t length);     // Puts codecFrame/codecWire in the state run() expects
+} FrameOp;
+
+static void prepareFrame(size_t length) {
+    memset(&codecFrame, 0, sizeof(codecFrame));
+    codecFrame.type = 0x05;
+    memcpy(codecFrame.data, codecPayload, length);
+    runEncode(length);
+    deserializeFrame(codecWire, &codecFrame);
+}
+static void prepareCrcWire(size_t length) { buildFrameWith(codecWire, 0x05, codecPayload, length, PROTO_CAP_CRC32C); }
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Run a kernel for roughly 0.2s and return MB/s
+static double measure(const Kernel *kernel, const uint8_t *bytes, size_t length) {
+    size_t iterations = 0;
+    size_t batch = (64 * 1024 * 1024) / length + 1;
+    double start = nowSeconds();
+    double elapsed;
+
+    do {
+        for (size_t i = 0; i < batch; i++) {
+            sink += kernel->run(bytes, length);
+        }
+        iterations += batch;
+        elapsed = nowSeconds() - start;
+    } while (elapsed < 0.2);
+
+    return (iterations * (double)length) / elapsed / (1024.0 * 1024.0);
+}
+
+// Run a frame operation for roughly 0.2s and return millions of frames per second
+static double measureFrames(const FrameOp *op, size_t length) {
+    size_t iterations = 0;
+    double start = nowSeconds();
+    double elapsed;
+
+    op->prepare(length);
+    do {
+        for (int i = 0; i < 4096; i++) {
+            sink += op->run(length);
+        }
+        iterations += 4096;
+        elapsed = nowSeconds() - start;
+    } while (elapsed < 0.2);
+
+    return iterations / elapsed / 1e6;
+}
+
+// The copying codec (Frame structs) and the zero-copy one (wire buffers) must produce and accept the same frames
+static int checkFrameCodec(void) {
+    for (size_t length = 0; length <= FRAME_DATA_SIZE; length++) {
+        prepareFrame(length);
+        Frame decoded = codecFrame;
+        FrameView view;
+        uint8_t built[FRAME_SIZE];
+        buildFrame(built, 0x05, codecPayload, length);
+        memcpy(built + FRAME_TIMESTAMP_OFFSET, codecWire + FRAME_TIMESTAMP_OFFSET, sizeof(int32_t));
+
+        if (decoded.dataLength != length || memcmp(decoded.data, codecPayload, length) != 0 ||
+            calculateChecksum(&decoded) != decoded.checksum || memcmp(built, codecWire, FRAME_SIZE) != 0 ||
+            parseFrameView(codecWire, &view) != FRAME_OK || view.dataLength != length) {
+            printf("Frame codecs disagree for payload length %zu\n", length);
+            return -1;
+        }
+        codecWire[FRAME_HEADER_SIZE + length / 2] ^= 0x01;
+        if (length > 0 && parseFrameView(codecWire, &view) != FRAME_BAD_CHECKSUM) {
+            printf("Corrupted frame of payload length %zu accepted\n", length);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    const size_t sizes[] = {FRAME_CHECKSUM_OFFSET, 4096, 65536};
+    const int sizeCount = sizeof(sizes) / sizeof(sizes[0]);
+
+    Kernel kernels[] = {
+        {"sum-scalar", runByteSumScalar, 1},
+        {"sum-sse2", runByteSumSse2, 1},
+        {"sum-avx2", runByteSumAvx2, cpuHasAvx2()},
+        {"crc32c-slice8", runCrc32cTable, 1},
+        {"crc32c-sse4.2", runCrc32cHardware, cpuHasSse42()},
+        {"distort-ref", runDistortReference, 1},
+        {"distort-simd", runDistortText, 1},
+        {"bits16-scalar", runReduceBits16Scalar, 1},
+        {"bits16-sse2", runReduceBits16Sse2, 1},
+        {"bits16-avx2", runReduceBits16Avx2, cpuHasAvx2()},
+        {"md5-scalar", runMd5Scalar, 1},
+        {"md5-sse2-x4", runMd5Sse2, 1},
+        {"md5-avx2-x8", runMd5Avx2, cpuHasAvx2()},
+    };
+    const int kernelCount = sizeof(kernels) / sizeof(kernels[0]);
+
+    uint8_t *bytes = malloc(sizes[sizeCount - 1]);
+    if (bytes == NULL) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    srand(42);
+    for (size_t i = 0; i < sizes[sizeCount - 1]; i++) {
+        bytes[i] = rand() & 0xFF;
+    }
+
+    // Text sample for the distortion kernels: words of 1-9 letters between spaces and punctuation
+    uint8_t *text = malloc(sizes[sizeCount - 1]);
+    uint8_t *expected = malloc(sizes[sizeCount - 1]);
+    if (text == NULL || expected == NULL) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    for (size_t i = 0; i < sizes[sizeCount - 1];) {
+        int wordLength = 1 + rand() % 9;
+        for (int c = 0; c < wordLength && i < sizes[sizeCount - 1]; c++) {
+            text[i++] = 'a' + rand() % 26;
+        }
+        if (i < sizes[sizeCount - 1]) {
+            text[i++] = " ,. \n"[rand() % 5];
+        }
+    }
+
+    // Every implementation of a family must agree before timings mean anything
+    memcpy(codecPayload, text, sizeof(codecPayload));
+    if (checkFrameCodec() < 0) {
+        return -2;
+    }
+    for (int s = 0; s < sizeCount; s++) {
+        for (size_t length = sizes[s] - 7; length <= sizes[s]; length++) {
+            uint32_t sum = byteSumScalar(bytes, length);
+            uint32_t crc = crc32cTable(0, bytes, length);
+            if ((kernels[1].available && byteSumSse2(bytes, length) != sum) ||
+                (kernels[2].available && byteSumAvx2(bytes, length) != sum) ||
+                (kernels[4].available && crc32cHardware(0, bytes, length) != crc)) {
+                printf("Checksum kernels disagree for length %zu\n", length);
+                free(bytes);
+                return -2;
+            }
+        }
+    }
+    for (size_t length = 0; length <= 300; length++) {
+        for (unsigned int factor = 0; factor < 8; factor++) {
+            size_t reference = distortTextReference(text, length, expected, factor);
+            if (distortText(text, length, distortOutput, factor) != reference ||
+                memcmp(distortOutput, expected, reference) != 0) {
+                printf("Text distortion kernels disagree for length %zu, factor %u\n", length, factor);
+                return -2;
+            }
+        }
+    }
+    uint8_t block[64];
+    for (int i = 0; i < 64 * 256; i++) {
+        block[i % 64] = rand() & 0xFF;
+        if (wordMaskSse2(block) != wordMaskScalar(block) ||
+            (kernels[2].available && wordMaskAvx2(block) != wordMaskScalar(block))) {
+            printf("Word classification kernels disagree\n");
+            return -2;
+        }
+    }
+    for (size_t length = 0; length <= 300; length++) {
+        for (unsigned int bits = 1; bits < 8; bits++) {
+            uint8_t *scalar = expected;
+            memcpy(scalar, bytes, 2 * length);
+            reduceBits16Scalar(scalar, length, bits);
+            memcpy(distortOutput, bytes, 2 * length);
+            reduceBits16Sse2(distortOutput, length, bits);
+            int mismatch = memcmp(distortOutput, scalar, 2 * length) != 0;
+            if (kernels[2].available) {
+                memcpy(distortOutput, bytes, 2 * length);
+                reduceBits16Avx2(distortOutput, length, bits);
+                mismatch |= memcmp(distortOutput, scalar, 2 * length) != 0;
+            }
+            memcpy(scalar, bytes, length);
+            reduceBits8Scalar(scalar, length, bits);
+            memcpy(distortOutput, bytes, length);
+            reduceBits8Sse2(distortOutput, length, bits);
+            mismatch |= memcmp(distortOutput, scalar, length) != 0;
+            if (kernels[2].available) {
+                memcpy(distortOutput, bytes, length);
+                reduceBits8Avx2(distortOutput, length, bits);
+                mismatch |= memcmp(distortOutput, scalar, length) != 0;
+            }
+            if (mismatch) {
+                printf("Bit depth kernels disagree for length %zu, bits %u\n", length, bits);
+                return -2;
+            }
+        }
+    }
+    // Multi-buffer MD5 against the scalar one, with batches of every size mixing short and long messages
+    // so lanes are refilled while others still run
+    for (int round = 0; round < 64; round++) {
+        const uint8_t *messages[11];
+        size_t lengths[11];
+        uint8_t scalar[11][MD5_SIZE], sse2[11][MD5_SIZE], avx2[11][MD5_SIZE];
+        int count = 1 + round % 11;
+        for (int i = 0; i < count; i++) {
+            lengths[i] = (rand() % 3 == 0) ? rand() % (sizes[sizeCount - 1] / 2) : rand() % 1024;
+            messages[i] = bytes + rand() % (sizes[sizeCount - 1] - lengths[i]);
+        }
+        memset(scalar, 0, sizeof(scalar));
+        memset(sse2, 0, sizeof(sse2));
+        memset(avx2, 0, sizeof(avx2));
+        md5HashBuffersScalar(messages, lengths, count, scalar);
+        md5HashBuffersSse2(messages, lengths, count, sse2);
+        if (kernels[2].available) {
+            md5HashBuffersAvx2(messages, lengths, count, avx2);
+        }
+        if (memcmp(scalar, sse2, sizeof(scalar)) != 0 || (kernels[2].available && memcmp(scalar, avx2, sizeof(scalar)) != 0)) {
+            printf("MD5 kernels disagree\n");
+            return -2;
+        }
+    }
+
+    // Known answer: MD5("abc") = 900150983cd24fb0d6963f7d28e17f72
+    uint8_t digest[MD5_SIZE];
+    char hex[MD5_HEX_SIZE];
+    Md5Context md5;
+    md5Init(&md5);
+    md5Update(&md5, (const uint8_t *)"abc", 3);
+    md5Final(&md5, digest);
+    md5ToHex(digest, hex);
+    if (strcmp(hex, "900150983cd24fb0d6963f7d28e17f72") != 0) {
+        printf("MD5 known-answer test failed\n");
+        return -3;
+    }
+
+    // Known answer: CRC32C("123456789") = 0xE3069283
+    if (crc32cTable(0, (const uint8_t *)"123456789", 9) != 0xE3069283u) {
+        printf("CRC32C known-answer test failed\n");
+        free(bytes);
+        return -3;
+    }
+
+    printf("%-16s", "kernel");
+    for (int s = 0; s < sizeCount; s++) {
+        printf("%10zuB", sizes[s]);
+    }
+    printf("   (MB/s)\n");
+
+    for (int k = 0; k < kernelCount; k++) {
+        // Distortion kernels run over the text sample, checksums over random bytes
+        const uint8_t *input = (kernels[k].run == runDistortReference || kernels[k].run == runDistortText) ? text : bytes;
+        printf("%-16s", kernels[k].name);
+        for (int s = 0; s < sizeCount; s++) {
+            if (kernels[k].available) {
+                printf("%11.0f", measure(&kernels[k], input, sizes[s]));
+            } else {
+                printf("%11s", "n/a");
+            }
+        }
+        printf("\n");
+    }
+
+    // Per-frame costs paid by every process on every control and data frame
+    const size_t frameSizes[] = {0, 32, 128, FRAME_DATA_SIZE};
+    const FrameOp frameOps[] = {
+        {"frame-encode", runEncode, prepareFrame},
+        {"frame-decode", runDecode, prepareFrame},
+        {"frame-verify", runVerify, prepareFrame},
+        {"frame-build", runBuild, prepareFrame},
+        {"frame-parse", runParse, prepareFrame},
+        {"frame-parse-crc", runParseCrc, prepareCrcWire},
+    };
+
+    printf("\n%-16s", "frame op");
+    for (size_t s = 0; s < sizeof(frameSizes) / sizeof(frameSizes[0]); s++) {
+        printf("%10zuB", frameSizes[s]);
+    }
+    printf("   (Mframes/s)\n");
+    for (size_t o = 0; o < sizeof(frameOps) / sizeof(frameOps[0]); o++) {
+        printf("%-16s", frameOps[o].name);
+        for (size_t s = 0; s < sizeof(frameSizes) / sizeof(frameSizes[0]); s++) {
+            printf("%11.2f", measureFrames(&frameOps[o], frameSizes[s]));
+        }
+        printf("\n");
+    }
+
+    free(bytes);
+    free(text);
+    free(expected);
+    return 0;
+}
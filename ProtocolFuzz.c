@@ -0,0 +1,275 @@
+/*
+@Author: Matéo Martin
+*/
+
+// Fuzz target for the frame codec and Gotham's frame handlers. Every input is taken as a 256-byte
+// wire buffer (short inputs are zero-padded) and goes through deserializeFrame(), the checksums, the
+// zero-copy parsers under each framing, Gotham's dispatchFrame() and, since random checksums rarely
+// match, straight into handleClientFrame() as well. Replies land on a socketpair and are discarded.
+//
+// libFuzzer: make ProtocolFuzzLibFuzzer, then ./ProtocolFuzzLibFuzzer -close_fd_mask=3 corpus/
+// Standalone (gcc, sanitizers on): ./ProtocolFuzz [-n count] [-s seed] [file|dir ...] replays the
+// given inputs, or without any runs count mutations of well-formed Gotham frames. A crash or a
+// broken codec invariant aborts; otherwise it prints how many inputs ran.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include "Protocol.h"
+#include "Tlv.h"
+
+// Gotham.c, built with GOTHAM_NO_MAIN
+void dispatchFrame(const FrameView *view, int result, int clientSock);
+void handleClientFrame(const Frame *receivedFrame, int clientSock);
+void removeWorkersBySocket(int sock);
+
+static int handlerSock = -1; // Gotham's end of the connection
+static int peerSock = -1;    // Where its replies arrive
+
+static void setUp(void) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0) {
+        perror("socketpair failed");
+        abort();
+    }
+    handlerSock = sockets[0];
+    peerSock = sockets[1];
+    fcntl(peerSock, F_SETFL, fcntl(peerSock, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static void drainReplies(void) {
+    uint8_t discard[4096];
+    while (read(peerSock, discard, sizeof(discard)) > 0) {
+    }
+}
+
+// Both codecs must agree on a well-formed frame: same payload, same checksum, same bytes back
+static void checkCodecs(const uint8_t *buffer, const Frame *frame, const FrameView *view) {
+    int paddingIsZero = 1;
+    for (size_t i = FRAME_HEADER_SIZE + view->dataLength; i < FRAME_CHECKSUM_OFFSET; i++) {
+        paddingIsZero &= buffer[i] == 0;
+    }
+    if (!paddingIsZero) {
+        return;
+    }
+
+    uint8_t serialized[FRAME_SIZE];
+    serializeFrame(frame, serialized);
+    if (frame->dataLength != view->dataLength || memcmp(frame->data, view->data, view->dataLength) != 0 ||
+        calculateChecksum(frame) != view->checksum || memcmp(serialized, buffer, FRAME_SIZE) != 0) {
+        fprintf(stderr, "Frame codecs disagree on a frame accepted by parseFrameView\n");
+        abort();
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (handlerSock < 0) {
+        setUp();
+    }
+
+    uint8_t buffer[FRAME_SIZE] = {0};
+    memcpy(buffer, data, size < FRAME_SIZE ? size : FRAME_SIZE);
+
+    Frame frame;
+    FrameView view;
+    deserializeFrame(buffer, &frame);
+    calculateChecksum(&frame);
+    calculateBufferChecksum(buffer);
+    int result = parseFrameView(buffer, &view);
+    if (result == FRAME_OK) {
+        checkCodecs(buffer, &frame, &view);
+    }
+    FrameView crcView;
+    parseFrameViewWith(buffer, &crcView, PROTO_CAP_CRC32C);
+
+    // Large framing sizes the frame from its header; parse it only when the input holds all of it
+    if (size >= FRAME_HEADER_SIZE && frameSizeFromHeader(data, PROTO_CAP_LARGE_FRAMES) <= size) {
+        FrameView largeView;
+        parseFrameViewWith(data, &largeView, PROTO_CAP_LARGE_FRAMES);
+        parseFrameViewWith(data, &largeView, PROTO_CAP_LARGE_FRAMES | PROTO_CAP_CRC32C);
+    }
+
+    // What Gotham does with the frame as received, then the handlers whatever the checksum said
+    dispatchFrame(&view, result, handlerSock);
+    FrameView raw = { .type = buffer[0], .dataLength = buffer[1] | (buffer[2] << 8), .data = framePayload(buffer) };
+    if (frameFromView(&raw, &frame) == FRAME_OK) {
+        handleClientFrame(&frame, handlerSock);
+    }
+
+    // Connection frames register workers and negotiate options on the socket; start the next input clean
+    drainReplies();
+    removeWorkersBySocket(handlerSock);
+    protocolSetOptions(handlerSock, 0);
+    return 0;
+}
+
+#ifndef PROTOCOL_FUZZ_LIBFUZZER
+
+// Well-formed frames of every type Gotham handles, to be mutated
+static size_t buildSeed(uint8_t *buffer, int index) {
+    static const char *textSeeds[][2] = {
+        {"\x01", "Arthur&127.0.0.1&8090&15"},
+        {"\x02", "Text&127.0.0.1&8091&15"},
+        {"\x02", "Media&127.0.0.1&8092"},
+        {"\x10", "Text&file.txt"},
+        {"\x11", "127.0.0.1&8091"},
+        {"\x12", "3&1&250"},
+        {"\x13", ""},
+        {"\x07", "Arthur"},
+    };
+    const int textCount = sizeof(textSeeds) / sizeof(textSeeds[0]);
+
+    if (index % (textCount + 3) < textCount) {
+        const char *const *seed = textSeeds[index % (textCount + 3)];
+        buildFrame(buffer, (uint8_t)seed[0][0], seed[1], strlen(seed[1]));
+        return FRAME_SIZE;
+    }
+
+    // TLV forms of the binary requests
+    size_t length;
+    uint8_t type;
+    switch (index % (textCount + 3) - textCount) {
+        case 0: {
+            DistortRequest request = { .mediaType = "Media", .fileName = "song.wav" };
+            length = encodeDistortRequest(&request, framePayload(buffer), FRAME_DATA_SIZE);
+            type = 0x10;
+            break;
+        }
+        case 1: {
+            JobFinished finished = { .ip = "127.0.0.1", .port = 8092 };
+            length = encodeJobFinished(&finished, framePayload(buffer), FRAME_DATA_SIZE);
+            type = 0x11;
+            break;
+        }
+        default: {
+            Heartbeat heartbeat = { .queueDepth = 2, .activeJobs = 4, .p99Ms = 90 };
+            length = encodeHeartbeat(&heartbeat, framePayload(buffer), FRAME_DATA_SIZE);
+            type = 0x12;
+            break;
+        }
+    }
+    finishFrame(buffer, type, length);
+    return FRAME_SIZE;
+}
+
+// Flip bytes, rewrite the length or truncate; half of the mutants get a valid checksum again
+static size_t mutate(uint8_t *buffer, size_t size, unsigned int *seed) {
+    int edits = 1 + rand_r(seed) % 8;
+    for (int i = 0; i < edits; i++) {
+        switch (rand_r(seed) % 4) {
+            case 0:
+                buffer[rand_r(seed) % FRAME_SIZE] ^= 1 << (rand_r(seed) % 8);
+                break;
+            case 1:
+                buffer[FRAME_HEADER_SIZE + rand_r(seed) % FRAME_DATA_SIZE] = rand_r(seed) & 0xFF;
+                break;
+            case 2:
+                buffer[1] = rand_r(seed) & 0xFF;
+                buffer[2] = (rand_r(seed) % 4 == 0) ? rand_r(seed) & 0xFF : 0;
+                break;
+            default:
+                size = rand_r(seed) % (FRAME_SIZE + 1);
+                break;
+        }
+    }
+    size_t dataLength = buffer[1] | (buffer[2] << 8);
+    if (rand_r(seed) % 2 == 0 && dataLength <= FRAME_DATA_SIZE) {
+        finishFrame(buffer, buffer[0], dataLength);
+    }
+    return size;
+}
+
+static int replayFile(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return 0;
+    }
+    uint8_t input[LARGE_FRAME_MAX_SIZE];
+    size_t size = fread(input, 1, sizeof(input), file);
+    fclose(file);
+    LLVMFuzzerTestOneInput(input, size);
+    return 1;
+}
+
+// A file, or every regular file directly inside a directory
+static int replayPath(const char *path) {
+    struct stat pathStat;
+    if (stat(path, &pathStat) < 0) {
+        perror(path);
+        return 0;
+    }
+    if (!S_ISDIR(pathStat.st_mode)) {
+        return replayFile(path);
+    }
+
+    DIR *directory = opendir(path);
+    if (directory == NULL) {
+        perror(path);
+        return 0;
+    }
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL) {
+        char *child;
+        asprintf(&child, "%s/%s", path, entry->d_name);
+        if (stat(child, &pathStat) == 0 && S_ISREG(pathStat.st_mode)) {
+            count += replayFile(child);
+        }
+        free(child);
+    }
+    closedir(directory);
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    long count = 100000;
+    unsigned int seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        if (opt == 'n') {
+            count = atol(optarg);
+        } else if (opt == 's') {
+            seed = strtoul(optarg, NULL, 10);
+        } else {
+            fprintf(stderr, "Usage: %s [-n count] [-s seed] [file|dir ...]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    // Gotham logs every frame it handles; keep the real stdout for the result only
+    int out = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    if (out < 0 || devNull < 0 || dup2(devNull, STDOUT_FILENO) < 0) {
+        perror("Could not silence stdout");
+        return -1;
+    }
+    close(devNull);
+
+    long inputs = 0;
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++) {
+            inputs += replayPath(argv[i]);
+        }
+    } else {
+        uint8_t buffer[FRAME_SIZE];
+        for (long i = 0; i < count; i++) {
+            size_t size = buildSeed(buffer, rand_r(&seed));
+            size = mutate(buffer, size, &seed);
+            LLVMFuzzerTestOneInput(buffer, size);
+            inputs++;
+        }
+    }
+
+    dprintf(out, "%ld inputs, no failures\n", inputs);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,148 @@
+#include <unistd.h>
+#include "Protocol.h"
+#include "Stats.h"
+
+static int bucketIndex(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (int)value;
+    }
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + (int)((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+static uint64_t bucketLow(int index) {
+    if (index < HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+    int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+    return (uint64_t)(HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+static uint64_t bucketHigh(int index) {
+    if (index < HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+    int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+    return bucketLow(index) + (((uint64_t)1 << shift) - 1);
+}
+
+void histogramRecord(Histogram *histogram, uint64_t value) {
+    statsAdd(&histogram->counts[bucketIndex(value)], 1);
+    statsAdd(&histogram->count, 1);
+    statsAdd(&histogram->sum, value);
+
+    uint64_t max = statsLoad(&histogram->max);
+    while (value > max &&
+           !__atomic_compare_exchange_n(&histogram->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Buckets are read one by one while others record, so the walk uses its own total
+uint64_t histogramPercentile(const Histogram *histogram, double percentile) {
+    uint64_t total = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        total += statsLoad(&histogram->counts[i]);
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    double exact = total * percentile / 100;
+    uint64_t rank = (uint64_t)exact;
+    if (rank < exact) {
+        rank++;
+    }
+    uint64_t seen = 0;
+    uint64_t max = statsLoad(&histogram->max);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += statsLoad(&histogram->counts[i]);
+        if (seen >= rank && seen > 0) {
+            uint64_t high = bucketHigh(i);
+            return high < max ? high : max;
+        }
+    }
+    return max;
+}
+
+void statsWriteCounter(FILE *out, const char *name, uint64_t value) {
+    fprintf(out, "%s %llu\n", name, (unsigned long long)value);
+}
+
+void statsWriteHistogram(FILE *out, const char *name, const Histogram *histogram) {
+    uint64_t count = statsLoad(&histogram->count);
+    fprintf(out, "%s.count %llu\n", name, (unsigned long long)count);
+    fprintf(out, "%s.mean %llu\n", name, (unsigned long long)(count ? statsLoad(&histogram->sum) / count : 0));
+    fprintf(out, "%s.p50 %llu\n", name, (unsigned long long)histogramPercentile(histogram, 50));
+    fprintf(out, "%s.p90 %llu\n", name, (unsigned long long)histogramPercentile(histogram, 90));
+    fprintf(out, "%s.p99 %llu\n", name, (unsigned long long)histogramPercentile(histogram, 99));
+    fprintf(out, "%s.max %llu\n", name, (unsigned long long)statsLoad(&histogram->max));
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        uint64_t bucketCount = statsLoad(&histogram->counts[i]);
+        if (bucketCount > 0) {
+            fprintf(out, "%s.bucket %llu-%llu %llu\n", name, (unsigned long long)bucketLow(i),
+                    (unsigned long long)bucketHigh(i), (unsigned long long)bucketCount);
+        }
+    }
+}
+
+uint64_t statsElapsedUs(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+// Chunks stay within a legacy frame, so peers read replies with FRAME_SIZE buffers whatever they negotiated
+int statsSendWith(int sock, const char *text, size_t length, int (*sendFrame)(int, const uint8_t *, size_t)) {
+    uint8_t buffer[FRAME_SIZE];
+    unsigned int options = protocolGetOptions(sock);
+    size_t offset = 0;
+
+    do {
+        size_t chunk = (length - offset < FRAME_DATA_SIZE) ? length - offset : FRAME_DATA_SIZE;
+        size_t size = buildFrameWith(buffer, 0x13, text + offset, chunk, options);
+        if (sendFrame(sock, buffer, size) < 0) {
+            return -1;
+        }
+        offset += chunk;
+    } while (offset < length);
+
+    // An empty frame ends the report (and is the whole report when there is nothing to say)
+    if (length > 0 && sendFrame(sock, buffer, buildFrameWith(buffer, 0x13, "", 0, options)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int sendBlocking(int sock, const uint8_t *buffer, size_t size) {
+    return sendFrameBuffer(sock, buffer, size) < 0 ? -1 : 0;
+}
+
+int statsSend(int sock, const char *text, size_t length) {
+    return statsSendWith(sock, text, length, sendBlocking);
+}
+
+int statsReceive(int sock, int fd) {
+    uint8_t buffer[FRAME_SIZE];
+    while (1) {
+        FrameView view;
+        if (receiveFrame(sock, buffer, sizeof(buffer), &view) != FRAME_OK || view.type != 0x13) {
+            return -1;
+        }
+        if (view.dataLength == 0) {
+            return 0;
+        }
+        if (write(fd, view.data, view.dataLength) < 0) {
+            return -1;
+        }
+    }
+}
+
+int statsQuery(int sock, int fd) {
+    uint8_t buffer[FRAME_SIZE];
+    size_t size = buildFrameWith(buffer, 0x13, "", 0, protocolGetOptions(sock));
+    if (sendFrameBuffer(sock, buffer, size) < 0) {
+        return -1;
+    }
+    return statsReceive(sock, fd);
+}
@@ -0,0 +1,57 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Runtime statistics served on request (TYPE: 0x13). A request has an empty payload; the reply is
+// "name value" text lines split over as many 0x13 frames as needed and closed by an empty 0x13 frame.
+// Counters are updated with relaxed atomics on the hot paths and only read when a report is built.
+
+// HDR-style histogram: exact buckets below 2^HISTOGRAM_SUB_BITS, then every power of two split
+// into 2^HISTOGRAM_SUB_BITS equal sub-buckets, so any recorded value is known within 1/16.
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+} Histogram;
+
+// Lock-free, safe to call from any number of threads
+void histogramRecord(Histogram *histogram, uint64_t value);
+// Upper bound of the bucket holding the given percentile (never above the largest value), 0 when empty
+uint64_t histogramPercentile(const Histogram *histogram, double percentile);
+// name.count/.mean/.p50/.p90/.p99/.max lines, then one "name.bucket low-high count" line per used bucket
+void statsWriteHistogram(FILE *out, const char *name, const Histogram *histogram);
+void statsWriteCounter(FILE *out, const char *name, uint64_t value);
+
+static inline void statsAdd(uint64_t *counter, uint64_t amount) {
+    __atomic_fetch_add(counter, amount, __ATOMIC_RELAXED);
+}
+
+static inline void statsSub(uint64_t *counter, uint64_t amount) {
+    __atomic_fetch_sub(counter, amount, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t statsLoad(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// Elapsed microseconds since a CLOCK_MONOTONIC start time
+uint64_t statsElapsedUs(const struct timespec *start);
+
+// Send a stats report as 0x13 frames with the socket's negotiated options
+int statsSend(int sock, const char *text, size_t length);
+// Same, handing each frame to sendFrame (e.g. a reactor's per-connection output queue)
+int statsSendWith(int sock, const char *text, size_t length, int (*sendFrame)(int, const uint8_t *, size_t));
+// Copy a report arriving on sock to fd; 0 once the closing frame arrived
+int statsReceive(int sock, int fd);
+// Request a report from a peer (TYPE: 0x13) and statsReceive() it
+int statsQuery(int sock, int fd);
+
+#endif
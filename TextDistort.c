@@ -0,0 +1,265 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Checksum.h"
+#include "TextDistort.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TEXT_DISTORT_X86 1
+#include <immintrin.h>
+#endif
+
+#define TEXT_BLOCK_SIZE 64
+
+static int isWordByte(uint8_t byte) {
+    return (byte >= '0' && byte <= '9') || ((byte | 0x20) >= 'a' && (byte | 0x20) <= 'z') || byte >= 0x80;
+}
+
+uint64_t wordMaskScalar(const uint8_t *block) {
+    uint64_t mask = 0;
+    for (int i = 0; i < TEXT_BLOCK_SIZE; i++) {
+        mask |= (uint64_t)isWordByte(block[i]) << i;
+    }
+    return mask;
+}
+
+#ifdef TEXT_DISTORT_X86
+// Signed-compare range test: bytes in [low, high] map to the bottom of the signed range
+#define IN_RANGE_SSE2(v, low, high) \
+    _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - (low)))), _mm_set1_epi8((char)(-128 + (high) - (low) + 1)))
+#define IN_RANGE_AVX2(v, low, high) \
+    _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + (high) - (low) + 1)), _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - (low)))))
+
+// Letters are tested case-folded (| 0x20); the sign bit marks non-ASCII bytes
+__attribute__((target("sse2")))
+uint64_t wordMaskSse2(const uint8_t *block) {
+    uint64_t mask = 0;
+    for (int i = 0; i < TEXT_BLOCK_SIZE; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(block + i));
+        __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i word = _mm_or_si128(IN_RANGE_SSE2(folded, 'a', 'z'), IN_RANGE_SSE2(v, '0', '9'));
+        word = _mm_or_si128(word, v);
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(word) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+uint64_t wordMaskAvx2(const uint8_t *block) {
+    uint64_t mask = 0;
+    for (int i = 0; i < TEXT_BLOCK_SIZE; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(block + i));
+        __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        __m256i word = _mm256_or_si256(IN_RANGE_AVX2(folded, 'a', 'z'), IN_RANGE_AVX2(v, '0', '9'));
+        word = _mm256_or_si256(word, v);
+        mask |= (uint64_t)(uint32_t)_mm256_movemask_epi8(word) << i;
+    }
+    return mask;
+}
+#else
+uint64_t wordMaskSse2(const uint8_t *block) { return wordMaskScalar(block); }
+uint64_t wordMaskAvx2(const uint8_t *block) { return wordMaskScalar(block); }
+#endif
+
+typedef uint64_t (*WordMaskFn)(const uint8_t *);
+
+static WordMaskFn wordMaskImpl = wordMaskScalar;
+static pthread_once_t dispatchOnce = PTHREAD_ONCE_INIT;
+
+static void initDispatch(void) {
+#ifdef TEXT_DISTORT_X86
+    __builtin_cpu_init();
+    wordMaskImpl = cpuHasAvx2() ? wordMaskAvx2 : wordMaskSse2;
+#endif
+}
+
+size_t distortTextReference(const uint8_t *input, size_t length, uint8_t *output, unsigned int minWordLength) {
+    size_t out = 0;
+    size_t i = 0;
+
+    while (i < length) {
+        if (!isWordByte(input[i])) {
+            output[out++] = input[i++];
+            continue;
+        }
+        size_t start = i;
+        while (i < length && isWordByte(input[i])) {
+            i++;
+        }
+        if (i - start >= minWordLength) {
+            memmove(output + out, input + start, i - start);
+            out += i - start;
+        }
+    }
+    return out;
+}
+
+// Word boundaries come from the 64-bit class masks (start = word byte after a separator,
+// end = separator after a word byte), so the loop runs once per word rather than per byte.
+// Everything between two dropped words is moved in a single memmove.
+size_t distortText(const uint8_t *input, size_t length, uint8_t *output, unsigned int minWordLength) {
+    if (minWordLength <= 1) {
+        if (output != input) {
+            memmove(output, input, length);
+        }
+        return length;
+    }
+
+    pthread_once(&dispatchOnce, initDispatch);
+
+    size_t out = 0;
+    size_t copyFrom = 0;  // Start of the input not yet moved to the output
+    size_t wordStart = 0;
+    uint64_t inWord = 0;  // Whether the previous block ended inside a word
+
+    for (size_t base = 0; base < length; base += TEXT_BLOCK_SIZE) {
+        uint64_t words;
+        if (length - base >= TEXT_BLOCK_SIZE) {
+            words = wordMaskImpl(input + base);
+        } else {
+            // Zero padding classifies as separator, which also closes a trailing word
+            uint8_t tail[TEXT_BLOCK_SIZE] = {0};
+            memcpy(tail, input + base, length - base);
+            words = wordMaskImpl(tail);
+        }
+
+        uint64_t previous = (words << 1) | inWord;
+        uint64_t starts = words & ~previous;
+        uint64_t ends = ~words & previous;
+
+        // Starts and ends alternate; consume them in order
+        while (1) {
+            if (!inWord) {
+                if (starts == 0) {
+                    break;
+                }
+                wordStart = base + __builtin_ctzll(starts);
+                starts &= starts - 1;
+                inWord = 1;
+            } else {
+                if (ends == 0) {
+                    break;
+                }
+                size_t wordEnd = base + __builtin_ctzll(ends);
+                ends &= ends - 1;
+                inWord = 0;
+                if (wordEnd - wordStart < minWordLength) {
+                    memmove(output + out, input + copyFrom, wordStart - copyFrom);
+                    out += wordStart - copyFrom;
+                    copyFrom = wordEnd;
+                }
+            }
+        }
+    }
+
+    // A word running to the end of the last full block ends with the input
+    if (inWord && length - wordStart < minWordLength) {
+        memmove(output + out, input + copyFrom, wordStart - copyFrom);
+        out += wordStart - copyFrom;
+        copyFrom = length;
+    }
+    memmove(output + out, input + copyFrom, length - copyFrom);
+    return out + (length - copyFrom);
+}
+
+// Length of the word run at the start of input
+static size_t leadingWordLength(const uint8_t *input, size_t length) {
+    size_t i = 0;
+    for (; i + TEXT_BLOCK_SIZE <= length; i += TEXT_BLOCK_SIZE) {
+        uint64_t separators = ~wordMaskImpl(input + i);
+        if (separators != 0) {
+            return i + __builtin_ctzll(separators);
+        }
+    }
+    while (i < length && isWordByte(input[i])) {
+        i++;
+    }
+    return i;
+}
+
+// Start of the word run ending input (length when input ends with a separator), not before floor
+static size_t trailingWordStart(const uint8_t *input, size_t length, size_t floor) {
+    size_t i = length;
+    for (; i >= floor + TEXT_BLOCK_SIZE; i -= TEXT_BLOCK_SIZE) {
+        uint64_t separators = ~wordMaskImpl(input + i - TEXT_BLOCK_SIZE);
+        if (separators != 0) {
+            return i - TEXT_BLOCK_SIZE + (64 - __builtin_clzll(separators));
+        }
+    }
+    while (i > floor && isWordByte(input[i - 1])) {
+        i--;
+    }
+    return i;
+}
+
+int textStreamInit(TextDistortStream *stream, unsigned int minWordLength) {
+    stream->minWordLength = minWordLength;
+    stream->pendingLength = 0;
+    stream->keepingWord = 0;
+    stream->pending = malloc(minWordLength > 0 ? minWordLength : 1);
+    return (stream->pending == NULL) ? -1 : 0;
+}
+
+void textStreamDestroy(TextDistortStream *stream) {
+    free(stream->pending);
+    stream->pending = NULL;
+}
+
+size_t textStreamDistort(TextDistortStream *stream, const uint8_t *input, size_t length, uint8_t *output, int final) {
+    unsigned int minWordLength = stream->minWordLength;
+    if (minWordLength <= 1) {
+        memcpy(output, input, length);
+        return length;
+    }
+
+    pthread_once(&dispatchOnce, initDispatch);
+
+    size_t out = 0;
+    size_t prefix = 0;  // Bytes at the start that finish the word cut by the previous chunk
+
+    if (stream->keepingWord) {
+        prefix = leadingWordLength(input, length);
+        memcpy(output, input, prefix);
+        out = prefix;
+        stream->keepingWord = (prefix == length);
+    } else if (stream->pendingLength > 0) {
+        prefix = leadingWordLength(input, length);
+        size_t wordLength = stream->pendingLength + prefix;
+        if (wordLength >= minWordLength) {
+            memcpy(output, stream->pending, stream->pendingLength);
+            memcpy(output + stream->pendingLength, input, prefix);
+            out = wordLength;
+            stream->keepingWord = (prefix == length);
+            stream->pendingLength = 0;
+        } else if (prefix == length && !final) {
+            // Still too short to decide
+            memcpy(stream->pending + stream->pendingLength, input, prefix);
+            stream->pendingLength = wordLength;
+            return 0;
+        } else {
+            stream->pendingLength = 0; // Complete and short: dropped
+        }
+    }
+
+    if (prefix < length) {
+        // Separator-aligned middle goes through the block kernel; the cut word at the end waits
+        size_t tailStart = final ? length : trailingWordStart(input, length, prefix);
+        out += distortText(input + prefix, tailStart - prefix, output + out, minWordLength);
+
+        size_t tailLength = length - tailStart;
+        if (tailLength >= minWordLength) {
+            memcpy(output + out, input + tailStart, tailLength);
+            out += tailLength;
+            stream->keepingWord = 1;
+        } else if (tailLength > 0) {
+            memcpy(stream->pending, input + tailStart, tailLength);
+            stream->pendingLength = tailLength;
+        }
+    }
+
+    if (final) {
+        stream->keepingWord = 0;
+        stream->pendingLength = 0;
+    }
+    return out;
+}
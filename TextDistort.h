@@ -0,0 +1,35 @@
+#ifndef TEXT_DISTORT_H
+#define TEXT_DISTORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Text distortion: words (runs of ASCII letters/digits and non-ASCII bytes) shorter than
+// minWordLength bytes are removed; separators (whitespace, punctuation) are always kept.
+// output may equal input (in-place); returns the distorted length, never more than length.
+size_t distortText(const uint8_t *input, size_t length, uint8_t *output, unsigned int minWordLength);
+
+// Streaming form: chunks may cut words anywhere. Only the start of a cut word shorter than
+// minWordLength is carried over; longer ones are passed through as they arrive, so the state
+// never holds more than minWordLength - 1 bytes whatever the input size.
+typedef struct {
+    unsigned int minWordLength;
+    uint8_t *pending;       // Start of a word cut by the previous chunk boundary
+    size_t pendingLength;
+    int keepingWord;        // The cut word already reached minWordLength
+} TextDistortStream;
+
+int textStreamInit(TextDistortStream *stream, unsigned int minWordLength);
+void textStreamDestroy(TextDistortStream *stream);
+// output needs room for length + minWordLength bytes; final marks the last chunk (may be empty)
+size_t textStreamDistort(TextDistortStream *stream, const uint8_t *input, size_t length, uint8_t *output, int final);
+
+// Per-character reference used to validate the vectorized path
+size_t distortTextReference(const uint8_t *input, size_t length, uint8_t *output, unsigned int minWordLength);
+
+// Classification kernels: bit i is set when block[i] (of 64) is a word byte
+uint64_t wordMaskScalar(const uint8_t *block);
+uint64_t wordMaskSse2(const uint8_t *block);
+uint64_t wordMaskAvx2(const uint8_t *block);
+
+#endif
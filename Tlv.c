@@ -0,0 +1,151 @@
+#include <string.h>
+#include "Tlv.h"
+
+void tlvWriterInit(TlvWriter *writer, uint8_t *buffer, size_t capacity) {
+    writer->buffer = buffer;
+    writer->capacity = capacity;
+    writer->length = 0;
+    writer->overflow = 0;
+    if (capacity > 0) {
+        buffer[writer->length++] = TLV_MARKER;
+    } else {
+        writer->overflow = 1;
+    }
+}
+
+void tlvPutBytes(TlvWriter *writer, uint8_t tag, const void *value, size_t length) {
+    if (length > 0xFF || writer->length + 2 + length > writer->capacity) {
+        writer->overflow = 1;
+        return;
+    }
+    writer->buffer[writer->length++] = tag;
+    writer->buffer[writer->length++] = (uint8_t)length;
+    memcpy(writer->buffer + writer->length, value, length);
+    writer->length += length;
+}
+
+void tlvPutUnsigned(TlvWriter *writer, uint8_t tag, uint64_t value, size_t width) {
+    uint8_t bytes[8];
+    for (size_t i = 0; i < width; i++) {
+        bytes[i] = (value >> (8 * i)) & 0xFF;
+    }
+    tlvPutBytes(writer, tag, bytes, width);
+}
+
+void tlvPutString(TlvWriter *writer, uint8_t tag, const char *value) {
+    tlvPutBytes(writer, tag, value, strlen(value));
+}
+
+int isTlvPayload(const uint8_t *data, size_t length) {
+    return length > 0 && data[0] == TLV_MARKER;
+}
+
+int tlvReaderInit(TlvReader *reader, const uint8_t *data, size_t length) {
+    if (!isTlvPayload(data, length)) {
+        return -1;
+    }
+    reader->data = data;
+    reader->length = length;
+    reader->offset = 1;
+    return 0;
+}
+
+// Next element; returns 1 while elements remain, 0 at the end, -1 on a truncated element
+int tlvNext(TlvReader *reader, uint8_t *tag, const uint8_t **value, uint8_t *length) {
+    if (reader->offset == reader->length) {
+        return 0;
+    }
+    if (reader->offset + 2 > reader->length) {
+        return -1;
+    }
+    *tag = reader->data[reader->offset];
+    *length = reader->data[reader->offset + 1];
+    if (reader->offset + 2 + *length > reader->length) {
+        return -1;
+    }
+    *value = reader->data + reader->offset + 2;
+    reader->offset += 2 + *length;
+    return 1;
+}
+
+static uint64_t readUnsigned(const uint8_t *value, size_t width) {
+    uint64_t result = 0;
+    for (size_t i = 0; i < width; i++) {
+        result |= (uint64_t)value[i] << (8 * i);
+    }
+    return result;
+}
+
+// Encoders per field kind
+#define TLV_ENCODE_STR(tag, name, size) tlvPutString(&writer, tag, message->name);
+#define TLV_ENCODE_RAW(tag, name, size) tlvPutBytes(&writer, tag, message->name, size);
+#define TLV_ENCODE_OPT_RAW(tag, name, size) TLV_ENCODE_RAW(tag, name, size)
+#define TLV_ENCODE_U8(tag, name, size) tlvPutUnsigned(&writer, tag, message->name, 1);
+#define TLV_ENCODE_U16(tag, name, size) tlvPutUnsigned(&writer, tag, message->name, 2);
+#define TLV_ENCODE_U32(tag, name, size) tlvPutUnsigned(&writer, tag, message->name, 4);
+#define TLV_ENCODE_U64(tag, name, size) tlvPutUnsigned(&writer, tag, message->name, 8);
+#define TLV_ENCODE(tag, kind, name, size) TLV_ENCODE_##kind(tag, name, size)
+
+// Decoders per field kind: bounded copies, wrong sizes reject the payload
+#define TLV_DECODE_STR(name, size) \
+    if (length >= size) return -1; \
+    memcpy(message->name, value, length); \
+    message->name[length] = '\0';
+#define TLV_DECODE_RAW(name, size) \
+    if (length != size) return -1; \
+    memcpy(message->name, value, size);
+#define TLV_DECODE_OPT_RAW(name, size) TLV_DECODE_RAW(name, size)
+#define TLV_DECODE_FIXED(name, width) \
+    if (length != width) return -1; \
+    message->name = readUnsigned(value, width);
+#define TLV_DECODE_U8(name, size) TLV_DECODE_FIXED(name, 1)
+#define TLV_DECODE_U16(name, size) TLV_DECODE_FIXED(name, 2)
+#define TLV_DECODE_U32(name, size) TLV_DECODE_FIXED(name, 4)
+#define TLV_DECODE_U64(name, size) TLV_DECODE_FIXED(name, 8)
+#define TLV_DECODE(tag, kind, name, size) \
+    case tag: \
+        TLV_DECODE_##kind(name, size) \
+        seen |= 1u << tag; \
+        break;
+// Tags a decoded payload must contain
+#define TLV_REQUIRED_STR(tag) | (1u << tag)
+#define TLV_REQUIRED_RAW(tag) | (1u << tag)
+#define TLV_REQUIRED_OPT_RAW(tag)
+#define TLV_REQUIRED_U8(tag) | (1u << tag)
+#define TLV_REQUIRED_U16(tag) | (1u << tag)
+#define TLV_REQUIRED_U32(tag) | (1u << tag)
+#define TLV_REQUIRED_U64(tag) | (1u << tag)
+#define TLV_REQUIRED(tag, kind, name, size) TLV_REQUIRED_##kind(tag)
+
+#define TLV_DEFINE_MESSAGE(Name, FIELDS) \
+    size_t encode##Name(const Name *message, uint8_t *payload, size_t capacity) { \
+        TlvWriter writer; \
+        tlvWriterInit(&writer, payload, capacity); \
+        FIELDS(TLV_ENCODE) \
+        return writer.overflow ? 0 : writer.length; \
+    } \
+    int decode##Name(const uint8_t *payload, size_t payloadLength, Name *message) { \
+        TlvReader reader; \
+        uint8_t tag, length; \
+        const uint8_t *value; \
+        uint32_t seen = 0; \
+        int result; \
+        memset(message, 0, sizeof(*message)); \
+        if (tlvReaderInit(&reader, payload, payloadLength) < 0) return -1; \
+        while ((result = tlvNext(&reader, &tag, &value, &length)) > 0) { \
+            switch (tag) { \
+                FIELDS(TLV_DECODE) \
+                default: /* Unknown tags are skipped for forward compatibility */ \
+                    break; \
+            } \
+        } \
+        if (result < 0) return -1; \
+        return ((seen & (0 FIELDS(TLV_REQUIRED))) == (0 FIELDS(TLV_REQUIRED))) ? 0 : -1; \
+    }
+
+TLV_DEFINE_MESSAGE(DistortRequest, DISTORT_REQUEST_FIELDS)
+TLV_DEFINE_MESSAGE(DistortRedirect, DISTORT_REDIRECT_FIELDS)
+TLV_DEFINE_MESSAGE(JobFinished, JOB_FINISHED_FIELDS)
+TLV_DEFINE_MESSAGE(Heartbeat, HEARTBEAT_FIELDS)
+TLV_DEFINE_MESSAGE(JobRequest, JOB_REQUEST_FIELDS)
+TLV_DEFINE_MESSAGE(TransferEnd, TRANSFER_END_FIELDS)
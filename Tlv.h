@@ -0,0 +1,98 @@
+#ifndef TLV_H
+#define TLV_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Md5.h"
+
+// Binary payloads (PROTO_CAP_TLV): a TLV_MARKER byte followed by elements
+// tag (1) | length (1) | value. Integers are little-endian and fixed width,
+// strings are length-prefixed without terminator, MD5 sums are 16 raw bytes.
+// A text payload never starts with a NUL byte, so both encodings can be told apart.
+#define TLV_MARKER 0x00
+
+typedef struct {
+    uint8_t *buffer;
+    size_t capacity;
+    size_t length;
+    int overflow; // Set when an element did not fit
+} TlvWriter;
+
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    size_t offset;
+} TlvReader;
+
+void tlvWriterInit(TlvWriter *writer, uint8_t *buffer, size_t capacity);
+void tlvPutBytes(TlvWriter *writer, uint8_t tag, const void *value, size_t length);
+void tlvPutUnsigned(TlvWriter *writer, uint8_t tag, uint64_t value, size_t width);
+void tlvPutString(TlvWriter *writer, uint8_t tag, const char *value);
+
+int tlvReaderInit(TlvReader *reader, const uint8_t *data, size_t length);
+int tlvNext(TlvReader *reader, uint8_t *tag, const uint8_t **value, uint8_t *length);
+int isTlvPayload(const uint8_t *data, size_t length);
+
+// Field lists per frame payload: F(tag, kind, name, size).
+// kind is STR (char[size], NUL-terminated after decode), U8/U16/U32/U64 or RAW (uint8_t[size], exact length).
+// Every field is required on decode except OPT_RAW, a RAW field added later that older peers omit (left zeroed).
+#define DISTORT_REQUEST_FIELDS(F) /* 0x10 Fleck -> Gotham */ \
+    F(1, STR, mediaType, 16) \
+    F(2, STR, fileName, 128)
+
+#define DISTORT_REDIRECT_FIELDS(F) /* 0x10 Gotham -> Fleck */ \
+    F(1, U8, status, 0) \
+    F(2, STR, ip, 128) \
+    F(3, U16, port, 0) \
+    F(4, U8, workerCapabilities, 0)
+
+#define JOB_FINISHED_FIELDS(F) /* 0x11 Fleck -> Gotham */ \
+    F(1, STR, ip, 128) \
+    F(2, U16, port, 0)
+
+#define HEARTBEAT_FIELDS(F) /* 0x12 worker -> Gotham */ \
+    F(1, U32, queueDepth, 0) \
+    F(2, U32, activeJobs, 0) \
+    F(3, U32, p99Ms, 0)
+
+#define JOB_REQUEST_FIELDS(F) /* 0x03 Fleck -> worker */ \
+    F(1, STR, username, 128) \
+    F(2, STR, fileName, 128) \
+    F(3, U64, fileSize, 0) \
+    F(4, RAW, md5, MD5_SIZE) \
+    F(5, U32, factor, 0) \
+    F(6, U8, capabilities, 0) \
+    F(7, U16, window, 0)
+
+#define TRANSFER_END_FIELDS(F) /* 0x06 end of a data stream, with its MD5 when known */ \
+    F(1, U64, totalBytes, 0) \
+    F(2, OPT_RAW, md5, MD5_SIZE)
+
+// Redirect status values
+#define REDIRECT_OK 0
+#define REDIRECT_DISTORT_KO 1
+#define REDIRECT_MEDIA_KO 2
+
+#define TLV_MEMBER_STR(name, size) char name[size];
+#define TLV_MEMBER_RAW(name, size) uint8_t name[size];
+#define TLV_MEMBER_OPT_RAW(name, size) uint8_t name[size];
+#define TLV_MEMBER_U8(name, size) uint8_t name;
+#define TLV_MEMBER_U16(name, size) uint16_t name;
+#define TLV_MEMBER_U32(name, size) uint32_t name;
+#define TLV_MEMBER_U64(name, size) uint64_t name;
+#define TLV_MEMBER(tag, kind, name, size) TLV_MEMBER_##kind(name, size)
+
+// Declares the payload struct and its encode/decode helpers; Tlv.c defines them with TLV_DEFINE_MESSAGE
+#define TLV_DECLARE_MESSAGE(Name, FIELDS) \
+    typedef struct { FIELDS(TLV_MEMBER) } Name; \
+    size_t encode##Name(const Name *message, uint8_t *payload, size_t capacity); \
+    int decode##Name(const uint8_t *payload, size_t length, Name *message);
+
+TLV_DECLARE_MESSAGE(DistortRequest, DISTORT_REQUEST_FIELDS)
+TLV_DECLARE_MESSAGE(DistortRedirect, DISTORT_REDIRECT_FIELDS)
+TLV_DECLARE_MESSAGE(JobFinished, JOB_FINISHED_FIELDS)
+TLV_DECLARE_MESSAGE(Heartbeat, HEARTBEAT_FIELDS)
+TLV_DECLARE_MESSAGE(JobRequest, JOB_REQUEST_FIELDS)
+TLV_DECLARE_MESSAGE(TransferEnd, TRANSFER_END_FIELDS)
+
+#endif
@@ -0,0 +1,470 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Protocol.h"
+#include "Transfer.h"
+
+// Process-wide byte counters, updated atomically by concurrent transfers
+static uint64_t zeroCopyBytes = 0;
+static uint64_t copiedBytes = 0;
+static uint64_t uncheckedBytes = 0;
+
+void transferGetCounters(TransferCounters *counters) {
+    counters->zeroCopyBytes = __atomic_load_n(&zeroCopyBytes, __ATOMIC_RELAXED);
+    counters->copiedBytes = __atomic_load_n(&copiedBytes, __ATOMIC_RELAXED);
+    counters->uncheckedBytes = __atomic_load_n(&uncheckedBytes, __ATOMIC_RELAXED);
+}
+
+size_t transferBufferSize(unsigned int options) {
+    return (options & PROTO_CAP_LARGE_FRAMES) ? LARGE_FRAME_MAX_SIZE : FRAME_SIZE;
+}
+
+static unsigned int clampWindow(unsigned int window) {
+    if (window < 1) {
+        return 1;
+    }
+    return (window > TRANSFER_MAX_WINDOW) ? TRANSFER_MAX_WINDOW : window;
+}
+
+static int readFully(int fd, uint8_t *data, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t count = read(fd, data + total, length - total);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return -1; // The file shrank or could not be read
+        }
+        total += count;
+    }
+    return 0;
+}
+
+static int serviceOnce(TransferSession *session);
+
+// The session's socket is non-blocking: when the peer is not taking our bytes, wait for room while
+// servicing what it sends, so both ends never block writing at once (each would wait for the other
+// to read). Returns once the socket is writable again.
+static int waitWritable(TransferSession *session) {
+    struct pollfd pending = { .fd = session->sock, .events = POLLIN | POLLOUT };
+    while (1) {
+        if (poll(&pending, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (pending.revents & POLLOUT) {
+            return 0;
+        }
+        if (!(pending.revents & POLLIN) || serviceOnce(session) < 0) {
+            return -1;
+        }
+    }
+}
+
+static int sendFully(TransferSession *session, const uint8_t *data, size_t length, int flags) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t count = send(session->sock, data + total, length - total, flags);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (waitWritable(session) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (count <= 0) {
+            return -1;
+        }
+        total += count;
+    }
+    return 0;
+}
+
+// Frames go out whole: peer frames serviced in the middle of one may not write, their ACKs wait until it is done
+static void beginFrame(TransferSession *session) {
+    session->writing = 1;
+}
+
+static int endFrame(TransferSession *session, int result) {
+    session->writing = 0;
+    if (result == 0 && session->ackDeferred) {
+        session->ackDeferred = 0;
+        return transferFlushAcks(session);
+    }
+    return result;
+}
+
+static int sendFrame(TransferSession *session, const uint8_t *buffer, size_t size) {
+    beginFrame(session);
+    return endFrame(session, sendFully(session, buffer, size, 0));
+}
+
+// One unchecked large data frame whose body never enters user space
+static int sendFrameZeroCopy(TransferSession *session, int fileFd, off_t *offset, size_t chunk) {
+    uint8_t header[FRAME_HEADER_SIZE] = { 0x05 | FRAME_FLAG_UNCHECKED, chunk & 0xFF, (chunk >> 8) & 0xFF };
+    uint8_t trailer[LARGE_FRAME_CHECKSUM_SIZE] = {0};
+
+    beginFrame(session);
+    if (sendFully(session, header, sizeof(header), MSG_MORE) < 0) {
+        return endFrame(session, -1);
+    }
+    size_t total = 0;
+    while (total < chunk) {
+        ssize_t count = sendfile(session->sock, fileFd, offset, chunk - total);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (waitWritable(session) < 0) {
+                return endFrame(session, -1);
+            }
+            continue;
+        }
+        if (count <= 0) {
+            return endFrame(session, -1);
+        }
+        total += count;
+    }
+    return endFrame(session, sendFully(session, trailer, sizeof(trailer), 0));
+}
+
+int transferSessionInit(TransferSession *session, int sock, unsigned int window) {
+    memset(session, 0, sizeof(*session));
+    session->sock = sock;
+    session->options = protocolGetOptions(sock);
+    session->window = clampWindow(window);
+    session->ackInterval = (session->window / 2 > 0) ? session->window / 2 : 1;
+    session->sendBuffer = malloc(transferBufferSize(session->options));
+    session->receiveBuffer = malloc(transferBufferSize(session->options));
+    session->socketFlags = fcntl(sock, F_GETFL, 0);
+    if (session->sendBuffer == NULL || session->receiveBuffer == NULL || session->socketFlags < 0 ||
+            fcntl(sock, F_SETFL, session->socketFlags | O_NONBLOCK) < 0) {
+        transferSessionDestroy(session);
+        return -1;
+    }
+    return 0;
+}
+
+void transferSessionDestroy(TransferSession *session) {
+    if (session->socketFlags >= 0) {
+        fcntl(session->sock, F_SETFL, session->socketFlags);
+        session->socketFlags = -1;
+    }
+    if (session->stash != NULL) {
+        for (unsigned int i = 0; i < session->window; i++) {
+            free(session->stash[i]);
+        }
+    }
+    free(session->stash);
+    free(session->stashViews);
+    free(session->sendBuffer);
+    free(session->receiveBuffer);
+    session->stash = NULL;
+    session->stashViews = NULL;
+    session->sendBuffer = NULL;
+    session->receiveBuffer = NULL;
+}
+
+// Keep a peer frame for a later transferReceive(); slots are allocated on first use
+static int stashFrame(TransferSession *session, const FrameView *view) {
+    if (session->stash == NULL) {
+        session->stash = calloc(session->window, sizeof(uint8_t *));
+        session->stashViews = calloc(session->window, sizeof(FrameView));
+        if (session->stash == NULL || session->stashViews == NULL) {
+            return -1;
+        }
+    }
+    if (session->stashCount == session->window) {
+        return -1; // The peer ignored the window
+    }
+
+    unsigned int slot = (session->stashHead + session->stashCount) % session->window;
+    if (session->stash[slot] == NULL) {
+        session->stash[slot] = malloc(transferBufferSize(session->options));
+        if (session->stash[slot] == NULL) {
+            return -1;
+        }
+    }
+    memcpy(session->stash[slot], view->data, view->dataLength);
+    session->stashViews[slot] = *view;
+    session->stashViews[slot].data = session->stash[slot];
+    session->stashCount++;
+    return 0;
+}
+
+// Read one frame; ACKs are applied here, anything else is returned to the caller
+static int readFrame(TransferSession *session, uint8_t *buffer, FrameView *view, int *isAck) {
+    if (receiveFrame(session->sock, buffer, transferBufferSize(session->options), view) != FRAME_OK) {
+        return -1;
+    }
+    *isAck = (view->type == 0x0A);
+    if (!*isAck) {
+        if (view->unchecked) {
+            __atomic_fetch_add(&uncheckedBytes, view->dataLength, __ATOMIC_RELAXED);
+        }
+        return 0;
+    }
+
+    char text[16];
+    if (view->dataLength == 0 || view->dataLength >= sizeof(text)) {
+        return -1;
+    }
+    memcpy(text, view->data, view->dataLength);
+    text[view->dataLength] = '\0';
+
+    uint32_t frames = strtoul(text, NULL, 10);
+    if (frames > session->sent) {
+        return -1;
+    }
+    if (frames > session->acked) {
+        session->acked = frames;
+    }
+    return 0;
+}
+
+// Service the socket once while waiting: apply an ACK, hand a frame to the handler or park it
+static int serviceOnce(TransferSession *session) {
+    FrameView view;
+    int isAck;
+
+    if (readFrame(session, session->receiveBuffer, &view, &isAck) < 0) {
+        return -1;
+    }
+    if (isAck) {
+        return 0;
+    }
+    int result = (session->onFrame != NULL) ? session->onFrame(session->context, &view) : TRANSFER_FRAME_PARK;
+    return (result == TRANSFER_FRAME_PARK) ? stashFrame(session, &view) : result;
+}
+
+static int waitForWindow(TransferSession *session) {
+    while (session->sent - session->acked >= session->window) {
+        if (serviceOnce(session) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int transferSend(TransferSession *session, const uint8_t *data, size_t length) {
+    size_t capacity = frameDataCapacity(session->options);
+
+    while (length > 0) {
+        if (waitForWindow(session) < 0) {
+            return -1;
+        }
+        size_t chunk = (length < capacity) ? length : capacity;
+        memcpy(framePayload(session->sendBuffer), data, chunk);
+        if (session->sendHash != NULL) {
+            md5Update(session->sendHash, data, chunk);
+        }
+        size_t size = finishFrameWith(session->sendBuffer, 0x05, chunk, session->options);
+        if (sendFrame(session, session->sendBuffer, size) < 0) {
+            return -1;
+        }
+        session->sent++;
+        if (session->sentBytes != NULL) {
+            __atomic_fetch_add(session->sentBytes, chunk, __ATOMIC_RELAXED);
+        }
+        data += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+// Stream fileSize bytes from fileFd's current position
+int transferSendFile(TransferSession *session, int fileFd, uint64_t fileSize) {
+    size_t capacity = frameDataCapacity(session->options);
+
+    // sendfile() needs a regular file and the large framing's checksum-free frames, which are only
+    // allowed when the upload ends with its MD5 (PROTO_CAP_MD5) so the body is still verified
+    const unsigned int zeroCopyCaps = PROTO_CAP_LARGE_FRAMES | PROTO_CAP_MD5;
+    struct stat fileStat;
+    int zeroCopy = (session->options & zeroCopyCaps) == zeroCopyCaps && fstat(fileFd, &fileStat) == 0 &&
+                   S_ISREG(fileStat.st_mode);
+    off_t offset = zeroCopy ? lseek(fileFd, 0, SEEK_CUR) : 0;
+    if (offset < 0) {
+        zeroCopy = 0;
+    }
+
+    // Hashing a zero-copy upload reads the file through a mapping just ahead of sendfile(),
+    // so each chunk is fetched from disk once and is hot in the page cache when it is sent
+    uint8_t *mapping = NULL;
+    size_t mappingLength = 0;
+    off_t mappingStart = offset & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+    if (zeroCopy && session->sendHash != NULL && fileSize > 0) {
+        mappingLength = offset - mappingStart + fileSize;
+        mapping = mmap(NULL, mappingLength, PROT_READ, MAP_SHARED, fileFd, mappingStart);
+        if (mapping == MAP_FAILED) {
+            mapping = NULL;
+            zeroCopy = 0;
+        }
+    }
+
+    int result = 0;
+    while (fileSize > 0) {
+        if (waitForWindow(session) < 0) {
+            result = -1;
+            break;
+        }
+
+        size_t chunk = (fileSize < capacity) ? fileSize : capacity;
+        if (zeroCopy) {
+            if (mapping != NULL) {
+                md5Update(session->sendHash, mapping + (offset - mappingStart), chunk);
+            }
+            if (sendFrameZeroCopy(session, fileFd, &offset, chunk) < 0) {
+                result = -1;
+                break;
+            }
+            __atomic_fetch_add(&zeroCopyBytes, chunk, __ATOMIC_RELAXED);
+        } else {
+            if (readFully(fileFd, framePayload(session->sendBuffer), chunk) < 0) {
+                result = -1;
+                break;
+            }
+            if (session->sendHash != NULL) {
+                md5Update(session->sendHash, framePayload(session->sendBuffer), chunk);
+            }
+            size_t size = finishFrameWith(session->sendBuffer, 0x05, chunk, session->options);
+            if (sendFrame(session, session->sendBuffer, size) < 0) {
+                result = -1;
+                break;
+            }
+            __atomic_fetch_add(&copiedBytes, chunk, __ATOMIC_RELAXED);
+        }
+        session->sent++;
+        if (session->sentBytes != NULL) {
+            __atomic_fetch_add(session->sentBytes, chunk, __ATOMIC_RELAXED);
+        }
+        fileSize -= chunk;
+    }
+
+    if (mapping != NULL) {
+        munmap(mapping, mappingLength);
+    }
+    return result;
+}
+
+// Close a stream of unknown length (TYPE: 0x06)
+int transferSendEnd(TransferSession *session, uint64_t totalBytes, const uint8_t *md5) {
+    uint8_t buffer[FRAME_SIZE];
+    size_t length;
+
+    if (session->options & PROTO_CAP_TLV) {
+        TransferEnd end = { .totalBytes = totalBytes };
+        if (md5 != NULL) {
+            memcpy(end.md5, md5, MD5_SIZE);
+        }
+        length = encodeTransferEnd(&end, framePayload(buffer), FRAME_DATA_SIZE);
+    } else if (md5 != NULL) {
+        // Older peers read the count with strtoull() and stop at the '&'
+        char hex[MD5_HEX_SIZE];
+        md5ToHex(md5, hex);
+        length = formatPayload(buffer, "%llu&%s", (unsigned long long)totalBytes, hex);
+    } else {
+        length = formatPayload(buffer, "%llu", (unsigned long long)totalBytes);
+    }
+    size_t size = finishFrameWith(buffer, 0x06, length, session->options);
+    return sendFrame(session, buffer, size);
+}
+
+int parseTransferEnd(const FrameView *view, uint64_t *totalBytes, uint8_t *md5) {
+    uint8_t ignored[MD5_SIZE];
+    if (md5 == NULL) {
+        md5 = ignored;
+    }
+    memset(md5, 0, MD5_SIZE);
+
+    if (isTlvPayload(view->data, view->dataLength)) {
+        TransferEnd end;
+        if (decodeTransferEnd(view->data, view->dataLength, &end) < 0) {
+            return -1;
+        }
+        *totalBytes = end.totalBytes;
+        memcpy(md5, end.md5, MD5_SIZE);
+        return 0;
+    }
+
+    char text[64];
+    if (view->dataLength == 0 || view->dataLength >= sizeof(text)) {
+        return -1;
+    }
+    memcpy(text, view->data, view->dataLength);
+    text[view->dataLength] = '\0';
+    char *rest;
+    *totalBytes = strtoull(text, &rest, 10);
+    if (*rest == '&' && md5FromHex(rest + 1, md5) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Wait until the peer acknowledged every data frame we sent
+int transferFlush(TransferSession *session) {
+    while (session->acked < session->sent) {
+        if (serviceOnce(session) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int transferReceive(TransferSession *session, uint8_t *buffer, FrameView *view) {
+    if (session->stashCount > 0) {
+        const FrameView *parked = &session->stashViews[session->stashHead];
+        *view = *parked;
+        memcpy(framePayload(buffer), parked->data, parked->dataLength);
+        view->data = framePayload(buffer);
+        session->stashHead = (session->stashHead + 1) % session->window;
+        session->stashCount--;
+        return 0;
+    }
+
+    int isAck = 1;
+    while (isAck) {
+        if (readFrame(session, buffer, view, &isAck) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int transferPump(TransferSession *session) {
+    return serviceOnce(session);
+}
+
+// Send a cumulative ACK covering everything consumed so far (once the frame being written is out)
+int transferFlushAcks(TransferSession *session) {
+    if (session->writing) {
+        session->ackDeferred = 1;
+        return 0;
+    }
+    if (session->consumed == session->reported) {
+        return 0;
+    }
+
+    uint8_t buffer[FRAME_SIZE];
+    uint32_t consumed = session->consumed;
+    size_t size = finishFrameWith(buffer, 0x0A, formatPayload(buffer, "%u", consumed), session->options);
+    session->reported = consumed;
+    return sendFrame(session, buffer, size);
+}
+
+// Mark one peer data frame as done; ACK every ackInterval frames or when flushing
+int transferConsumed(TransferSession *session, int flush) {
+    session->consumed++;
+    if (!flush && session->consumed - session->reported < session->ackInterval) {
+        return 0;
+    }
+    return transferFlushAcks(session);
+}
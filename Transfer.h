@@ -0,0 +1,82 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <stdint.h>
+#include "Protocol.h"
+#include "Md5.h"
+
+// Data streams travel as data frames (TYPE: 0x05) sized to the negotiated framing.
+// The receiver answers with cumulative ACKs (TYPE: 0x0A, payload = frames consumed so far)
+// every window/2 frames and when flushed; the sender keeps at most `window` frames unacknowledged.
+// A stream of unknown length ends with TYPE: 0x06 carrying the total byte count and its MD5
+// (TLV field, or "&<hex>" after the count in text); an upload ends the same way under PROTO_CAP_MD5.
+// Both directions may run at once on the same socket, each with its own window.
+#define TRANSFER_DEFAULT_WINDOW 32
+#define TRANSFER_MAX_WINDOW 1024
+
+// Large-frame uploads of regular files go out with sendfile() when PROTO_CAP_MD5 was negotiated too:
+// the header is sent with MSG_MORE, the body straight from the page cache and the frame is flagged
+// FRAME_FLAG_UNCHECKED. Without MD5, legacy framing or a non-file source the body is copied
+// through a frame buffer and checksummed.
+typedef struct {
+    uint64_t zeroCopyBytes;  // File bytes handed to sendfile()
+    uint64_t copiedBytes;    // File bytes copied into frame buffers
+    uint64_t uncheckedBytes; // Data bytes received without a frame checksum (left to the end-to-end MD5)
+} TransferCounters;
+
+void transferGetCounters(TransferCounters *counters);
+
+// Called for every peer frame other than an ACK that arrives while the session waits for ACKs or for room to write.
+// Returns 0, -1 to fail the session, or TRANSFER_FRAME_PARK to leave the frame for transferReceive().
+#define TRANSFER_FRAME_PARK 1
+typedef int (*TransferFrameHandler)(void *context, const FrameView *view);
+
+// One job's transfer state on a socket; single-threaded, no locking. The socket is non-blocking while
+// the session lives: a write that would block services the peer's frames until there is room again.
+typedef struct {
+    int sock;
+    int socketFlags;           // File status flags to restore when the session ends
+    int writing;               // A frame is partly written; ACKs wait for it
+    int ackDeferred;           // ...and one was asked for meanwhile
+    unsigned int options;      // Socket options when the session started
+    unsigned int window;
+    unsigned int ackInterval;
+    uint32_t sent;             // Data frames we sent
+    uint32_t acked;            // ...of which the peer has acknowledged
+    uint32_t consumed;         // Peer data frames we are done with
+    uint32_t reported;         // Consumed count in our last ACK
+    uint8_t *sendBuffer;
+    uint8_t *receiveBuffer;
+    // Peer frames read while waiting are parked here (at most `window`) unless a handler takes them
+    uint8_t **stash;
+    FrameView *stashViews;
+    unsigned int stashHead;
+    unsigned int stashCount;
+    TransferFrameHandler onFrame;
+    void *context;
+    Md5Context *sendHash;      // When set, every data byte sent is folded into it
+    uint64_t *sentBytes;       // When set, data bytes sent are added to it atomically (progress readers)
+} TransferSession;
+
+int transferSessionInit(TransferSession *session, int sock, unsigned int window);
+void transferSessionDestroy(TransferSession *session);
+
+// Sending side; all of them keep servicing the peer's frames while the window is full
+int transferSend(TransferSession *session, const uint8_t *data, size_t length);
+int transferSendFile(TransferSession *session, int fileFd, uint64_t fileSize);
+int transferSendEnd(TransferSession *session, uint64_t totalBytes, const uint8_t *md5);
+int transferFlush(TransferSession *session);
+
+// Receiving side: next non-ACK frame (parked ones first) into a transferBufferSize() buffer,
+// or dispatch one frame to the handler. Consumed data frames are acknowledged in batches.
+int transferReceive(TransferSession *session, uint8_t *buffer, FrameView *view);
+int transferPump(TransferSession *session);
+int transferConsumed(TransferSession *session, int flush);
+int transferFlushAcks(TransferSession *session);
+// md5 (MD5_SIZE bytes, may be NULL) is left all zero when the peer did not send one
+int parseTransferEnd(const FrameView *view, uint64_t *totalBytes, uint8_t *md5);
+
+// Wire buffer large enough for any frame under the given options
+size_t transferBufferSize(unsigned int options);
+
+#endif
@@ -0,0 +1,789 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <errno.h>
+#include <sys/time.h>
+#include "Protocol.h"
+#include "Common.h"
+#include "Log.h"
+#include "Stats.h"
+#include "Transfer.h"
+#include "Worker.h"
+
+static const WorkerSettings *settings = NULL;
+static int sockfd = -1; // Socket for Gotham connection
+#define GOTHAM_RETRY_MAX 32 // Longest wait, in seconds, between attempts to reconnect to Gotham
+static pthread_mutex_t gothamMutex = PTHREAD_MUTEX_INITIALIZER; // Serializes writes on the Gotham socket
+
+// Load figures reported to Gotham in every heartbeat
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+static int activeJobs = 0;
+static int queuedJobs = 0;
+static LatencyWindow jobTimes = {0};
+
+// Served with TYPE 0x13, counted atomically outside statsMutex
+typedef struct {
+    uint64_t jobsOk;
+    uint64_t jobsFailed;
+    uint64_t jobsCorrupt;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    uint64_t busyRejections;
+    Histogram jobMs;            // Whole connection: request, upload, distortion and result
+} WorkerStats;
+
+static WorkerStats stats = {0};
+
+// Bounded FIFO of accepted client sockets consumed by the thread pool
+typedef struct {
+    int *sockets;
+    int capacity;
+    int head;
+    int count;
+    pthread_mutex_t mutex;
+    pthread_cond_t notEmpty;
+} JobQueue;
+
+static JobQueue jobQueue = { .mutex = PTHREAD_MUTEX_INITIALIZER, .notEmpty = PTHREAD_COND_INITIALIZER };
+
+// Send a connection request to Gotham; -1 when the socket is already unusable
+static int sendConnectionRequest(const char *workerType, const char *ip, int port) {
+    uint8_t buffer[FRAME_SIZE];
+    size_t length = formatPayload(buffer, "%s&%s&%d&%u", workerType, ip, port, PROTO_SUPPORTED_CAPS);
+    finishFrame(buffer, 0x02, length); // Worker connection frame
+    if (send(sockfd, buffer, FRAME_SIZE, MSG_NOSIGNAL) < 0) {
+        perror("Error sending connection request to Gotham");
+        return -1;
+    }
+
+    // Gotham acknowledges with the capabilities it accepted (empty if it predates them)
+    FrameView ack;
+    if (receiveFrame(sockfd, buffer, sizeof(buffer), &ack) == FRAME_OK && ack.type == 0x02) {
+        if (protocolSetOptions(sockfd, ack.dataLength == 0 ? 0 : parseCapabilities(&ack)) < 0) {
+            LOG_INFO("Cannot keep the options negotiated with Gotham.\n");
+        }
+    } else {
+        LOG_INFO("Gotham did not acknowledge the connection.\n");
+    }
+    return 0;
+}
+
+// Send a disconnection request to Gotham
+static void sendDisconnectionRequest(const char *workerType) {
+    uint8_t buffer[FRAME_SIZE];
+    size_t size = buildFrameWith(buffer, 0x07, workerType, strlen(workerType), protocolGetOptions(sockfd)); // Disconnection frame
+    if (send(sockfd, buffer, size, MSG_NOSIGNAL) < 0) {
+        perror("Error sending disconnection request to Gotham");
+    }
+}
+
+// Open a connection to Gotham; the socket, or -3 / -4 when it cannot be created / connected
+static int connectToGotham(void) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("Socket creation failed");
+        return -3;
+    }
+
+    struct sockaddr_in serverAddr = {0};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(settings->gothamPort);
+    inet_pton(AF_INET, settings->gothamIp, &serverAddr.sin_addr);
+
+    if (connect(sock, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) {
+        perror("Connection to Gotham failed");
+        close(sock);
+        return -4;
+    }
+    return sock;
+}
+
+// The Gotham connection broke: connect and register again, waiting twice as long after each failed
+// attempt (up to GOTHAM_RETRY_MAX seconds), so a transient error does not leave the worker unlisted
+static void reconnectToGotham(void) {
+    pthread_mutex_lock(&gothamMutex);
+    protocolSetOptions(sockfd, 0);
+    close(sockfd);
+    sockfd = -1;
+    pthread_mutex_unlock(&gothamMutex);
+
+    unsigned int delay = 1;
+    while (1) {
+        LOG_INFO("Reconnecting to Gotham in %u s.\n", delay);
+        sleep(delay);
+        delay = (delay * 2 < GOTHAM_RETRY_MAX) ? delay * 2 : GOTHAM_RETRY_MAX;
+
+        int sock = connectToGotham();
+        if (sock < 0) {
+            continue;
+        }
+        pthread_mutex_lock(&gothamMutex);
+        sockfd = sock;
+        int registered = sendConnectionRequest(settings->workerType, settings->fleckIp, settings->fleckPort);
+        if (registered < 0) {
+            protocolSetOptions(sockfd, 0);
+            close(sockfd);
+            sockfd = -1;
+        }
+        pthread_mutex_unlock(&gothamMutex);
+        if (registered == 0) {
+            LOG_INFO("Reconnected to Gotham as %s worker.\n", settings->name);
+            return;
+        }
+    }
+}
+
+// Periodically report load to Gotham so it can route around busy or dead workers (TYPE: 0x12)
+static void *heartbeatLoop(void *arg) {
+    (void)arg;
+
+    while (1) {
+        uint8_t buffer[FRAME_SIZE];
+
+        Heartbeat heartbeat;
+        pthread_mutex_lock(&statsMutex);
+        heartbeat.queueDepth = queuedJobs;
+        heartbeat.activeJobs = activeJobs;
+        heartbeat.p99Ms = latencyPercentile(&jobTimes, 99);
+        pthread_mutex_unlock(&statsMutex);
+
+        pthread_mutex_lock(&gothamMutex);
+        unsigned int options = protocolGetOptions(sockfd);
+        size_t length;
+        if (options & PROTO_CAP_TLV) {
+            length = encodeHeartbeat(&heartbeat, framePayload(buffer), FRAME_DATA_SIZE);
+        } else {
+            length = formatPayload(buffer, "%u&%u&%u", heartbeat.queueDepth, heartbeat.activeJobs, heartbeat.p99Ms);
+        }
+        size_t size = finishFrameWith(buffer, 0x12, length, options);
+        ssize_t written = send(sockfd, buffer, size, MSG_NOSIGNAL);
+        pthread_mutex_unlock(&gothamMutex);
+        if (written < 0) {
+            perror("Error sending heartbeat to Gotham");
+            reconnectToGotham();
+            continue;
+        }
+
+        sleep(HEARTBEAT_INTERVAL);
+    }
+
+    return NULL;
+}
+
+// Elapsed milliseconds since a monotonic start time
+static unsigned int elapsedMs(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+// runJob() outcomes
+#define WORKER_JOB_OK 0
+#define WORKER_JOB_FAILED -1
+#define WORKER_JOB_CORRUPT -2
+
+// One frame's trip through a pipelined job: wire buffer in, distorted bytes out
+typedef struct {
+    uint8_t *wire;          // transferBufferSize() receive buffer, NULL marks the abort sentinel
+    const uint8_t *input;
+    size_t inputLength;
+    uint8_t *output;
+    size_t outputLength;
+    int final;
+} PipelineSlot;
+
+// Single-producer single-consumer ring of slots. Only WORKER_PIPELINE_DEPTH slots and one
+// sentinel exist, so it never fills and the producer needs no view of the head.
+// The semaphore counts ready entries and parks the consumer when there are none.
+#define SLOT_RING_SIZE 16
+
+typedef struct {
+    PipelineSlot *entries[SLOT_RING_SIZE];
+    uint32_t head;          // Consumer side only
+    uint32_t tail;          // Published by the producer
+    sem_t ready;
+} SlotRing;
+
+static void slotRingPush(SlotRing *ring, PipelineSlot *slot) {
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    ring->entries[tail % SLOT_RING_SIZE] = slot;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    sem_post(&ring->ready);
+}
+
+// Next slot, or NULL when none is ready and the caller does not want to wait
+static PipelineSlot *slotRingPop(SlotRing *ring, int wait) {
+    if (wait) {
+        while (sem_wait(&ring->ready) < 0 && errno == EINTR);
+    } else if (sem_trywait(&ring->ready) < 0) {
+        return NULL;
+    }
+    uint32_t head = ring->head;
+    while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head); // Posted after the store, never spins
+    ring->head = head + 1;
+    return ring->entries[head % SLOT_RING_SIZE];
+}
+
+typedef struct {
+    const WorkerStreamStage *stage;
+    void *state;
+    WorkerResult *result;
+    SlotRing toCompute;
+    SlotRing toNetwork;
+} Pipeline;
+
+// Compute stage: hash and distort slots in arrival order until the final one or the abort sentinel
+static void *computeStage(void *arg) {
+    Pipeline *pipeline = (Pipeline *)arg;
+
+    while (1) {
+        PipelineSlot *slot = slotRingPop(&pipeline->toCompute, 1);
+        if (slot->wire == NULL) {
+            break;
+        }
+        int final = slot->final;
+        md5Update(&pipeline->result->uploadHash, slot->input, slot->inputLength);
+        slot->outputLength = pipeline->stage->process(pipeline->state, slot->input, slot->inputLength,
+                                                      slot->output, final);
+        md5Update(&pipeline->result->resultHash, slot->output, slot->outputLength);
+        slotRingPush(&pipeline->toNetwork, slot);
+        if (final) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Network stage state, shared with the frame handler that runs while a send waits for room or ACKs
+typedef struct {
+    Pipeline *pipeline;
+    TransferSession *session;
+    PipelineSlot *freeSlots[WORKER_PIPELINE_DEPTH];
+    int freeCount;
+    uint64_t remaining;     // Upload bytes still to arrive
+} NetworkStage;
+
+// Hand a received upload frame (its payload already in the slot) to the compute stage and acknowledge it
+static int pushInput(NetworkStage *network, PipelineSlot *slot, const FrameView *view) {
+    if (view->type != 0x05 || view->dataLength == 0 || view->dataLength > network->remaining) {
+        return -1;
+    }
+    network->remaining -= view->dataLength;
+    slot->input = view->data;
+    slot->inputLength = view->dataLength;
+    slot->final = (network->remaining == 0);
+    slotRingPush(&network->pipeline->toCompute, slot);
+    return transferConsumed(network->session, network->remaining == 0);
+}
+
+// Upload frames arriving while a result is being sent go straight to compute when a slot is free,
+// so input keeps flowing while output is blocked; anything else is parked, keeping frames in order
+static int handleInputFrame(void *context, const FrameView *view) {
+    NetworkStage *network = (NetworkStage *)context;
+    if (view->type != 0x05 || network->remaining == 0 || network->freeCount == 0 ||
+            network->session->stashCount > 0) {
+        return TRANSFER_FRAME_PARK;
+    }
+    PipelineSlot *slot = network->freeSlots[--network->freeCount];
+    memcpy(framePayload(slot->wire), view->data, view->dataLength);
+    FrameView copy = *view;
+    copy.data = framePayload(slot->wire);
+    return pushInput(network, slot, &copy);
+}
+
+int runPipelinedJob(TransferSession *session, const WorkerJob *job, const WorkerStreamStage *stage, WorkerResult *jobResult) {
+    PipelineSlot slots[WORKER_PIPELINE_DEPTH] = {0};
+    PipelineSlot abortSlot = {0};
+    size_t bufferSize = transferBufferSize(session->options);
+    size_t outputSlack = 0;
+    Pipeline pipeline = { .stage = stage, .result = jobResult };
+    NetworkStage network = { .pipeline = &pipeline, .session = session, .remaining = job->fileSize };
+
+    pipeline.state = stage->start(job, &outputSlack);
+    if (pipeline.state == NULL) {
+        return -1;
+    }
+    int result = 0;
+    for (int i = 0; i < WORKER_PIPELINE_DEPTH; i++) {
+        slots[i].wire = malloc(bufferSize);
+        slots[i].output = malloc(bufferSize + outputSlack);
+        if (slots[i].wire == NULL || slots[i].output == NULL) {
+            result = -1;
+        }
+        network.freeSlots[network.freeCount++] = &slots[i];
+    }
+
+    pthread_t computeThread;
+    sem_init(&pipeline.toCompute.ready, 0, 0);
+    sem_init(&pipeline.toNetwork.ready, 0, 0);
+    if (result == 0 && pthread_create(&computeThread, NULL, computeStage, &pipeline) != 0) {
+        result = -1;
+    }
+
+    if (result == 0) {
+        int finished = 0;
+
+        if (network.remaining == 0) {
+            // Nothing to receive, but the stage still gets its final call
+            PipelineSlot *slot = network.freeSlots[--network.freeCount];
+            slot->input = slot->wire;
+            slot->inputLength = 0;
+            slot->final = 1;
+            slotRingPush(&pipeline.toCompute, slot);
+        }
+
+        // Network stage: send whatever is distorted, otherwise receive into a free slot.
+        // Block on the compute stage only when there is nothing left to receive or nowhere to put it.
+        session->onFrame = handleInputFrame;
+        session->context = &network;
+        while (result == 0 && !finished) {
+            PipelineSlot *slot = slotRingPop(&pipeline.toNetwork, network.remaining == 0 || network.freeCount == 0);
+            if (slot != NULL) {
+                jobResult->size += slot->outputLength;
+                if (transferSend(session, slot->output, slot->outputLength) < 0) {
+                    result = -1;
+                }
+                finished = slot->final;
+                network.freeSlots[network.freeCount++] = slot;
+                continue;
+            }
+
+            slot = network.freeSlots[--network.freeCount];
+            FrameView view;
+            if (transferReceive(session, slot->wire, &view) < 0 || pushInput(&network, slot, &view) < 0) {
+                result = -1;
+            }
+        }
+        session->onFrame = NULL;
+        session->context = NULL;
+
+        if (result < 0) {
+            slotRingPush(&pipeline.toCompute, &abortSlot);
+        }
+        pthread_join(computeThread, NULL);
+    }
+
+    sem_destroy(&pipeline.toCompute.ready);
+    sem_destroy(&pipeline.toNetwork.ready);
+    for (int i = 0; i < WORKER_PIPELINE_DEPTH; i++) {
+        free(slots[i].wire);
+        free(slots[i].output);
+    }
+    stage->finish(pipeline.state);
+    return result;
+}
+
+// Fleck's end frame after the upload (PROTO_CAP_MD5): its size and MD5 must match what arrived
+static int checkUploadEnd(TransferSession *session, const WorkerJob *job, const uint8_t *uploadMd5) {
+    uint8_t *buffer = malloc(transferBufferSize(session->options));
+    uint8_t announced[MD5_SIZE];
+    uint64_t totalBytes;
+    FrameView view;
+    int result = -1;
+
+    if (buffer != NULL && transferReceive(session, buffer, &view) == 0 && view.type == 0x06 &&
+            parseTransferEnd(&view, &totalBytes, announced) == 0 && totalBytes == job->fileSize &&
+            memcmp(announced, uploadMd5, MD5_SIZE) == 0) {
+        result = 0;
+    }
+    free(buffer);
+    return result;
+}
+
+// Run the job on a transfer session and close the result stream (TYPE: 0x06) with the result's MD5.
+// An upload that does not match the MD5 of the request or of Fleck's end frame gets no end frame,
+// so Fleck discards the result.
+static int runJob(int clientSock, const WorkerJob *job, WorkerResult *jobResult) {
+    TransferSession session;
+    if (transferSessionInit(&session, clientSock, job->window) < 0) {
+        return WORKER_JOB_FAILED;
+    }
+
+    jobResult->size = 0;
+    md5Init(&jobResult->uploadHash);
+    md5Init(&jobResult->resultHash);
+    int result = (settings->handler(&session, job, jobResult) == 0) ? WORKER_JOB_OK : WORKER_JOB_FAILED;
+
+    uint8_t uploadMd5[MD5_SIZE], resultMd5[MD5_SIZE];
+    md5Final(&jobResult->uploadHash, uploadMd5);
+    md5Final(&jobResult->resultHash, resultMd5);
+    if (result == WORKER_JOB_OK && (session.options & PROTO_CAP_MD5) && checkUploadEnd(&session, job, uploadMd5) < 0) {
+        result = WORKER_JOB_CORRUPT;
+    }
+    if (result == WORKER_JOB_OK && md5IsKnown(job->md5) && memcmp(job->md5, uploadMd5, MD5_SIZE) != 0) {
+        result = WORKER_JOB_CORRUPT;
+    }
+
+    if (result == WORKER_JOB_OK &&
+            (transferSendEnd(&session, jobResult->size, resultMd5) < 0 || transferFlush(&session) < 0)) {
+        result = WORKER_JOB_FAILED;
+    }
+
+    transferSessionDestroy(&session);
+    return result;
+}
+
+// Handle distortion requests from Fleck
+static void handleDistortionRequest(const Frame *receivedFrame, int clientSock) {
+    WorkerJob job = {0};
+    char fileSize[32] = {0};
+    char factor[32] = {0};
+    unsigned int capabilities = 0;
+    int fields;
+
+    if (isTlvPayload((const uint8_t *)receivedFrame->data, receivedFrame->dataLength)) {
+        // Only peers that negotiate capabilities speak TLV, so the ack always carries them
+        JobRequest request;
+        if (decodeJobRequest((const uint8_t *)receivedFrame->data, receivedFrame->dataLength, &request) < 0) {
+            perror("Invalid distortion request data\n");
+            return;
+        }
+        strcpy(job.username, request.username);
+        strcpy(job.fileName, request.fileName);
+        snprintf(fileSize, sizeof(fileSize), "%llu", (unsigned long long)request.fileSize);
+        md5ToHex(request.md5, job.md5sum);
+        snprintf(factor, sizeof(factor), "%u", request.factor);
+        capabilities = request.capabilities;
+        job.window = request.window;
+        fields = 7;
+    } else {
+        // Parse the distortion request data (capabilities and transfer window are optional)
+        fields = sscanf(receivedFrame->data, "%127[^&]&%127[^&]&%31[^&]&%32[^&]&%31[^&]&%u&%u",
+                        job.username, job.fileName, fileSize, job.md5sum, factor, &capabilities, &job.window);
+        if (fields < 5) {
+            perror("Invalid distortion request data\n");
+            return;
+        }
+    }
+    job.fileSize = strtoull(fileSize, NULL, 10);
+    job.factor = strtoul(factor, NULL, 10);
+    md5FromHex(job.md5sum, job.md5); // Placeholders such as "<MD5SUM>" leave it unknown
+
+    uint8_t buffer[FRAME_SIZE];
+    unsigned int accepted = negotiateSocketCapabilities(clientSock, capabilities);
+    // Clients without a transfer window predate file transfer: acknowledge only
+    if (fields < 7) {
+        finishFrame(buffer, 0x03, (fields == 6) ? formatPayload(buffer, "%u", accepted) : 0); // Distortion acknowledgment
+        if (write(clientSock, buffer, FRAME_SIZE) < 0) {
+            perror("Error sending distortion response to Fleck");
+        }
+        return;
+    }
+
+    // Accept with the negotiated capabilities; the transfer runs on them
+    finishFrame(buffer, 0x03, formatPayload(buffer, "%u", accepted)); // Distortion acknowledgment
+    if (write(clientSock, buffer, FRAME_SIZE) < 0) {
+        perror("Error sending distortion response to Fleck");
+        return;
+    }
+    protocolSetOptions(clientSock, accepted);
+
+    WorkerResult jobResult;
+    switch (runJob(clientSock, &job, &jobResult)) {
+        case WORKER_JOB_OK:
+            statsAdd(&stats.jobsOk, 1);
+            statsAdd(&stats.bytesIn, job.fileSize);
+            statsAdd(&stats.bytesOut, jobResult.size);
+            LOG_INFO("Distorted %s for %s: %llu bytes in, %llu bytes out.\n", job.fileName, job.username,
+                (unsigned long long)job.fileSize, (unsigned long long)jobResult.size);
+            break;
+        case WORKER_JOB_CORRUPT:
+            statsAdd(&stats.jobsCorrupt, 1);
+            LOG_INFO("Upload of %s for %s failed its MD5 check, result discarded.\n", job.fileName, job.username);
+            break;
+        default:
+            statsAdd(&stats.jobsFailed, 1);
+            LOG_INFO("Distortion of %s for %s failed.\n", job.fileName, job.username);
+            break;
+    }
+}
+
+// Reply to a stats request (TYPE: 0x13) on a Fleck connection
+static void handleStatsRequest(int clientSock) {
+    char *text = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&text, &length);
+    if (out == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&statsMutex);
+    int active = activeJobs, queued = queuedJobs;
+    pthread_mutex_unlock(&statsMutex);
+
+    statsWriteCounter(out, "jobs.active", active);
+    statsWriteCounter(out, "jobs.queued", queued);
+    statsWriteCounter(out, "jobs.ok", statsLoad(&stats.jobsOk));
+    statsWriteCounter(out, "jobs.failed", statsLoad(&stats.jobsFailed));
+    statsWriteCounter(out, "jobs.corrupt", statsLoad(&stats.jobsCorrupt));
+    statsWriteCounter(out, "jobs.busy_rejections", statsLoad(&stats.busyRejections));
+    statsWriteCounter(out, "bytes.in", statsLoad(&stats.bytesIn));
+    statsWriteCounter(out, "bytes.out", statsLoad(&stats.bytesOut));
+    TransferCounters transferCounters;
+    transferGetCounters(&transferCounters);
+    statsWriteCounter(out, "bytes.unchecked", transferCounters.uncheckedBytes);
+    statsWriteHistogram(out, "job_ms", &stats.jobMs);
+
+    LogCounters logCounters;
+    logGetCounters(&logCounters);
+    statsWriteCounter(out, "log.records", logCounters.records);
+    statsWriteCounter(out, "log.stalls", logCounters.stalls);
+    fclose(out);
+
+    if (statsSend(clientSock, text, length) < 0) {
+        perror("Error sending stats to Fleck");
+    }
+    free(text);
+}
+
+// Serve one accepted Fleck connection: read its request and run the job
+static void serveConnection(int clientSock) {
+    uint8_t buffer[FRAME_SIZE];
+    FrameView view;
+    int result = receiveFrame(clientSock, buffer, sizeof(buffer), &view);
+    if (result == FRAME_CLOSED) {
+        perror("Invalid frame size received\n");
+        close(clientSock);
+        return;
+    }
+    if (result != FRAME_OK) {
+        perror("Checksum mismatch\n");
+        close(clientSock);
+        return;
+    }
+
+    if (view.type == 0x03) { // Distortion request
+        Frame receivedFrame;
+        frameFromView(&view, &receivedFrame);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_mutex_lock(&statsMutex);
+        activeJobs++;
+        pthread_mutex_unlock(&statsMutex);
+
+        handleDistortionRequest(&receivedFrame, clientSock);
+
+        unsigned int milliseconds = elapsedMs(&start);
+        pthread_mutex_lock(&statsMutex);
+        activeJobs--;
+        latencyRecord(&jobTimes, milliseconds);
+        pthread_mutex_unlock(&statsMutex);
+        histogramRecord(&stats.jobMs, milliseconds);
+    } else if (view.type == 0x13) {
+        handleStatsRequest(clientSock);
+    } else {
+        perror("Unexpected frame type received\n");
+    }
+
+    protocolSetOptions(clientSock, 0);
+    close(clientSock);
+}
+
+// Queue an accepted connection; fails when every slot is taken
+static int enqueueConnection(int clientSock) {
+    pthread_mutex_lock(&jobQueue.mutex);
+    if (jobQueue.count == jobQueue.capacity) {
+        pthread_mutex_unlock(&jobQueue.mutex);
+        return -1;
+    }
+    jobQueue.sockets[(jobQueue.head + jobQueue.count) % jobQueue.capacity] = clientSock;
+    jobQueue.count++;
+    pthread_cond_signal(&jobQueue.notEmpty);
+    pthread_mutex_unlock(&jobQueue.mutex);
+
+    pthread_mutex_lock(&statsMutex);
+    queuedJobs++;
+    pthread_mutex_unlock(&statsMutex);
+    return 0;
+}
+
+// Thread pool body: take the oldest queued connection and serve it
+static void *poolWorker(void *arg) {
+    (void)arg;
+
+    while (1) {
+        pthread_mutex_lock(&jobQueue.mutex);
+        while (jobQueue.count == 0) {
+            pthread_cond_wait(&jobQueue.notEmpty, &jobQueue.mutex);
+        }
+        int clientSock = jobQueue.sockets[jobQueue.head];
+        jobQueue.head = (jobQueue.head + 1) % jobQueue.capacity;
+        jobQueue.count--;
+        pthread_mutex_unlock(&jobQueue.mutex);
+
+        pthread_mutex_lock(&statsMutex);
+        queuedJobs--;
+        pthread_mutex_unlock(&statsMutex);
+
+        serveConnection(clientSock);
+    }
+
+    return NULL;
+}
+
+// Rejections allowed to wait for their request at once; beyond that BUSY goes out without waiting
+#define MAX_REJECT_THREADS 16
+
+static int rejectThreads = 0;
+
+// Refuse a job (TYPE: 0x03, "BUSY")
+static void sendBusy(int clientSock) {
+    uint8_t buffer[FRAME_SIZE];
+    statsAdd(&stats.busyRejections, 1);
+    buildFrame(buffer, 0x03, "BUSY", strlen("BUSY"));
+    if (write(clientSock, buffer, FRAME_SIZE) < 0) {
+        perror("Error sending busy reply to Fleck");
+    }
+}
+
+// The request is read first so closing the socket does not reset the reply away;
+// stats requests are cheap and still answered, a saturated worker is when they matter most.
+static void *rejectBusyThread(void *arg) {
+    int clientSock = (int)(intptr_t)arg;
+    uint8_t buffer[FRAME_SIZE];
+    FrameView view;
+    struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+
+    setsockopt(clientSock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (receiveFrame(clientSock, buffer, sizeof(buffer), &view) == FRAME_OK && view.type == 0x13) {
+        handleStatsRequest(clientSock);
+    } else {
+        sendBusy(clientSock);
+    }
+    close(clientSock);
+    __atomic_sub_fetch(&rejectThreads, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// Turn a connection away while the queue is full, without making the accept loop wait for the client
+static void rejectBusy(int clientSock) {
+    pthread_t thread;
+    if (__atomic_add_fetch(&rejectThreads, 1, __ATOMIC_RELAXED) <= MAX_REJECT_THREADS &&
+        pthread_create(&thread, NULL, rejectBusyThread, (void *)(intptr_t)clientSock) == 0) {
+        pthread_detach(thread);
+        return;
+    }
+    __atomic_sub_fetch(&rejectThreads, 1, __ATOMIC_RELAXED);
+
+    // Discard whatever request already arrived, without waiting for more, then refuse
+    uint8_t discard[FRAME_SIZE];
+    while (recv(clientSock, discard, sizeof(discard), MSG_DONTWAIT) > 0) {
+    }
+    sendBusy(clientSock);
+    close(clientSock);
+}
+
+// Accept distortion connections and hand them to the thread pool
+static void *acceptLoop(void *arg) {
+    (void)arg;
+
+    jobQueue.capacity = settings->queueCapacity;
+    jobQueue.sockets = malloc(jobQueue.capacity * sizeof(int));
+    if (jobQueue.sockets == NULL) {
+        perror("Job queue allocation failed");
+        return NULL;
+    }
+
+    for (int i = 0; i < settings->poolSize; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, poolWorker, NULL) != 0) {
+            perror("Failed to create pool thread");
+            return NULL;
+        }
+        pthread_detach(thread);
+    }
+
+    int serverSock = socket(AF_INET, SOCK_STREAM, 0);
+    if (serverSock < 0) {
+        perror("Socket creation failed for worker");
+        return NULL;
+    }
+
+    // Allow an immediate restart while old connections sit in TIME_WAIT
+    int reuse = 1;
+    setsockopt(serverSock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in serverAddr = {0};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(settings->fleckPort);
+    serverAddr.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(serverSock, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) {
+        perror("Bind failed for worker");
+        close(serverSock);
+        return NULL;
+    }
+
+    if (listen(serverSock, jobQueue.capacity) < 0) {
+        perror("Listen failed for worker");
+        close(serverSock);
+        return NULL;
+    }
+
+    LOG_INFO("Waiting for connections with %d pool thread(s)...\n", settings->poolSize);
+
+    while (1) {
+        struct sockaddr_in clientAddr;
+        socklen_t addrLen = sizeof(clientAddr);
+        int clientSock = accept(serverSock, (struct sockaddr *)&clientAddr, &addrLen);
+
+        if (clientSock < 0) {
+            perror("Accept failed");
+            continue;
+        }
+
+        LOG_INFO("Accepted connection from %s:%d\n",
+               inet_ntoa(clientAddr.sin_addr), ntohs(clientAddr.sin_port));
+
+        if (enqueueConnection(clientSock) < 0) {
+            LOG_INFO("Job queue full, replying BUSY.\n");
+            rejectBusy(clientSock);
+        }
+    }
+
+    close(serverSock);
+    return NULL;
+}
+
+int runWorker(const WorkerSettings *workerSettings) {
+    settings = workerSettings;
+
+    sockfd = connectToGotham();
+    if (sockfd < 0) {
+        return sockfd;
+    }
+
+    sendConnectionRequest(settings->workerType, settings->fleckIp, settings->fleckPort);
+
+    LOG_INFO("Connected to Gotham as %s worker, ready to distort %s.\n", settings->name, settings->media);
+
+    pthread_t heartbeatThread;
+    if (pthread_create(&heartbeatThread, NULL, heartbeatLoop, NULL) != 0) {
+        perror("Failed to create heartbeat thread");
+    } else {
+        pthread_detach(heartbeatThread);
+    }
+
+    pthread_t workerThread;
+    pthread_create(&workerThread, NULL, acceptLoop, NULL);
+
+    pthread_join(workerThread, NULL);
+
+    pthread_mutex_lock(&gothamMutex);
+    if (sockfd != -1) {
+        sendDisconnectionRequest(settings->workerType);
+        LOG_INFO("Disconnecting from Gotham.\n");
+        close(sockfd);
+        sockfd = -1;
+    }
+    pthread_mutex_unlock(&gothamMutex);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <stdint.h>
+#include "Transfer.h"
+
+// Distortion job announced by Fleck (TYPE: 0x03)
+typedef struct {
+    char username[128];
+    char fileName[128];
+    uint64_t fileSize;
+    char md5sum[33];
+    uint8_t md5[MD5_SIZE];      // Parsed md5sum, all zero when Fleck did not know it
+    unsigned int factor;
+    unsigned int window;
+} WorkerJob;
+
+// What a handler reports back: result bytes sent and running MD5s of both directions
+typedef struct {
+    uint64_t size;
+    Md5Context uploadHash;      // Every upload byte, in order
+    Md5Context resultHash;      // Every result byte, in order
+} WorkerResult;
+
+// Consume job->fileSize bytes of data frames from the session and transferSend() the result,
+// folding both into the job result's hashes. The end frame, the upload MD5 check and the final
+// flush are done by the worker framework.
+typedef int (*WorkerJobHandler)(TransferSession *session, const WorkerJob *job, WorkerResult *result);
+
+// Chunk-by-chunk distortion for runPipelinedJob(). start() returns the job state and the extra
+// output room process() may need beyond its input; process() is called once per data frame
+// in order, with final set on the last one (a single empty final call for an empty upload).
+typedef struct {
+    void *(*start)(const WorkerJob *job, size_t *outputSlack);
+    size_t (*process)(void *state, const uint8_t *input, size_t length, uint8_t *output, int final);
+    void (*finish)(void *state);
+} WorkerStreamStage;
+
+// Reusable frame buffers in flight per pipelined job
+#define WORKER_PIPELINE_DEPTH 8
+
+// Run a streaming job as concurrent stages: the calling thread receives and sends frames while a
+// compute thread hashes and distorts them, connected by lock-free queues of WORKER_PIPELINE_DEPTH buffers.
+// Upload frames arriving while a result send waits are fed to compute from inside the send, so
+// receiving, sending and computing all overlap and job time tends to the slowest of them.
+int runPipelinedJob(TransferSession *session, const WorkerJob *job, const WorkerStreamStage *stage, WorkerResult *result);
+
+typedef struct {
+    const char *name;          // Process name used in messages ("Enigma", "Harley")
+    const char *media;         // What it distorts, for messages
+    const char *gothamIp;
+    int gothamPort;
+    const char *workerType;    // Registry Gotham files the worker under
+    const char *fleckIp;
+    int fleckPort;
+    int poolSize;
+    int queueCapacity;
+    WorkerJobHandler handler;
+} WorkerSettings;
+
+// Register with Gotham, report load and serve jobs from a thread pool; returns main's exit code
+int runWorker(const WorkerSettings *settings);
+
+#endif